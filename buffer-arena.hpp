@@ -0,0 +1,66 @@
+#pragma once
+// Free-list sub-allocator for one large GPU buffer. Works in abstract units
+// (the game uses vertices) and knows nothing about GL: the renderer owns
+// the buffer and decides when a freed range is safe to hand out again.
+#include <cstdint>
+#include <iterator>
+#include <map>
+
+class ArenaAllocator {
+public:
+    explicit ArenaAllocator(uint32_t capacity = 0) { grow(capacity); }
+
+    // First fit; returns false if no free range is large enough
+    bool allocate(uint32_t count, uint32_t& first) {
+        if (!count) return false;
+        for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+            if (it->second < count) continue;
+            first = it->first;
+            uint32_t left = it->second - count;
+            freeRanges.erase(it);
+            if (left) freeRanges[first + count] = left;
+            usedUnits += count;
+            return true;
+        }
+        return false;
+    }
+
+    // Returns a range, merging it with free neighbours
+    void free(uint32_t first, uint32_t count) {
+        if (!count) return;
+        usedUnits -= count;
+        auto next = freeRanges.lower_bound(first);
+        if (next != freeRanges.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == first) {
+                first = prev->first;
+                count += prev->second;
+                freeRanges.erase(prev);
+            }
+        }
+        if (next != freeRanges.end() && first + count == next->first) {
+            count += next->second;
+            freeRanges.erase(next);
+        }
+        freeRanges[first] = count;
+    }
+
+    // Adds [capacity, newCapacity) as free space
+    void grow(uint32_t newCapacity) {
+        if (newCapacity <= total) return;
+        uint32_t added = newCapacity - total;
+        uint32_t start = total;
+        total = newCapacity;
+        usedUnits += added;  // free() subtracts it again
+        free(start, added);
+    }
+
+    uint32_t capacity() const { return total; }
+    uint32_t used() const { return usedUnits; }
+    size_t freeRangeCount() const { return freeRanges.size(); }
+
+private:
+    std::map<uint32_t, uint32_t> freeRanges;  // first -> count
+    uint32_t total = 0;
+    uint32_t usedUnits = 0;
+};
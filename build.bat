@@ -6,8 +6,8 @@ set GLFW_INC="C:\glfw\include"
 set GLFW_LIB="C:\glfw\lib-mingw-w64"
 
 :: === Common compiler/linker flags ===
-set CFLAGS=-I%GLFW_INC% 
-set LFLAGS=-L%GLFW_LIB% -lglfw3 -lopengl32 -lgdi32 -luser32 -lglu32 -lwinmm
+set CFLAGS=-O3 -I%GLFW_INC% 
+set LFLAGS=-L%GLFW_LIB% -lglfw3 -lopengl32 -lgdi32 -luser32 -lglu32 -lwinmm -lws2_32
 
 :: === Count cpp files ===
 set count=0
@@ -36,7 +36,15 @@ if %count% equ 1 (
     if defined file%choice% (
         set selectedfile=!file%choice%!
         echo Building !selectedfile!...
-        g++ "!selectedfile!" -o "!selectedfile:~0,-4!.exe" %CFLAGS% %LFLAGS%
+        if /i "!selectedfile!"=="world-tool.cpp" (
+            rem Offline tool, no window or GL
+            g++ "!selectedfile!" -o "!selectedfile:~0,-4!.exe" -O3
+        ) else if /i "!selectedfile!"=="world-server.cpp" (
+            rem Headless server, no window or GL
+            g++ "!selectedfile!" -o "!selectedfile:~0,-4!.exe" -O3 -lws2_32
+        ) else (
+            g++ "!selectedfile!" ../engine-thingy/glad/glad.c -o "!selectedfile:~0,-4!.exe" %CFLAGS% %LFLAGS%
+        )
     ) else (
         echo Invalid selection!
     )
@@ -1 +1,3 @@
-g++ main.cpp ../engine-thingy/glad/glad.c -o app -lglfw -ldl -lGL -lpthread
+g++ -O3 main.cpp ../engine-thingy/glad/glad.c -o app -lglfw -ldl -lGL -lpthread
+g++ -O3 world-tool.cpp -o world-tool -lpthread
+g++ -O3 world-server.cpp -o world-server -lpthread
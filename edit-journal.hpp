@@ -0,0 +1,170 @@
+#pragma once
+// Write-ahead journal of block edits. Every place/break is appended as a
+// small fixed-size record and flushed once per frame, so a crash loses at
+// most the current frame. Bulk box edits take two records, however many
+// blocks they change. Records carry a checksum; a torn record at the end of
+// the file (crash mid-write) ends the replay.
+#include "region-storage.hpp"
+
+const uint32_t JOURNAL_MAGIC = 0x4C4A5042;  // "BPJL"
+const uint32_t JOURNAL_VERSION = 1;
+const size_t JOURNAL_HEADER_SIZE = 8;
+const size_t JOURNAL_RECORD_SIZE = 24;  // op, rotate, 2 unused, x, y, z, color, checksum
+const uint8_t JOURNAL_BOX_END = 0x80;   // op flag of the second record of a box edit
+
+struct JournalEdit {
+    // Fill and later ops cover the box [x, x1] x [y, y1] x [z, z1]:
+    // Fill sets every block to color, Hollow sets the box's shell and clears
+    // its inside, Clear removes every block, Replace turns blocks of color
+    // into color1
+    enum Op : uint8_t { Place = 1, Break = 2, Fill = 3, Hollow = 4, Clear = 5, Replace = 6 };
+    Op op = Place;
+    bool rotate = false;
+    int32_t x = 0, y = 0, z = 0;
+    uint32_t color = 0;  // 0xRRGGBB, unused for Break and Clear
+    int32_t x1 = 0, y1 = 0, z1 = 0;
+    uint32_t color1 = 0;
+};
+
+inline bool isBoxEdit(JournalEdit::Op op) {
+    return op >= JournalEdit::Fill && op <= JournalEdit::Replace;
+}
+
+// Appends the intact records of the journal at path to edits, and sets
+// intactBytes to where they end. Returns false if there is no readable
+// journal there.
+inline bool readJournal(const std::string& path, std::vector<JournalEdit>& edits, size_t* intactBytes = nullptr) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (data.size() < JOURNAL_HEADER_SIZE || getU32(data.data()) != JOURNAL_MAGIC ||
+        getU32(data.data() + 4) != JOURNAL_VERSION) {
+        return false;
+    }
+    auto intact = [&](size_t at) {
+        const uint8_t* r = data.data() + at;
+        return at + JOURNAL_RECORD_SIZE <= data.size() &&
+               fnv1a(r, JOURNAL_RECORD_SIZE - 4) == getU32(r + JOURNAL_RECORD_SIZE - 4);
+    };
+    size_t at = JOURNAL_HEADER_SIZE;
+    for (; intact(at); at += JOURNAL_RECORD_SIZE) {
+        const uint8_t* r = data.data() + at;
+        JournalEdit::Op op = (JournalEdit::Op)r[0];
+        if (op != JournalEdit::Place && op != JournalEdit::Break && !isBoxEdit(op)) break;
+        JournalEdit edit;
+        edit.op = op;
+        edit.rotate = r[1] != 0;
+        edit.x = (int32_t)getU32(r + 4);
+        edit.y = (int32_t)getU32(r + 8);
+        edit.z = (int32_t)getU32(r + 12);
+        edit.color = getU32(r + 16);
+        if (isBoxEdit(op)) {
+            // A box edit whose second half is missing never happened
+            size_t second = at + JOURNAL_RECORD_SIZE;
+            if (!intact(second)) break;
+            const uint8_t* end = data.data() + second;
+            if (end[0] != (op | JOURNAL_BOX_END)) break;
+            edit.x1 = (int32_t)getU32(end + 4);
+            edit.y1 = (int32_t)getU32(end + 8);
+            edit.z1 = (int32_t)getU32(end + 12);
+            edit.color1 = getU32(end + 16);
+            at = second;
+        }
+        edits.push_back(edit);
+    }
+    if (intactBytes) *intactBytes = at;
+    return true;
+}
+
+class EditJournal {
+public:
+    ~EditJournal() { close(); }
+
+    // Starts a new, empty journal at path (replay any old one first). With
+    // keep, a journal already there keeps its intact records and new ones
+    // go after them; only a torn tail is cut off.
+    bool open(const std::string& newPath, bool keep = false) {
+        close();
+        path = newPath;
+        edits = 0;
+        std::vector<JournalEdit> kept;
+        size_t intactBytes = 0;
+        if (keep && readJournal(path, kept, &intactBytes)) {
+            std::error_code ec;
+            std::filesystem::resize_file(path, intactBytes, ec);
+            if (ec) return false;
+            file = std::fopen(path.c_str(), "ab");
+            edits = kept.size();
+            return file != nullptr;
+        }
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) return false;
+        std::vector<uint8_t> header;
+        putU32(header, JOURNAL_MAGIC);
+        putU32(header, JOURNAL_VERSION);
+        std::fwrite(header.data(), 1, header.size(), file);
+        std::fflush(file);
+        return true;
+    }
+
+    void close() {
+        if (!file) return;
+        flush();
+        std::fclose(file);
+        file = nullptr;
+    }
+
+    bool isOpen() const { return file != nullptr; }
+    size_t size() const { return edits; }
+
+    void append(const JournalEdit& edit) {
+        if (!file) return;
+        appendRecord(edit.op, edit.rotate, edit.x, edit.y, edit.z, edit.color);
+        if (isBoxEdit(edit.op)) appendRecord(edit.op | JOURNAL_BOX_END, false, edit.x1, edit.y1, edit.z1, edit.color1);
+        edits++;
+    }
+
+    // Hands buffered records to the OS, which keeps them if the game crashes
+    bool flush() {
+        if (!file || pending.empty()) return true;
+        bool ok = std::fwrite(pending.data(), 1, pending.size(), file) == pending.size();
+        ok = std::fflush(file) == 0 && ok;
+        pending.clear();
+        return ok;
+    }
+
+    // Closes this journal, renames it to rotatedPath and starts a new one
+    // in its place, so edits up to now can be folded into the store while
+    // newer ones keep being logged
+    bool rotate(const std::string& rotatedPath) {
+        std::string current = path;
+        close();
+        std::error_code ec;
+        std::filesystem::rename(current, rotatedPath, ec);
+        if (ec) {
+            // Keep appending to the old file rather than truncating it
+            file = std::fopen(current.c_str(), "ab");
+            return false;
+        }
+        return open(current);
+    }
+
+private:
+    void appendRecord(uint8_t op, bool rotate, int32_t x, int32_t y, int32_t z, uint32_t color) {
+        size_t start = pending.size();
+        pending.push_back(op);
+        pending.push_back(rotate);
+        pending.push_back(0);
+        pending.push_back(0);
+        putU32(pending, (uint32_t)x);
+        putU32(pending, (uint32_t)y);
+        putU32(pending, (uint32_t)z);
+        putU32(pending, color);
+        putU32(pending, fnv1a(pending.data() + start, JOURNAL_RECORD_SIZE - 4));
+    }
+
+    FILE* file = nullptr;
+    std::string path;
+    std::vector<uint8_t> pending;
+    size_t edits = 0;
+};
@@ -0,0 +1,196 @@
+#pragma once
+// Compact log of everything that drives a session: per frame the time
+// step, the camera orientation, the held keys and buttons, and which
+// streamed chunks were taken in (streaming runs on worker threads, so that
+// is not otherwise reproducible). Replaying a log against a copy of the
+// world it was recorded in rebuilds the same world state frame for frame;
+// a hash of that state closes the log so replays can be checked against it.
+#include "region-storage.hpp"
+
+const uint32_t RECORDING_MAGIC = 0x52495042;  // "BPIR"
+const uint32_t RECORDING_VERSION = 1;
+
+// Frame record flags
+const uint8_t RECORD_KEYS = 1;         // held keys changed
+const uint8_t RECORD_ORIENTATION = 2;  // yaw or pitch changed
+const uint8_t RECORD_CHUNKS = 4;       // chunks were integrated
+const uint8_t RECORD_END = 0x80;       // closing record: world hash
+
+struct RecordingHeader {
+    uint64_t seed = 0;
+    float x = 0, y = 0, z = 0, yaw = 0, pitch = 0;
+    int32_t viewDistance = 0;
+    int32_t hotbarSlot = 0;
+    uint64_t chunkCacheBytes = 0;  // eviction order depends on it
+};
+
+struct RecordedFrame {
+    float deltaTime = 0;
+    float yaw = 0, pitch = 0;
+    uint64_t keys = 0;                 // bit per entry of the game's recorded key list
+    std::vector<int64_t> chunks;       // chunkKey of every streamed chunk taken in, in order
+};
+
+inline void putF32(std::vector<uint8_t>& out, float v) {
+    uint32_t bits;
+    std::memcpy(&bits, &v, 4);
+    putU32(out, bits);
+}
+
+inline float getF32(const uint8_t* p) {
+    uint32_t bits = getU32(p);
+    float v;
+    std::memcpy(&v, &bits, 4);
+    return v;
+}
+
+// Frames are buffered and written every RECORDING_FLUSH_FRAMES, so a crash
+// loses at most that many
+const int RECORDING_FLUSH_FRAMES = 60;
+
+class InputRecorder {
+public:
+    ~InputRecorder() { close(0); }
+
+    bool open(const std::string& path, const RecordingHeader& header) {
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) return false;
+        std::vector<uint8_t> out;
+        putU32(out, RECORDING_MAGIC);
+        putU32(out, RECORDING_VERSION);
+        putU32(out, (uint32_t)header.seed);
+        putU32(out, (uint32_t)(header.seed >> 32));
+        for (float v : {header.x, header.y, header.z, header.yaw, header.pitch}) putF32(out, v);
+        putU32(out, (uint32_t)header.viewDistance);
+        putU32(out, (uint32_t)header.hotbarSlot);
+        putU32(out, (uint32_t)header.chunkCacheBytes);
+        putU32(out, (uint32_t)(header.chunkCacheBytes >> 32));
+        std::fwrite(out.data(), 1, out.size(), file);
+        last = RecordedFrame();
+        last.yaw = header.yaw;
+        last.pitch = header.pitch;
+        frames = 0;
+        return true;
+    }
+
+    bool isOpen() const { return file != nullptr; }
+
+    void append(const RecordedFrame& frame) {
+        if (!file) return;
+        uint8_t flags = 0;
+        if (frame.keys != last.keys) flags |= RECORD_KEYS;
+        if (frame.yaw != last.yaw || frame.pitch != last.pitch) flags |= RECORD_ORIENTATION;
+        if (!frame.chunks.empty()) flags |= RECORD_CHUNKS;
+        pending.push_back(flags);
+        putF32(pending, frame.deltaTime);
+        if (flags & RECORD_ORIENTATION) {
+            putF32(pending, frame.yaw);
+            putF32(pending, frame.pitch);
+        }
+        if (flags & RECORD_KEYS) {
+            putVarint(pending, (uint32_t)frame.keys);
+            putVarint(pending, (uint32_t)(frame.keys >> 32));
+        }
+        if (flags & RECORD_CHUNKS) {
+            putVarint(pending, (uint32_t)frame.chunks.size());
+            for (int64_t key : frame.chunks) {
+                putVarint(pending, zigzag((int32_t)(key >> 32)));
+                putVarint(pending, zigzag((int32_t)(uint32_t)key));
+            }
+        }
+        last = frame;
+        if (++frames % RECORDING_FLUSH_FRAMES == 0) flush();
+    }
+
+    // Ends the log with the hash of the world state after the last frame
+    void close(uint64_t worldHash) {
+        if (!file) return;
+        pending.push_back(RECORD_END);
+        putU32(pending, (uint32_t)worldHash);
+        putU32(pending, (uint32_t)(worldHash >> 32));
+        flush();
+        std::fclose(file);
+        file = nullptr;
+    }
+
+private:
+    void flush() {
+        std::fwrite(pending.data(), 1, pending.size(), file);
+        std::fflush(file);
+        pending.clear();
+    }
+
+    FILE* file = nullptr;
+    std::vector<uint8_t> pending;
+    RecordedFrame last;
+    size_t frames = 0;
+};
+
+// Reads a log written by InputRecorder. A log cut short by a crash gives
+// the frames up to the cut and hasWorldHash false.
+inline bool readInputRecording(const std::string& path, RecordingHeader& header, std::vector<RecordedFrame>& frames,
+                               bool& hasWorldHash, uint64_t& worldHash) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const size_t headerBytes = 52;
+    if (data.size() < headerBytes || getU32(&data[0]) != RECORDING_MAGIC || getU32(&data[4]) != RECORDING_VERSION) {
+        return false;
+    }
+    header.seed = getU32(&data[8]) | (uint64_t)getU32(&data[12]) << 32;
+    header.x = getF32(&data[16]);
+    header.y = getF32(&data[20]);
+    header.z = getF32(&data[24]);
+    header.yaw = getF32(&data[28]);
+    header.pitch = getF32(&data[32]);
+    header.viewDistance = (int32_t)getU32(&data[36]);
+    header.hotbarSlot = (int32_t)getU32(&data[40]);
+    header.chunkCacheBytes = getU32(&data[44]) | (uint64_t)getU32(&data[48]) << 32;
+
+    hasWorldHash = false;
+    frames.clear();
+    RecordedFrame frame;
+    frame.yaw = header.yaw;
+    frame.pitch = header.pitch;
+    const uint8_t* p = data.data() + headerBytes;
+    const uint8_t* end = data.data() + data.size();
+    while (p < end) {
+        uint8_t flags = *p++;
+        if (flags & RECORD_END) {
+            if (end - p < 8) break;
+            worldHash = getU32(p) | (uint64_t)getU32(p + 4) << 32;
+            hasWorldHash = true;
+            break;
+        }
+        if (end - p < 4) break;
+        frame.deltaTime = getF32(p);
+        p += 4;
+        if (flags & RECORD_ORIENTATION) {
+            if (end - p < 8) break;
+            frame.yaw = getF32(p);
+            frame.pitch = getF32(p + 4);
+            p += 8;
+        }
+        uint32_t low, high, count;
+        if (flags & RECORD_KEYS) {
+            if (!getVarint(p, end, low) || !getVarint(p, end, high)) break;
+            frame.keys = low | (uint64_t)high << 32;
+        }
+        frame.chunks.clear();
+        if (flags & RECORD_CHUNKS) {
+            if (!getVarint(p, end, count) || count > (uint32_t)(end - p)) break;
+            bool ok = true;
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t cx = 0, cz = 0;
+                if (!getVarint(p, end, cx) || !getVarint(p, end, cz)) {
+                    ok = false;
+                    break;
+                }
+                frame.chunks.push_back((int64_t)unzigzag(cx) << 32 | (uint32_t)unzigzag(cz));
+            }
+            if (!ok) break;
+        }
+        frames.push_back(frame);
+    }
+    return true;
+}
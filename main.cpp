@@ -3,15 +3,51 @@
 #include <vector>
 #include <algorithm>
 #include <cstdlib>
+#include "world-protocol.hpp"  // first: winsock2.h has to come before windows.h
 #include "../engine-thingy/cpp-engine.hpp"
+#include "region-storage.hpp"
+#include "terrain.hpp"
+#include "edit-journal.hpp"
+#include "profiler.hpp"
+#include "buffer-arena.hpp"
+#include "input-recording.hpp"
+#include "timing-json.hpp"
 #include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <unordered_set>
+#include <list>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
-namespace fs = std::filesystem;
+#include <string>
+#include <tuple>
 
 const int CHUNK_SIZE = 16;
 const int RENDER_DISTANCE = 3;
+// Chunks within RENDER_DISTANCE are loaded; loaded chunks stay until they
+// are further than UNLOAD_DISTANCE so walking along a chunk line does not
+// unload and reload them over and over
+const int UNLOAD_DISTANCE = RENDER_DISTANCE + 2;
 const int HOTBAR_SLOTS = 9;
+const int SECTION_HEIGHT = 16;
+// Sections further above or below the camera than this are not meshed
+const int SECTION_RENDER_DISTANCE = RENDER_DISTANCE + 1;
+// Finished chunks moved from the streaming workers into loadedChunks per frame
+const int CHUNK_INTEGRATIONS_PER_FRAME = 2;
+// Fold the edit journal into the chunk store this often, or sooner once it
+// holds this many edits
+const float JOURNAL_COMPACT_INTERVAL = 30.0f;
+const size_t JOURNAL_COMPACT_EDITS = 4096;
+// Beyond RENDER_DISTANCE chunks are drawn as coarse heightfield tiles out
+// to the view distance, which can be changed at runtime ([ and ] keys)
+const int DEFAULT_VIEW_DISTANCE = 16;
+const int MAX_VIEW_DISTANCE = 32;
 
 // --------------------
 // Shaders
@@ -20,18 +56,52 @@ const char* vertexShaderSource = R"(
 #version 330 core
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aBary;
+layout(location = 2) in vec3 aColor;
 out vec3 vBary;
+out vec3 vColor;
+out float vHighlight;
 uniform mat4 uMVP;
 void main() {
     vBary = aBary;
+    vColor = aColor;
+    vHighlight = 0.0;
     gl_Position = uMVP * vec4(aPos, 1.0);
 })";
 
+// Dynamic cubes: cubeVertices instanced with per-instance offset, rotation
+// (radians about x, y, z), color and highlight flag
+const char* instanceVertexShaderSource = R"(
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aBary;
+layout(location = 2) in vec3 aColor;
+layout(location = 3) in vec3 aOffset;
+layout(location = 4) in vec3 aRotation;
+layout(location = 5) in float aHighlight;
+out vec3 vBary;
+out vec3 vColor;
+out float vHighlight;
+uniform mat4 uMVP;
+mat3 rotation(vec3 r) {
+    vec3 c = cos(r), s = sin(r);
+    mat3 rx = mat3(1.0, 0.0, 0.0,  0.0, c.x, s.x,  0.0, -s.x, c.x);
+    mat3 ry = mat3(c.y, 0.0, -s.y,  0.0, 1.0, 0.0,  s.y, 0.0, c.y);
+    mat3 rz = mat3(c.z, s.z, 0.0,  -s.z, c.z, 0.0,  0.0, 0.0, 1.0);
+    return rz * ry * rx;
+}
+void main() {
+    vBary = aBary;
+    vColor = aColor;
+    vHighlight = aHighlight;
+    gl_Position = uMVP * vec4(rotation(aRotation) * aPos + aOffset, 1.0);
+})";
+
 const char* fragmentShaderSource = R"(
 #version 330 core
 in vec3 vBary;
+in vec3 vColor;
+in float vHighlight;
 out vec4 FragColor;
-uniform vec3 uColor;
 uniform bool uHighlight;
 float edgeFactor() {
     vec3 d = fwidth(vBary);
@@ -40,14 +110,14 @@ float edgeFactor() {
 }
 void main() {
     float factor = edgeFactor();
-    if(uHighlight) {
+    if(uHighlight || vHighlight > 0.5) {
         vec3 outlineColor = vec3(1.0, 1.0, 1.0);
-        vec3 brightColor = uColor * 1.5;
+        vec3 brightColor = vColor * 1.5;
         vec3 color = mix(outlineColor, brightColor, factor);
         FragColor = vec4(color, 1.0);
     } else {
         vec3 outlineColor = vec3(0.0,0.0,0.0);
-        vec3 color = mix(outlineColor, uColor, factor);
+        vec3 color = mix(outlineColor, vColor, factor);
         FragColor = vec4(color, 1.0);
     }
 }
@@ -107,242 +177,4357 @@ void main() {
         FragColor = vec4(uColor * 0.7, 1.0);
     }
 }
-)";
+)";
+
+// --------------------
+// Cube data
+// --------------------
+float cubeVertices[] = {
+    -0.5f,-0.5f,0.5f, 1,0,0,  0.5f,-0.5f,0.5f, 0,1,0,  0.5f,0.5f,0.5f, 0,0,1,
+     0.5f,0.5f,0.5f, 1,0,0, -0.5f,0.5f,0.5f, 0,1,0, -0.5f,-0.5f,0.5f, 0,0,1,
+    -0.5f,-0.5f,-0.5f, 1,0,0,  0.5f,0.5f,-0.5f, 0,1,0,  0.5f,-0.5f,-0.5f, 0,0,1,
+     0.5f,0.5f,-0.5f, 1,0,0, -0.5f,-0.5f,-0.5f, 0,1,0, -0.5f,0.5f,-0.5f, 0,0,1,
+    -0.5f,-0.5f,-0.5f, 1,0,0, -0.5f,0.5f,0.5f, 0,1,0, -0.5f,0.5f,-0.5f, 0,0,1,
+    -0.5f,-0.5f,-0.5f, 1,0,0, -0.5f,-0.5f,0.5f, 0,1,0, -0.5f,0.5f,0.5f, 0,0,1,
+     0.5f,-0.5f,-0.5f, 1,0,0,  0.5f,0.5f,-0.5f, 0,1,0,  0.5f,0.5f,0.5f, 0,0,1,
+     0.5f,-0.5f,-0.5f, 1,0,0,  0.5f,0.5f,0.5f, 0,1,0,  0.5f,-0.5f,0.5f, 0,0,1,
+    -0.5f,0.5f,-0.5f, 1,0,0,  0.5f,0.5f,0.5f, 0,1,0,  0.5f,0.5f,-0.5f, 0,0,1,
+    -0.5f,0.5f,-0.5f, 1,0,0, -0.5f,0.5f,0.5f, 0,1,0,  0.5f,0.5f,0.5f, 0,0,1,
+    -0.5f,-0.5f,-0.5f, 1,0,0,  0.5f,-0.5f,-0.5f, 0,1,0,  0.5f,-0.5f,0.5f, 0,0,1,
+    -0.5f,-0.5f,-0.5f, 1,0,0,  0.5f,-0.5f,0.5f, 0,1,0, -0.5f,-0.5f,0.5f, 0,0,1
+};
+
+float crosshairVertices[] = {
+    -0.02f,  0.0f,
+     0.02f,  0.0f,
+     0.0f, -0.02f,
+     0.0f,  0.02f
+};
+
+// --------------------
+// Globals
+// --------------------
+Camera3d camera;
+Keyboard keyboard;
+Mouse mouse;
+float deltaTime=0,lastFrame=0;
+bool wireframeMode = false;
+int selectedHotbarSlot = 0;
+int viewDistance = DEFAULT_VIEW_DISTANCE;  // in chunks, --view-distance
+
+// Far enough to reach the corners of the viewed area, no further
+float farPlane() {
+    return (viewDistance + 1) * CHUNK_SIZE * 1.5f;
+}
+
+// Hotbar colors
+Vec3 hotbarColors[HOTBAR_SLOTS] = {
+    Vec3(0.8f, 0.2f, 0.2f),  // Red
+    Vec3(0.2f, 0.8f, 0.2f),  // Green
+    Vec3(0.2f, 0.2f, 0.8f),  // Blue
+    Vec3(0.9f, 0.9f, 0.2f),  // Yellow, lamps (see Lighting)
+    Vec3(0.9f, 0.5f, 0.2f),  // Orange
+    Vec3(0.6f, 0.2f, 0.8f),  // Purple
+    Vec3(0.2f, 0.8f, 0.8f),  // Cyan
+    Vec3(0.9f, 0.9f, 0.9f),  // White
+    Vec3(0.5f, 0.35f, 0.2f)  // Brown
+};
+
+// --------------------
+// Mesh arena
+// --------------------
+// Every section and tile mesh lives in one vertex buffer, sub-allocated with
+// ArenaAllocator, so the whole scene is one VAO and one glMultiDrawArrays.
+// New meshes are written to a staging ring (persistently mapped when buffer
+// storage is available, otherwise mapped unsynchronized) and copied into
+// place on the GPU. Each frame's uploads and frees end with a fence; ring
+// space and freed ranges are only reused once the GPU has passed it.
+// Vertex layout: position(3) barycentric(3) color(3)
+const int MESH_VERTEX_FLOATS = 9;
+const GLsizeiptr MESH_VERTEX_BYTES = MESH_VERTEX_FLOATS * sizeof(float);
+const uint32_t MESH_ARENA_INITIAL_VERTICES = 1 << 19;  // 18 MB, doubled when full
+const size_t MESH_STAGING_BYTES = 8 << 20;
+
+struct ArenaMesh {
+    uint32_t first = 0;  // first vertex in the arena
+    GLsizei vertexCount = 0;
+    bool uploaded = false;  // set even if the mesh came out empty
+};
+
+// Uploads and frees of one frame, waiting for the GPU to pass its fence
+struct ArenaFrame {
+    GLsync fence = 0;
+    size_t stagingBytes = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> frees;  // first, count
+};
+
+struct MeshArena {
+    GLuint vao = 0, vbo = 0;
+    ArenaAllocator allocator;  // in vertices
+    GLuint staging = 0;
+    uint8_t* stagingMap = nullptr;  // persistent mapping, null if unsupported
+    size_t stagingHead = 0;
+    size_t stagingInFlight = 0;  // bytes of fenced frames not yet retired
+    ArenaFrame current;
+    std::deque<ArenaFrame> inFlight;
+};
+
+MeshArena meshArena;
+
+void bindMeshArenaLayout() {
+    glBindVertexArray(meshArena.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, meshArena.vbo);
+    GLsizei stride = MESH_VERTEX_BYTES;
+    glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,stride,(void*)0); glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,stride,(void*)(3*sizeof(float))); glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2,3,GL_FLOAT,GL_FALSE,stride,(void*)(6*sizeof(float))); glEnableVertexAttribArray(2);
+}
+
+void initMeshArena() {
+    glGenVertexArrays(1, &meshArena.vao);
+    glGenBuffers(1, &meshArena.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, meshArena.vbo);
+    glBufferData(GL_ARRAY_BUFFER, MESH_ARENA_INITIAL_VERTICES * MESH_VERTEX_BYTES, nullptr, GL_DYNAMIC_DRAW);
+    meshArena.allocator = ArenaAllocator(MESH_ARENA_INITIAL_VERTICES);
+    bindMeshArenaLayout();
+
+    glGenBuffers(1, &meshArena.staging);
+    glBindBuffer(GL_COPY_READ_BUFFER, meshArena.staging);
+#ifdef GL_VERSION_4_4
+    if (GLAD_GL_VERSION_4_4) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_READ_BUFFER, MESH_STAGING_BYTES, nullptr, flags);
+        meshArena.stagingMap = (uint8_t*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, MESH_STAGING_BYTES, flags);
+        if (!meshArena.stagingMap) {
+            // Immutable storage cannot be respecified; start over with a plain buffer
+            glDeleteBuffers(1, &meshArena.staging);
+            glGenBuffers(1, &meshArena.staging);
+            glBindBuffer(GL_COPY_READ_BUFFER, meshArena.staging);
+        }
+    }
+#endif
+    if (!meshArena.stagingMap) glBufferData(GL_COPY_READ_BUFFER, MESH_STAGING_BYTES, nullptr, GL_STREAM_COPY);
+}
+
+bool retireOldestArenaFrame(bool wait) {
+    if (meshArena.inFlight.empty()) return false;
+    ArenaFrame& frame = meshArena.inFlight.front();
+    GLenum status = glClientWaitSync(frame.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+    if (status == GL_TIMEOUT_EXPIRED) return false;
+    meshArena.stagingInFlight -= frame.stagingBytes;
+    for (auto& [first, count] : frame.frees) meshArena.allocator.free(first, count);
+    glDeleteSync(frame.fence);
+    meshArena.inFlight.pop_front();
+    return true;
+}
+
+// Fences this frame's uploads and frees; called once per frame after the
+// scene is drawn, and early if one frame outgrows the staging ring
+void endMeshArenaFrame() {
+    ArenaFrame& frame = meshArena.current;
+    if (frame.stagingBytes || !frame.frees.empty()) {
+        frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        meshArena.stagingInFlight += frame.stagingBytes;
+        meshArena.inFlight.push_back(std::move(frame));
+        frame = ArenaFrame();
+    }
+    while (retireOldestArenaFrame(false)) {}
+}
+
+// Reserves `bytes` of the staging ring, waiting for the GPU if it is full
+size_t reserveStaging(size_t bytes) {
+    size_t waste;
+    while (true) {
+        size_t used = meshArena.stagingInFlight + meshArena.current.stagingBytes;
+        if (!used) meshArena.stagingHead = 0;
+        waste = meshArena.stagingHead + bytes > MESH_STAGING_BYTES ? MESH_STAGING_BYTES - meshArena.stagingHead : 0;
+        if (used + waste + bytes <= MESH_STAGING_BYTES) break;
+        if (meshArena.inFlight.empty()) endMeshArenaFrame();
+        retireOldestArenaFrame(true);
+    }
+    size_t offset = waste ? 0 : meshArena.stagingHead;
+    meshArena.current.stagingBytes += waste + bytes;
+    meshArena.stagingHead = offset + bytes;
+    return offset;
+}
+
+// Doubles the arena (or more if needed) with a GPU-side copy of its contents
+void growMeshArena(uint32_t minVertices) {
+    uint32_t oldCapacity = meshArena.allocator.capacity();
+    uint32_t newCapacity = std::max(oldCapacity * 2, oldCapacity + minVertices);
+    GLuint grown;
+    glGenBuffers(1, &grown);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)newCapacity * MESH_VERTEX_BYTES, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, meshArena.vbo);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)oldCapacity * MESH_VERTEX_BYTES);
+    glDeleteBuffers(1, &meshArena.vbo);
+    meshArena.vbo = grown;
+    meshArena.allocator.grow(newCapacity);
+    bindMeshArenaLayout();
+}
+
+// Gives the mesh's range back once the GPU is done drawing from it
+void releaseArenaMesh(ArenaMesh& mesh) {
+    if (mesh.uploaded && mesh.vertexCount) meshArena.current.frees.push_back({mesh.first, (uint32_t)mesh.vertexCount});
+    mesh = ArenaMesh();
+}
+
+void uploadArenaMesh(ArenaMesh& mesh, const std::vector<float>& vertices) {
+    releaseArenaMesh(mesh);
+    mesh.uploaded = true;
+    uint32_t count = vertices.size() / MESH_VERTEX_FLOATS;
+    if (!count) return;
+    if (!meshArena.allocator.allocate(count, mesh.first)) {
+        growMeshArena(count);
+        meshArena.allocator.allocate(count, mesh.first);
+    }
+    mesh.vertexCount = count;
+    size_t bytes = vertices.size() * sizeof(float);
+    GLintptr target = (GLintptr)mesh.first * MESH_VERTEX_BYTES;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, meshArena.vbo);
+    uint8_t* dst = nullptr;
+    size_t offset = 0;
+    if (bytes <= MESH_STAGING_BYTES) {
+        offset = reserveStaging(bytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, meshArena.staging);
+        dst = meshArena.stagingMap ? meshArena.stagingMap + offset
+            : (uint8_t*)glMapBufferRange(GL_COPY_READ_BUFFER, offset, bytes,
+                                         GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    }
+    // Meshes larger than the ring (or a failed map) go straight in
+    if (!dst) {
+        glBufferSubData(GL_COPY_WRITE_BUFFER, target, bytes, vertices.data());
+        return;
+    }
+    std::memcpy(dst, vertices.data(), bytes);
+    if (!meshArena.stagingMap) glUnmapBuffer(GL_COPY_READ_BUFFER);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, target, bytes);
+}
+
+void destroyMeshArena() {
+    for (auto& frame : meshArena.inFlight) glDeleteSync(frame.fence);
+    meshArena.inFlight.clear();
+    if (meshArena.stagingMap) {
+        glBindBuffer(GL_COPY_READ_BUFFER, meshArena.staging);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+    }
+    glDeleteBuffers(1, &meshArena.staging);
+    glDeleteBuffers(1, &meshArena.vbo);
+    glDeleteVertexArrays(1, &meshArena.vao);
+    meshArena = MeshArena();
+}
+
+// --------------------
+// Structures
+// --------------------
+// Expanded view of one block as returned by getBlock; chunks store blocks
+// packed (see Chunk)
+struct Cube {
+    Vec3 pos;
+    Vec3 rot;
+    Vec3 color;
+    bool do_rotate = 0;
+};
+
+// Palette index + 1, 0 is air. Dynamic (do_rotate) blocks also carry
+// DYNAMIC_BLOCK; they are drawn instanced and left out of the chunk mesh.
+typedef uint16_t BlockId;
+const BlockId DYNAMIC_BLOCK = 0x8000;
+const BlockId PALETTE_MASK = 0x7FFF;
+const uint32_t NO_INSTANCE = UINT32_MAX;
+
+// Faces of a section's 16^3 cell; the opposite face is face ^ 1
+enum SectionFace { FACE_WEST, FACE_EAST, FACE_DOWN, FACE_UP, FACE_NORTH, FACE_SOUTH, SECTION_FACES };
+// 6x6 bit matrix, bit a * SECTION_FACES + b set if faces a and b are linked
+const uint64_t ALL_FACES_LINKED = (1ull << (SECTION_FACES * SECTION_FACES)) - 1;
+
+// A SECTION_HEIGHT-tall slice of a chunk column with its own mesh
+struct ChunkSection {
+    // Dense blocks over the occupied height range [baseY, baseY + height)
+    // of this section, laid out y-major then z then x. Sections without
+    // blocks keep no array at all.
+    int baseY = 0, height = 0;
+    std::vector<BlockId> blocks;
+    int blockCount = 0;
+    // Mesh in the arena, rebuilt whenever meshDirty is set by an edit here
+    // or next door
+    bool meshDirty = true;
+    bool meshUrgent = false;  // dirtied by an edit: meshed before anything else
+    uint64_t meshJob = 0;     // generation of the mesh being built, 0 if none
+    ArenaMesh mesh;
+    // Which of the section's faces see each other through empty cells
+    // (see sectionFaceLinks), computed along with the mesh
+    uint64_t faceLinks = ALL_FACES_LINKED;
+};
+
+// Light levels of a chunk's cells (see Lighting). Layers from baseY up
+// cover every section and one more; above them is open sky, below them
+// nothing lets light through.
+struct ChunkLight {
+    bool lit = false;
+    int baseY = 0, height = 0;
+    std::vector<uint8_t> levels;  // skylight << 4 | block light, y-major then z then x
+};
+
+struct Chunk {
+    Vec3 pos;
+    bool dirty = false;
+    // sections[i] covers section index baseSection + i, i.e. blocks
+    // y in [(baseSection + i) * SECTION_HEIGHT, ... + SECTION_HEIGHT)
+    int baseSection = 0;
+    std::vector<ChunkSection> sections;
+    int blockCount = 0;
+    // Packed 0xRRGGBB colors, one entry per distinct color in the chunk
+    std::vector<uint32_t> palette;
+    // Rotation of the few blocks with do_rotate set, keyed by localKey
+    std::unordered_map<uint32_t, Vec3> rotations;
+    // Instance buffer for the dynamic blocks, rebuilt when instancesDirty is
+    // set or the highlighted block moves in or out of this chunk
+    bool instancesDirty = true;
+    uint32_t highlightedInstance = NO_INSTANCE;  // localKey
+    GLuint instanceVAO = 0, instanceVBO = 0;
+    GLsizei instanceCount = 0;
+    // Version of the server's copy this matches (--connect). 0 while a
+    // fresh copy is on its way, or when not connected.
+    uint32_t version = 0;
+    ChunkLight light;
+};
+
+std::unordered_map<int64_t, Chunk> loadedChunks;
+
+RegionStore worldStore("chunks");
+// Terrain seed of the loaded world, set from its world.seed file at startup
+uint64_t worldSeed = 0;
+EditJournal editJournal;
+InputRecorder inputRecorder;  // --record
+
+int floorDiv(int a, int b) {
+    return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+// World position -> integer block coordinate (cubes are centred on integers)
+int blockCoord(float v) {
+    return (int)std::floor(v + 0.5f);
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+const int CHUNK_LAYER = CHUNK_SIZE * CHUNK_SIZE;
+
+// Stable key for a local position; unlike an array index it survives the
+// block array growing downwards
+uint32_t localKey(int lx, int y, int lz) {
+    return (uint32_t)(y + (1 << 23)) << 8 | lz << 4 | lx;
+}
+
+Vec3 paletteColor(const Chunk& chunk, BlockId id) {
+    Vec3 color;
+    unpackColor(chunk.palette[(id & PALETTE_MASK) - 1], color.x, color.y, color.z);
+    return color;
+}
+
+// Id of color in the chunk's palette, added if there is room; otherwise
+// the nearest color held (see makePaletteRoom)
+BlockId paletteId(Chunk& chunk, uint32_t color) {
+    for (size_t i = 0; i < chunk.palette.size(); i++) {
+        if (chunk.palette[i] == color) return i + 1;
+    }
+    if (chunk.palette.size() >= MAX_PALETTE_COLORS) return nearestPaletteColor(chunk.palette, color) + 1;
+    chunk.palette.push_back(color);
+    return chunk.palette.size();
+}
+
+// Drops the colors no block uses any more once the palette is full,
+// renumbering the blocks. Ids of the chunk held elsewhere go stale, so it
+// is only called before an edit looks any up.
+void makePaletteRoom(Chunk& chunk) {
+    if (chunk.palette.size() < MAX_PALETTE_COLORS) return;
+    std::vector<BlockId> remap(chunk.palette.size() + 1, 0);
+    for (auto& section : chunk.sections) {
+        for (BlockId id : section.blocks) {
+            if (id) remap[id & PALETTE_MASK] = 1;
+        }
+    }
+    std::vector<uint32_t> palette;
+    for (size_t i = 1; i < remap.size(); i++) {
+        if (!remap[i]) continue;
+        palette.push_back(chunk.palette[i - 1]);
+        remap[i] = palette.size();
+    }
+    for (auto& section : chunk.sections) {
+        for (BlockId& id : section.blocks) {
+            if (id) id = remap[id & PALETTE_MASK] | (id & DYNAMIC_BLOCK);
+        }
+    }
+    chunk.palette.swap(palette);
+}
+
+int sectionIndex(int y) {
+    return floorDiv(y, SECTION_HEIGHT);
+}
+
+ChunkSection* findSection(Chunk& chunk, int section) {
+    int i = section - chunk.baseSection;
+    if (i < 0 || i >= (int)chunk.sections.size()) return nullptr;
+    return &chunk.sections[i];
+}
+
+const ChunkSection* findSection(const Chunk& chunk, int section) {
+    return findSection(const_cast<Chunk&>(chunk), section);
+}
+
+// Returns the slot for a local position, or nullptr if y is outside the
+// allocated layers
+BlockId* chunkSlot(Chunk& chunk, int lx, int y, int lz) {
+    ChunkSection* section = findSection(chunk, sectionIndex(y));
+    if (!section || y < section->baseY || y >= section->baseY + section->height) return nullptr;
+    return &section->blocks[(size_t)(y - section->baseY) * CHUNK_LAYER + lz * CHUNK_SIZE + lx];
+}
+
+BlockId chunkBlockAt(const Chunk& chunk, int lx, int y, int lz) {
+    const ChunkSection* section = findSection(chunk, sectionIndex(y));
+    if (!section || y < section->baseY || y >= section->baseY + section->height) return 0;
+    return section->blocks[(size_t)(y - section->baseY) * CHUNK_LAYER + lz * CHUNK_SIZE + lx];
+}
+
+// Extends the chunk's sections, and the block array of y's section, so that
+// layer y exists
+void growChunkBlocks(Chunk& chunk, int y) {
+    int index = sectionIndex(y);
+    if (chunk.sections.empty()) {
+        chunk.baseSection = index;
+        chunk.sections.resize(1);
+    } else if (index < chunk.baseSection) {
+        chunk.sections.insert(chunk.sections.begin(), chunk.baseSection - index, ChunkSection());
+        chunk.baseSection = index;
+    } else if (index >= chunk.baseSection + (int)chunk.sections.size()) {
+        chunk.sections.resize(index - chunk.baseSection + 1);
+    }
+
+    ChunkSection& section = chunk.sections[index - chunk.baseSection];
+    if (section.height == 0) {
+        section.baseY = y;
+        section.height = 1;
+        section.blocks.assign(CHUNK_LAYER, 0);
+        return;
+    }
+    int top = section.baseY + section.height - 1;
+    if (y >= section.baseY && y <= top) return;
+    int newBase = std::min(section.baseY, y);
+    int newHeight = std::max(top, y) - newBase + 1;
+    std::vector<BlockId> grown((size_t)newHeight * CHUNK_LAYER, 0);
+    std::copy(section.blocks.begin(), section.blocks.end(),
+              grown.begin() + (size_t)(section.baseY - newBase) * CHUNK_LAYER);
+    section.blocks.swap(grown);
+    section.baseY = newBase;
+    section.height = newHeight;
+}
+
+// Frees the block array of a section whose last block was removed
+void elideEmptySection(ChunkSection& section) {
+    if (section.blockCount) return;
+    std::vector<BlockId>().swap(section.blocks);
+    section.baseY = section.height = 0;
+}
+
+Chunk* findChunk(int cx, int cz) {
+    auto it = loadedChunks.find(chunkKey(cx, cz));
+    return it == loadedChunks.end() ? nullptr : &it->second;
+}
+
+// Rough heap footprint of a chunk's block data, for stats
+size_t chunkMemoryBytes(const Chunk& chunk) {
+    size_t bytes = chunk.sections.capacity() * sizeof(ChunkSection);
+    for (auto& section : chunk.sections) bytes += section.blocks.capacity() * sizeof(BlockId);
+    bytes += chunk.light.levels.capacity();
+    return bytes + chunk.palette.capacity() * sizeof(uint32_t) +
+           chunk.rotations.size() * (sizeof(uint32_t) + sizeof(Vec3) + 2 * sizeof(void*));
+}
+
+// Top block of every column, for level-of-detail tiles
+const int LOD_EMPTY_COLUMN = INT32_MIN;
+
+struct LodColumns {
+    int height[CHUNK_LAYER];     // LOD_EMPTY_COLUMN if the column has no blocks
+    uint32_t color[CHUNK_LAYER];  // packed, of the top block
+};
+
+void lodColumns(const Chunk& chunk, LodColumns& columns) {
+    std::fill(std::begin(columns.height), std::end(columns.height), LOD_EMPTY_COLUMN);
+    std::fill(std::begin(columns.color), std::end(columns.color), 0u);
+    int remaining = CHUNK_LAYER;
+    for (int i = (int)chunk.sections.size() - 1; i >= 0 && remaining; i--) {
+        const ChunkSection& section = chunk.sections[i];
+        for (int ly = section.height - 1; ly >= 0 && remaining; ly--) {
+            const BlockId* layer = section.blocks.data() + (size_t)ly * CHUNK_LAYER;
+            for (int c = 0; c < CHUNK_LAYER; c++) {
+                if (!layer[c] || columns.height[c] != LOD_EMPTY_COLUMN) continue;
+                columns.height[c] = section.baseY + ly;
+                columns.color[c] = chunk.palette[(layer[c] & PALETTE_MASK) - 1];
+                remaining--;
+            }
+        }
+    }
+}
+
+// --------------------
+// World server client
+// --------------------
+// `--connect host[:port]` plays on a world-server (see world-server.cpp),
+// which owns the blocks. Loads become subscriptions that the server
+// answers with the chunk or a delta, chunks leaving the loaded area are
+// unsubscribed, and nothing is saved locally. Edits are applied here
+// straight away and sent to the server, which echoes the accepted ones to
+// every subscriber and corrects rejected ones. A network thread moves the
+// bytes; the main thread encodes requests and applies updates.
+const int WORLD_CLIENT_POLL_MS = 2;
+const double WORLD_CLIENT_CONNECT_TIMEOUT_MS = 5000;
+
+struct WorldClient {
+    bool active = false;
+    Connection connection;  // network thread only once it runs
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> lost{false};
+    bool lostReported = false;
+    std::mutex mutex;
+    std::vector<uint8_t> outbox;  // encoded requests
+    std::deque<Message> updates;  // deltas and edit acks, in arrival order
+    std::filesystem::path scratchDir;  // store for level-of-detail tiles
+    uint32_t nextSeq = 1;
+    int editsSent = 0, editsRejected = 0, resyncs = 0;
+};
+
+WorldClient worldClient;
+
+void subscribeChunk(int cx, int cz, uint32_t held) {
+    std::lock_guard<std::mutex> lock(worldClient.mutex);
+    encodeSubscribe(worldClient.outbox, cx, cz, held);
+}
+
+void unsubscribeChunk(int cx, int cz) {
+    std::lock_guard<std::mutex> lock(worldClient.mutex);
+    encodeUnsubscribe(worldClient.outbox, cx, cz);
+}
+
+void sendServerEdit(bool place, int x, int y, int z, uint32_t color, bool rotate) {
+    if (!worldClient.active) return;
+    BlockEdit edit;
+    edit.place = place;
+    edit.rotate = rotate;
+    edit.x = x; edit.y = y; edit.z = z;
+    edit.color = color;
+    std::lock_guard<std::mutex> lock(worldClient.mutex);
+    encodeEdit(worldClient.outbox, worldClient.nextSeq++, edit);
+    worldClient.editsSent++;
+}
+
+// --------------------
+// Block access by world integer position
+// --------------------
+BlockId blockAt(int x, int y, int z) {
+    int cx = floorDiv(x, CHUNK_SIZE), cz = floorDiv(z, CHUNK_SIZE);
+    Chunk* chunk = findChunk(cx, cz);
+    if (!chunk) return 0;
+    return chunkBlockAt(*chunk, x - cx * CHUNK_SIZE, y, z - cz * CHUNK_SIZE);
+}
+
+// Fills `cube` and returns true if there is a block at (x, y, z)
+bool getBlock(int x, int y, int z, Cube& cube) {
+    int cx = floorDiv(x, CHUNK_SIZE), cz = floorDiv(z, CHUNK_SIZE);
+    Chunk* chunk = findChunk(cx, cz);
+    if (!chunk) return false;
+    int lx = x - cx * CHUNK_SIZE, lz = z - cz * CHUNK_SIZE;
+    BlockId id = chunkBlockAt(*chunk, lx, y, lz);
+    if (!id) return false;
+    cube.pos = Vec3(x, y, z);
+    cube.color = paletteColor(*chunk, id);
+    cube.do_rotate = id & DYNAMIC_BLOCK;
+    cube.rot = cube.do_rotate ? chunk->rotations[localKey(lx, y, lz)] : Vec3(0,0,0);
+    return true;
+}
+
+// Places or recolors the block at (x, y, z). Returns false if its chunk is
+// not loaded.
+bool setBlock(int x, int y, int z, const Vec3& color, bool doRotate) {
+    int cx = floorDiv(x, CHUNK_SIZE), cz = floorDiv(z, CHUNK_SIZE);
+    Chunk* chunk = findChunk(cx, cz);
+    if (!chunk) return false;
+    int lx = x - cx * CHUNK_SIZE, lz = z - cz * CHUNK_SIZE;
+    growChunkBlocks(*chunk, y);
+    makePaletteRoom(*chunk);
+    BlockId* slot = chunkSlot(*chunk, lx, y, lz);
+    if (!*slot) {
+        chunk->blockCount++;
+        findSection(*chunk, sectionIndex(y))->blockCount++;
+    }
+    *slot = paletteId(*chunk, packColor(color.x, color.y, color.z)) | (doRotate ? DYNAMIC_BLOCK : 0);
+    if (doRotate) chunk->rotations[localKey(lx, y, lz)] = Vec3(0,0,0);
+    else chunk->rotations.erase(localKey(lx, y, lz));
+    chunk->dirty = true;
+    return true;
+}
+
+bool removeBlock(int x, int y, int z) {
+    int cx = floorDiv(x, CHUNK_SIZE), cz = floorDiv(z, CHUNK_SIZE);
+    Chunk* chunk = findChunk(cx, cz);
+    if (!chunk) return false;
+    int lx = x - cx * CHUNK_SIZE, lz = z - cz * CHUNK_SIZE;
+    BlockId* slot = chunkSlot(*chunk, lx, y, lz);
+    if (!slot || !*slot) return false;
+    *slot = 0;
+    chunk->blockCount--;
+    ChunkSection* section = findSection(*chunk, sectionIndex(y));
+    section->blockCount--;
+    elideEmptySection(*section);
+    chunk->rotations.erase(localKey(lx, y, lz));
+    chunk->dirty = true;
+    return true;
+}
+
+// Returns false if the column has no blocks or its chunk is not loaded
+bool highestBlockY(int x, int z, int& y) {
+    int cx = floorDiv(x, CHUNK_SIZE), cz = floorDiv(z, CHUNK_SIZE);
+    Chunk* chunk = findChunk(cx, cz);
+    if (!chunk) return false;
+    int lx = x - cx * CHUNK_SIZE, lz = z - cz * CHUNK_SIZE;
+    // Top section down; empty sections cost nothing to skip
+    for (int i = (int)chunk->sections.size() - 1; i >= 0; i--) {
+        const ChunkSection& section = chunk->sections[i];
+        for (int ly = section.height - 1; ly >= 0; ly--) {
+            if (section.blocks[(size_t)ly * CHUNK_LAYER + lz * CHUNK_SIZE + lx]) {
+                y = section.baseY + ly;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+float getHighestBlockY(float x, float z) {
+    int y;
+    if (!highestBlockY((int)std::floor(x), (int)std::floor(z), y)) return -10000.0f;
+    return y;
+}
+
+StoredChunk toStoredChunk(const Chunk& chunk) {
+    StoredChunk stored;
+    stored.cx = chunk.pos.x;
+    stored.cz = chunk.pos.z;
+    stored.blocks.reserve(chunk.blockCount);
+    for (auto& section : chunk.sections) {
+        for (int ly = 0; ly < section.height; ly++) {
+            for (int lz = 0; lz < CHUNK_SIZE; lz++) {
+                for (int lx = 0; lx < CHUNK_SIZE; lx++) {
+                    BlockId id = section.blocks[(size_t)ly * CHUNK_LAYER + lz * CHUNK_SIZE + lx];
+                    if (!id) continue;
+                    StoredBlock b;
+                    b.x = lx;
+                    b.z = lz;
+                    b.y = section.baseY + ly;
+                    b.color = chunk.palette[(id & PALETTE_MASK) - 1];
+                    b.rotate = id & DYNAMIC_BLOCK;
+                    stored.blocks.push_back(b);
+                }
+            }
+        }
+    }
+    return stored;
+}
+
+// Packs stored blocks into a chunk in one pass; the palette is rebuilt so
+// colors no longer used by any block are dropped
+void fillChunk(Chunk& chunk, const std::vector<StoredBlock>& blocks) {
+    chunk.sections.clear();
+    chunk.palette.clear();
+    chunk.rotations.clear();
+    chunk.baseSection = chunk.blockCount = 0;
+    if (blocks.empty()) return;
+    // Size every section to its occupied layers up front
+    std::unordered_map<int, std::pair<int, int>> layerRange;  // section -> min y, max y
+    int minSection = INT32_MAX, maxSection = INT32_MIN;
+    for (auto& b : blocks) {
+        int index = sectionIndex(b.y);
+        auto [it, added] = layerRange.emplace(index, std::make_pair(b.y, b.y));
+        it->second.first = std::min(it->second.first, b.y);
+        it->second.second = std::max(it->second.second, b.y);
+        minSection = std::min(minSection, index);
+        maxSection = std::max(maxSection, index);
+    }
+    chunk.baseSection = minSection;
+    chunk.sections.resize(maxSection - minSection + 1);
+    for (auto& [index, range] : layerRange) {
+        ChunkSection& section = chunk.sections[index - minSection];
+        section.baseY = range.first;
+        section.height = range.second - range.first + 1;
+        section.blocks.assign((size_t)section.height * CHUNK_LAYER, 0);
+    }
+    std::unordered_map<uint32_t, BlockId> ids;
+    for (auto& b : blocks) {
+        auto [it, added] = ids.emplace(b.color, (BlockId)(chunk.palette.size() + 1));
+        if (added && chunk.palette.size() < MAX_PALETTE_COLORS) chunk.palette.push_back(b.color);
+        else if (added) it->second = nearestPaletteColor(chunk.palette, b.color) + 1;
+        ChunkSection& section = chunk.sections[sectionIndex(b.y) - minSection];
+        BlockId& slot = section.blocks[(size_t)(b.y - section.baseY) * CHUNK_LAYER + b.z * CHUNK_SIZE + b.x];
+        if (!slot) {
+            chunk.blockCount++;
+            section.blockCount++;
+        }
+        slot = it->second;
+        if (b.rotate) {
+            slot |= DYNAMIC_BLOCK;
+            chunk.rotations[localKey(b.x, b.y, b.z)] = Vec3(0,0,0);
+        }
+    }
+}
+
+bool saveChunk(const Chunk& chunk) {
+    if (worldClient.active) return true;  // the server keeps the world
+    return worldStore.save(toStoredChunk(chunk));
+}
+
+Chunk loadChunk(int cx, int cz) {
+    Chunk chunk;
+    chunk.pos = Vec3(cx, 0, cz);
+    StoredChunk stored;
+    if (!worldStore.load(cx, cz, stored)) generateTerrainChunk(worldSeed, cx, cz, stored);
+    fillChunk(chunk, stored.blocks);
+    return chunk;
+}
+
+void markChunkMeshDirty(int cx, int cz) {
+    if (Chunk* chunk = findChunk(cx, cz)) {
+        for (auto& section : chunk->sections) section.meshDirty = true;
+    }
+}
+
+// Only edits mark single sections, so these jump the meshing queue
+void markSectionMeshDirty(int cx, int section, int cz) {
+    if (Chunk* chunk = findChunk(cx, cz)) {
+        if (ChunkSection* s = findSection(*chunk, section)) s->meshDirty = s->meshUrgent = true;
+    }
+}
+
+// Dynamic blocks neither appear in nor occlude the mesh, so editing one only
+// touches its own chunk's instance buffer
+void markBlockInstancesDirty(int x, int z) {
+    if (Chunk* chunk = findChunk(floorDiv(x, CHUNK_SIZE), floorDiv(z, CHUNK_SIZE))) chunk->instancesDirty = true;
+}
+
+// Faces on a section border are culled against the neighbour, so an edit
+// there has to remesh the neighbouring section too
+void markBlockMeshDirty(int x, int y, int z) {
+    int cx = floorDiv(x, CHUNK_SIZE), cz = floorDiv(z, CHUNK_SIZE), sy = sectionIndex(y);
+    int lx = x - cx * CHUNK_SIZE, ly = y - sy * SECTION_HEIGHT, lz = z - cz * CHUNK_SIZE;
+    markSectionMeshDirty(cx, sy, cz);
+    if (lx == 0) markSectionMeshDirty(cx - 1, sy, cz);
+    if (lx == CHUNK_SIZE - 1) markSectionMeshDirty(cx + 1, sy, cz);
+    if (ly == 0) markSectionMeshDirty(cx, sy - 1, cz);
+    if (ly == SECTION_HEIGHT - 1) markSectionMeshDirty(cx, sy + 1, cz);
+    if (lz == 0) markSectionMeshDirty(cx, sy, cz - 1);
+    if (lz == CHUNK_SIZE - 1) markSectionMeshDirty(cx, sy, cz + 1);
+}
+
+void destroySectionMesh(ChunkSection& section) {
+    releaseArenaMesh(section.mesh);
+    section.meshDirty = true;
+    section.meshJob = 0;  // whatever is being built for it is dropped
+}
+
+void destroyChunkMesh(Chunk& chunk) {
+    for (auto& section : chunk.sections) destroySectionMesh(section);
+    if (chunk.instanceVAO) glDeleteVertexArrays(1, &chunk.instanceVAO);
+    if (chunk.instanceVBO) glDeleteBuffers(1, &chunk.instanceVBO);
+    chunk.instanceVAO = chunk.instanceVBO = 0;
+    chunk.instanceCount = 0;
+    chunk.instancesDirty = true;
+    chunk.highlightedInstance = NO_INSTANCE;
+}
+
+// --------------------
+// Lighting
+// --------------------
+// Every cell has a skylight and a block light level from 0 to MAX_LIGHT.
+// Skylight falls straight down from open sky without dimming and loses a
+// level per step any other way; block light spreads from lamps (blocks of
+// the hotbar's yellow) losing a level per step. Solid blocks stop both;
+// dynamic blocks let light through, as they do not occlude the mesh
+// either. A chunk is flooded once before it is first meshed. After that an
+// edit only relights what it changed: the light that came through the
+// edited cells is flooded away, and whatever still reaches them flows back
+// in, across chunk borders. The cost follows the light that moved, not the
+// size of the world. Meshing bakes the levels into vertex colors.
+const int MAX_LIGHT = 15;
+const int LAMP_LIGHT = 14;
+const uint8_t OPEN_SKY = MAX_LIGHT << 4;
+const uint32_t LAMP_COLOR = packColor(0.9f, 0.9f, 0.2f);
+enum LightChannel { SKY_LIGHT, BLOCK_LIGHT, LIGHT_CHANNELS };
+const int lightShift[LIGHT_CHANNELS] = {4, 0};
+
+bool blocksLight(BlockId id) {
+    return id && !(id & DYNAMIC_BLOCK);
+}
+
+int blockEmission(const Chunk& chunk, BlockId id) {
+    return id && chunk.palette[(id & PALETTE_MASK) - 1] == LAMP_COLOR ? LAMP_LIGHT : 0;
+}
+
+int lightLevel(uint8_t levels, int channel) {
+    return levels >> lightShift[channel] & MAX_LIGHT;
+}
+
+// Brighter of the two levels
+int lightOf(uint8_t levels) {
+    return std::max(levels >> 4, levels & MAX_LIGHT);
+}
+
+// Levels of local cell (lx, y, lz) of a lit chunk
+uint8_t chunkLightAt(const Chunk& chunk, int lx, int y, int lz) {
+    const ChunkLight& light = chunk.light;
+    if (!light.height || y >= light.baseY + light.height) return OPEN_SKY;
+    if (y < light.baseY) return 0;
+    return light.levels[(size_t)(y - light.baseY) * CHUNK_LAYER + lz * CHUNK_SIZE + lx];
+}
+
+// Stored layers a chunk's blocks call for: its sections and one more
+void chunkLightRange(const Chunk& chunk, int& baseY, int& topY) {
+    baseY = chunk.baseSection * SECTION_HEIGHT;
+    topY = (chunk.baseSection + (int)chunk.sections.size() + 1) * SECTION_HEIGHT;
+}
+
+struct LightNode {
+    int x, y, z;
+    int level;
+};
+
+// A section whose mesh saw light change; borders has bit f set when a
+// changed cell lies on its face f
+struct LightTouch {
+    int cx, sy, cz;
+    unsigned borders;
+};
+
+struct LightStats {
+    long long relights = 0, cellsChanged = 0;
+    int chunksLit = 0;
+    double chunkLightMs = 0;
+    bool keepSamples = false;  // --bench
+    std::vector<double> relightMs;
+};
+
+// Flood queues and what the flood changed. Queues are read front to back
+// while they grow and cleared once drained.
+struct LightSearch {
+    std::vector<LightNode> add[LIGHT_CHANNELS], remove[LIGHT_CHANNELS];
+    std::vector<LightTouch> touched;
+    long long changes = 0;
+    LightStats stats;
+};
+
+LightSearch lightSearch;
+
+// Walks cells of lit chunks, remembering the last chunk it found
+struct LightCursor {
+    int cx = INT32_MIN, cz = INT32_MIN;
+    Chunk* chunk = nullptr;
+    int lx = 0, lz = 0;
+
+    // Moves to column (x, z); nullptr if its chunk is not loaded or not lit
+    Chunk* seek(int x, int z) {
+        int ncx = floorDiv(x, CHUNK_SIZE), ncz = floorDiv(z, CHUNK_SIZE);
+        if (ncx != cx || ncz != cz) {
+            cx = ncx;
+            cz = ncz;
+            chunk = findChunk(cx, cz);
+            if (chunk && !chunk->light.lit) chunk = nullptr;
+        }
+        lx = x - cx * CHUNK_SIZE;
+        lz = z - cz * CHUNK_SIZE;
+        return chunk;
+    }
+
+    // Stored levels of cell (x, y, z); nullptr outside the stored layers,
+    // where light never changes
+    uint8_t* slot(int x, int y, int z) {
+        if (!seek(x, z)) return nullptr;
+        ChunkLight& light = chunk->light;
+        if (y < light.baseY || y >= light.baseY + light.height) return nullptr;
+        return &light.levels[(size_t)(y - light.baseY) * CHUNK_LAYER + lz * CHUNK_SIZE + lx];
+    }
+};
+
+// -x, +x, -y, +y, -z, +z as in SectionFace
+const int lightStep[SECTION_FACES][3] = {{-1,0,0},{1,0,0},{0,-1,0},{0,1,0},{0,0,-1},{0,0,1}};
+
+void touchLight(int x, int y, int z) {
+    int cx = floorDiv(x, CHUNK_SIZE), cz = floorDiv(z, CHUNK_SIZE), sy = sectionIndex(y);
+    int lx = x - cx * CHUNK_SIZE, ly = y - sy * SECTION_HEIGHT, lz = z - cz * CHUNK_SIZE;
+    unsigned borders = (lx == 0) << FACE_WEST | (lx == CHUNK_SIZE - 1) << FACE_EAST |
+                       (ly == 0) << FACE_DOWN | (ly == SECTION_HEIGHT - 1) << FACE_UP |
+                       (lz == 0) << FACE_NORTH | (lz == CHUNK_SIZE - 1) << FACE_SOUTH;
+    auto& touched = lightSearch.touched;
+    if (!touched.empty() && touched.back().cx == cx && touched.back().sy == sy && touched.back().cz == cz) {
+        touched.back().borders |= borders;
+    } else {
+        touched.push_back({cx, sy, cz, borders});
+    }
+}
+
+void setLight(uint8_t* slot, int channel, int level, int x, int y, int z) {
+    *slot = (*slot & ~(MAX_LIGHT << lightShift[channel])) | level << lightShift[channel];
+    touchLight(x, y, z);
+    lightSearch.changes++;
+}
+
+// Queues the cells of lit chunks next door, beside layers [y0, y1) of
+// `chunk`, that are bright enough to spread into it
+void queueLightFromNeighbours(const Chunk& chunk, int y0, int y1) {
+    int originX = chunk.pos.x * CHUNK_SIZE, originZ = chunk.pos.z * CHUNK_SIZE;
+    for (int face = 0; face < SECTION_FACES; face++) {
+        int dx = lightStep[face][0], dz = lightStep[face][2];
+        if (lightStep[face][1]) continue;
+        const Chunk* next = findChunk(chunk.pos.x + dx, chunk.pos.z + dz);
+        if (!next || !next->light.lit) continue;
+        for (int y = y0; y < y1; y++) {
+            for (int j = 0; j < CHUNK_SIZE; j++) {
+                int lx = dx ? (dx < 0 ? 0 : CHUNK_SIZE - 1) : j, lz = dz ? (dz < 0 ? 0 : CHUNK_SIZE - 1) : j;
+                uint8_t levels = chunkLightAt(*next, lx + dx - dx * CHUNK_SIZE, y, lz + dz - dz * CHUNK_SIZE);
+                uint8_t here = chunkLightAt(chunk, lx, y, lz);
+                for (int channel = 0; channel < LIGHT_CHANNELS; channel++) {
+                    int level = lightLevel(levels, channel);
+                    if (level > lightLevel(here, channel) + 1) {
+                        lightSearch.add[channel].push_back({originX + lx + dx, y, originZ + lz + dz, level});
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Extends the stored layers of a lit chunk to cover [baseY, topY). Layers
+// added on top are open sky, as they were before. Layers added below start
+// dark. The next spread feeds both from around them.
+void growChunkLight(Chunk& chunk, int baseY, int topY) {
+    ChunkLight& light = chunk.light;
+    if (!light.height) {
+        light.baseY = baseY;
+        light.height = topY - baseY;
+        light.levels.assign((size_t)light.height * CHUNK_LAYER, OPEN_SKY);
+        queueLightFromNeighbours(chunk, baseY, topY);
+        return;
+    }
+    int oldBase = light.baseY, oldTop = light.baseY + light.height;
+    if (topY > oldTop) {
+        light.levels.resize((size_t)(topY - oldBase) * CHUNK_LAYER, OPEN_SKY);
+        light.height = topY - oldBase;
+        queueLightFromNeighbours(chunk, oldTop, topY);
+    }
+    if (baseY < oldBase) {
+        light.levels.insert(light.levels.begin(), (size_t)(oldBase - baseY) * CHUNK_LAYER, 0);
+        light.baseY = baseY;
+        light.height += oldBase - baseY;
+        int originX = chunk.pos.x * CHUNK_SIZE, originZ = chunk.pos.z * CHUNK_SIZE;
+        for (int lz = 0; lz < CHUNK_SIZE; lz++) {
+            for (int lx = 0; lx < CHUNK_SIZE; lx++) {
+                uint8_t levels = chunkLightAt(chunk, lx, oldBase, lz);
+                for (int channel = 0; channel < LIGHT_CHANNELS; channel++) {
+                    int level = lightLevel(levels, channel);
+                    if (level > 1) lightSearch.add[channel].push_back({originX + lx, oldBase, originZ + lz, level});
+                }
+            }
+        }
+        queueLightFromNeighbours(chunk, baseY, oldBase);
+    }
+}
+
+// Grows a lit chunk's layers to what its blocks call for, and its lit
+// neighbours' to match, so light crossing the border finds stored cells
+// on both sides
+void fitChunkLight(Chunk& chunk) {
+    int baseY, topY;
+    chunkLightRange(chunk, baseY, topY);
+    growChunkLight(chunk, baseY, topY);
+    for (int face = 0; face < SECTION_FACES; face++) {
+        if (lightStep[face][1]) continue;
+        Chunk* next = findChunk(chunk.pos.x + lightStep[face][0], chunk.pos.z + lightStep[face][2]);
+        if (next && next->light.lit) growChunkLight(*next, baseY, topY);
+    }
+}
+
+// Spreads the queued add nodes of a channel
+void spreadLight(int channel) {
+    LightCursor cursor;
+    auto& queue = lightSearch.add[channel];
+    for (size_t i = 0; i < queue.size(); i++) {
+        LightNode node = queue[i];
+        uint8_t* slot = cursor.slot(node.x, node.y, node.z);
+        if (!slot || lightLevel(*slot, channel) != node.level || node.level <= 1) continue;  // since overwritten
+        for (int face = 0; face < SECTION_FACES; face++) {
+            int x = node.x + lightStep[face][0], y = node.y + lightStep[face][1], z = node.z + lightStep[face][2];
+            uint8_t* next = cursor.slot(x, y, z);
+            if (!next || blocksLight(chunkBlockAt(*cursor.chunk, cursor.lx, y, cursor.lz))) continue;
+            int level = channel == SKY_LIGHT && face == FACE_DOWN && node.level == MAX_LIGHT ? MAX_LIGHT : node.level - 1;
+            if (lightLevel(*next, channel) >= level) continue;
+            setLight(next, channel, level, x, y, z);
+            queue.push_back({x, y, z, level});
+        }
+    }
+    queue.clear();
+}
+
+// Floods away the light that came through the queued remove nodes. Cells
+// lit from elsewhere that border the cleared region are queued to spread
+// back into it.
+void unspreadLight(int channel) {
+    LightCursor cursor;
+    auto& queue = lightSearch.remove[channel];
+    for (size_t i = 0; i < queue.size(); i++) {
+        LightNode node = queue[i];
+        for (int face = 0; face < SECTION_FACES; face++) {
+            int x = node.x + lightStep[face][0], y = node.y + lightStep[face][1], z = node.z + lightStep[face][2];
+            uint8_t* next = cursor.slot(x, y, z);
+            if (!next) continue;
+            int level = lightLevel(*next, channel);
+            if (!level) continue;
+            bool fed = level < node.level ||
+                       (channel == SKY_LIGHT && face == FACE_DOWN && node.level == MAX_LIGHT && level == MAX_LIGHT);
+            if (!fed) {
+                lightSearch.add[channel].push_back({x, y, z, level});
+                continue;
+            }
+            int keep = channel == BLOCK_LIGHT ? blockEmission(*cursor.chunk, chunkBlockAt(*cursor.chunk, cursor.lx, y, cursor.lz)) : 0;
+            if (level <= keep) continue;
+            setLight(next, channel, keep, x, y, z);
+            queue.push_back({x, y, z, level});
+            if (keep) lightSearch.add[channel].push_back({x, y, z, keep});
+        }
+    }
+    queue.clear();
+}
+
+// Marks the sections whose faces saw light change for remeshing: first in
+// line after an edit, in the usual order when a chunk was lit. Dynamic
+// blocks take their shade from their own cell, so chunks with any are
+// re-instanced.
+void applyLightChanges(bool urgent) {
+    auto& touched = lightSearch.touched;
+    std::sort(touched.begin(), touched.end(), [](const LightTouch& a, const LightTouch& b) {
+        return std::tie(a.cx, a.cz, a.sy) < std::tie(b.cx, b.cz, b.sy);
+    });
+    auto mark = [&](int cx, int sy, int cz) {
+        Chunk* chunk = findChunk(cx, cz);
+        ChunkSection* section = chunk ? findSection(*chunk, sy) : nullptr;
+        if (!section) return;
+        section->meshDirty = true;
+        section->meshUrgent |= urgent;
+        if (!chunk->rotations.empty()) chunk->instancesDirty = true;
+    };
+    for (size_t i = 0; i < touched.size();) {
+        LightTouch t = touched[i];
+        for (i++; i < touched.size() && touched[i].cx == t.cx && touched[i].cz == t.cz && touched[i].sy == t.sy; i++) {
+            t.borders |= touched[i].borders;
+        }
+        mark(t.cx, t.sy, t.cz);
+        for (int face = 0; face < SECTION_FACES; face++) {
+            if (t.borders >> face & 1) mark(t.cx + lightStep[face][0], t.sy + lightStep[face][1], t.cz + lightStep[face][2]);
+        }
+    }
+    touched.clear();
+}
+
+// Relights after the blocks in the box changed
+void relightCells(int x0, int y0, int z0, int x1, int y1, int z1) {
+    auto begin = std::chrono::steady_clock::now();
+    long long changesBefore = lightSearch.changes;
+    for (int cz = floorDiv(z0, CHUNK_SIZE); cz <= floorDiv(z1, CHUNK_SIZE); cz++) {
+        for (int cx = floorDiv(x0, CHUNK_SIZE); cx <= floorDiv(x1, CHUNK_SIZE); cx++) {
+            Chunk* chunk = findChunk(cx, cz);
+            if (chunk && chunk->light.lit) fitChunkLight(*chunk);
+        }
+    }
+
+    // Reset the box to what its blocks give off; what it held floods away
+    LightCursor cursor;
+    for (int z = z0; z <= z1; z++) {
+        for (int x = x0; x <= x1; x++) {
+            if (!cursor.seek(x, z)) continue;
+            for (int y = y0; y <= y1; y++) {
+                uint8_t* slot = cursor.slot(x, y, z);
+                if (!slot) continue;
+                int emission = blockEmission(*cursor.chunk, chunkBlockAt(*cursor.chunk, cursor.lx, y, cursor.lz));
+                for (int channel = 0; channel < LIGHT_CHANNELS; channel++) {
+                    int old = lightLevel(*slot, channel), level = channel == BLOCK_LIGHT ? emission : 0;
+                    if (old != level) setLight(slot, channel, level, x, y, z);
+                    if (old > level) lightSearch.remove[channel].push_back({x, y, z, old});
+                    if (level) lightSearch.add[channel].push_back({x, y, z, level});
+                }
+            }
+        }
+    }
+    for (int channel = 0; channel < LIGHT_CHANNELS; channel++) unspreadLight(channel);
+
+    // Whatever lights the cells around the box may now reach into it
+    int lo[3] = {x0, y0, z0}, hi[3] = {x1, y1, z1};
+    for (int face = 0; face < SECTION_FACES; face++) {
+        int axis = face / 2;
+        int p[3];
+        p[axis] = face & 1 ? hi[axis] + 1 : lo[axis] - 1;
+        int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        for (p[v] = lo[v]; p[v] <= hi[v]; p[v]++) {
+            for (p[u] = lo[u]; p[u] <= hi[u]; p[u]++) {
+                uint8_t* slot = cursor.slot(p[0], p[1], p[2]);
+                if (!slot) continue;
+                for (int channel = 0; channel < LIGHT_CHANNELS; channel++) {
+                    int level = lightLevel(*slot, channel);
+                    if (level > 1) lightSearch.add[channel].push_back({p[0], p[1], p[2], level});
+                }
+            }
+        }
+    }
+    for (int channel = 0; channel < LIGHT_CHANNELS; channel++) spreadLight(channel);
+    applyLightChanges(true);
+
+    LightStats& stats = lightSearch.stats;
+    stats.relights++;
+    stats.cellsChanged += lightSearch.changes - changesBefore;
+    if (stats.keepSamples) stats.relightMs.push_back(elapsedMs(begin));
+}
+
+// What the block at (x, y, z) does to light: bit 0 set if it stops it,
+// the level it gives off above that
+int blockLighting(int x, int y, int z) {
+    int cx = floorDiv(x, CHUNK_SIZE), cz = floorDiv(z, CHUNK_SIZE);
+    Chunk* chunk = findChunk(cx, cz);
+    if (!chunk) return 0;
+    BlockId id = chunkBlockAt(*chunk, x - cx * CHUNK_SIZE, y, z - cz * CHUNK_SIZE);
+    return blocksLight(id) | blockEmission(*chunk, id) << 1;
+}
+
+// Relights after a single block changed, if the change matters to light;
+// `before` is blockLighting from before the edit
+void relightBlock(int x, int y, int z, int before) {
+    if (blockLighting(x, y, z) != before) relightCells(x, y, z, x, y, z);
+}
+
+// Floods a chunk that was just loaded: skylight down every column, then
+// sideways under overhangs, lamps, and the light of lit neighbours both
+// ways across its borders
+void lightChunk(Chunk& chunk) {
+    auto begin = std::chrono::steady_clock::now();
+    ChunkLight& light = chunk.light;
+    int baseY = INT32_MAX, topY = INT32_MIN;
+    if (!chunk.sections.empty()) chunkLightRange(chunk, baseY, topY);
+    Chunk* neighbours[4];
+    int count = 0;
+    for (int face = 0; face < SECTION_FACES; face++) {
+        if (lightStep[face][1]) continue;
+        Chunk* next = findChunk(chunk.pos.x + lightStep[face][0], chunk.pos.z + lightStep[face][2]);
+        if (!next || !next->light.lit) continue;
+        neighbours[count++] = next;
+        if (next->light.height) {
+            baseY = std::min(baseY, next->light.baseY);
+            topY = std::max(topY, next->light.baseY + next->light.height);
+        }
+    }
+    light = ChunkLight();
+    light.lit = true;
+    if (topY == INT32_MIN) {  // nothing but sky around
+        lightSearch.stats.chunksLit++;
+        lightSearch.stats.chunkLightMs += elapsedMs(begin);
+        return;
+    }
+    light.baseY = baseY;
+    light.height = topY - baseY;
+    light.levels.assign((size_t)light.height * CHUNK_LAYER, 0);
+    // Lowest open sky cell of each column
+    int skyFloor[CHUNK_LAYER];
+    for (int lz = 0; lz < CHUNK_SIZE; lz++) {
+        for (int lx = 0; lx < CHUNK_SIZE; lx++) {
+            int y = topY - 1;
+            for (; y >= baseY && !blocksLight(chunkBlockAt(chunk, lx, y, lz)); y--) {
+                light.levels[(size_t)(y - baseY) * CHUNK_LAYER + lz * CHUNK_SIZE + lx] = OPEN_SKY;
+            }
+            skyFloor[lz * CHUNK_SIZE + lx] = y + 1;
+        }
+    }
+    for (int i = 0; i < count; i++) growChunkLight(*neighbours[i], baseY, topY);
+
+    // Sky spreads sideways from open sky cells beside columns whose open
+    // part ends higher up, here or next door
+    int originX = chunk.pos.x * CHUNK_SIZE, originZ = chunk.pos.z * CHUNK_SIZE;
+    LightCursor cursor;
+    for (int lz = 0; lz < CHUNK_SIZE; lz++) {
+        for (int lx = 0; lx < CHUNK_SIZE; lx++) {
+            int floor = skyFloor[lz * CHUNK_SIZE + lx], seedTop = floor;
+            bool border = false;
+            for (int face = 0; face < SECTION_FACES; face++) {
+                if (lightStep[face][1]) continue;
+                int nx = lx + lightStep[face][0], nz = lz + lightStep[face][2];
+                if (nx < 0 || nx >= CHUNK_SIZE || nz < 0 || nz >= CHUNK_SIZE) border = true;
+                else seedTop = std::max(seedTop, skyFloor[nz * CHUNK_SIZE + nx]);
+            }
+            if (border) {
+                for (int y = floor; y < topY; y++) {
+                    for (int face = 0; face < SECTION_FACES; face++) {
+                        if (lightStep[face][1]) continue;
+                        uint8_t* next = cursor.slot(originX + lx + lightStep[face][0], y, originZ + lz + lightStep[face][2]);
+                        if (next && lightLevel(*next, SKY_LIGHT) < MAX_LIGHT - 1) seedTop = std::max(seedTop, y + 1);
+                    }
+                }
+            }
+            for (int y = floor; y < seedTop; y++) lightSearch.add[SKY_LIGHT].push_back({originX + lx, y, originZ + lz, MAX_LIGHT});
+        }
+    }
+    if (std::find(chunk.palette.begin(), chunk.palette.end(), LAMP_COLOR) != chunk.palette.end()) {
+        for (auto& section : chunk.sections) {
+            for (int ly = 0; ly < section.height; ly++) {
+                for (int lz = 0; lz < CHUNK_SIZE; lz++) {
+                    for (int lx = 0; lx < CHUNK_SIZE; lx++) {
+                        int y = section.baseY + ly;
+                        int emission = blockEmission(chunk, section.blocks[(size_t)ly * CHUNK_LAYER + lz * CHUNK_SIZE + lx]);
+                        if (!emission) continue;
+                        light.levels[(size_t)(y - baseY) * CHUNK_LAYER + lz * CHUNK_SIZE + lx] |= emission;
+                        lightSearch.add[BLOCK_LIGHT].push_back({originX + lx, y, originZ + lz, emission});
+                    }
+                }
+            }
+        }
+    }
+    queueLightFromNeighbours(chunk, baseY, topY);
+    for (int channel = 0; channel < LIGHT_CHANNELS; channel++) spreadLight(channel);
+    applyLightChanges(false);
+    lightSearch.stats.chunksLit++;
+    lightSearch.stats.chunkLightMs += elapsedMs(begin);
+}
+
+// Lights the loaded chunks that have not been yet; runs before meshing
+void lightLoadedChunks() {
+    for (auto& [key, chunk] : loadedChunks) {
+        if (!chunk.light.lit) lightChunk(chunk);
+    }
+}
+
+// --------------------
+// Chunk streaming
+// --------------------
+// Bounded multi-producer/multi-consumer ring (Vyukov). Each slot carries a
+// sequence number telling producers and consumers whose turn it is.
+template <typename T>
+class LockFreeQueue {
+public:
+    explicit LockFreeQueue(size_t capacity) : slots(new Slot[capacity]), mask(capacity - 1) {
+        for (size_t i = 0; i < capacity; i++) slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    bool push(T value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // full
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    bool pop(T& value) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(slot.value);
+                    slot.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // empty
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        T value;
+    };
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;  // capacity must be a power of two
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+struct ChunkJob {
+    enum Type { Load, Save, Lod } type;
+    int cx, cz;
+};
+
+// Column summary of a chunk outside the load radius (see Level of detail)
+struct LodResult {
+    int cx, cz;
+    LodColumns columns;
+};
+
+// Background loading, generation and saving of chunks. Only the main thread
+// touches loadedChunks; workers hand finished chunks back through `finished`.
+struct ChunkStreamer {
+    std::vector<std::thread> workers;
+    std::mutex jobMutex;
+    std::condition_variable jobReady;
+    std::deque<ChunkJob> jobs;
+    std::deque<ChunkJob> lodJobs;  // only run when `jobs` is empty
+    bool stopping = false;
+    std::atomic<int> liveWorkers{0};
+
+    LockFreeQueue<Chunk*> finished{256};
+    std::unordered_set<int64_t> pendingLoads;  // main thread only
+    LockFreeQueue<LodResult*> finishedLod{256};
+
+    // Evicted dirty chunks waiting to be written. A load of the same chunk
+    // copies from here instead of reading a file that is not written yet.
+    std::mutex savingMutex;
+    std::unordered_map<int64_t, std::shared_ptr<const Chunk>> savingChunks;
+    std::vector<int64_t> failedSaves;  // still in savingChunks, to be retried
+};
+
+ChunkStreamer streamer;
+
+// The chunk as last edited: a copy of its pending save if there is one
+// (marked dirty, it is not on disk yet), otherwise read or generated
+Chunk loadNewestChunk(int cx, int cz) {
+    {
+        std::lock_guard<std::mutex> lock(streamer.savingMutex);
+        auto it = streamer.savingChunks.find(chunkKey(cx, cz));
+        if (it != streamer.savingChunks.end()) {
+            Chunk chunk(*it->second);
+            chunk.dirty = true;
+            return chunk;
+        }
+    }
+    return loadChunk(cx, cz);
+}
+
+void runChunkJob(const ChunkJob& job) {
+    static const char* zoneNames[] = {"chunk_load", "chunk_save", "chunk_lod"};
+    ProfileZone zone(zoneNames[job.type]);
+    int64_t key = chunkKey(job.cx, job.cz);
+    if (job.type == ChunkJob::Save) {
+        // Always write the newest snapshot; an older job finding it already
+        // written and removed has nothing left to do
+        std::shared_ptr<const Chunk> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(streamer.savingMutex);
+            auto it = streamer.savingChunks.find(key);
+            if (it == streamer.savingChunks.end()) return;
+            snapshot = it->second;
+        }
+        bool saved = saveChunk(*snapshot);
+        std::lock_guard<std::mutex> lock(streamer.savingMutex);
+        auto it = streamer.savingChunks.find(key);
+        if (it == streamer.savingChunks.end() || it->second != snapshot) return;
+        // A snapshot that did not make it to disk stays, and so does the
+        // journal holding its edits
+        if (saved) streamer.savingChunks.erase(it);
+        else streamer.failedSaves.push_back(key);
+        return;
+    }
+
+    if (job.type == ChunkJob::Lod) {
+        LodResult* result = new LodResult{job.cx, job.cz, {}};
+        lodColumns(loadNewestChunk(job.cx, job.cz), result->columns);
+        while (!streamer.finishedLod.push(result)) std::this_thread::yield();
+        return;
+    }
+
+    Chunk* chunk = new Chunk(loadNewestChunk(job.cx, job.cz));
+    while (!streamer.finished.push(chunk)) std::this_thread::yield();
+}
+
+void chunkWorker() {
+    profileSetThreadName("chunk worker");
+    while (true) {
+        ChunkJob job;
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(streamer.jobMutex);
+            streamer.jobReady.wait(lock, []{
+                return streamer.stopping || !streamer.jobs.empty() || !streamer.lodJobs.empty();
+            });
+            stopping = streamer.stopping;
+            if (!streamer.jobs.empty()) {
+                job = streamer.jobs.front();
+                streamer.jobs.pop_front();
+            } else if (!stopping) {
+                job = streamer.lodJobs.front();
+                streamer.lodJobs.pop_front();
+            } else {
+                break;  // stopping and drained
+            }
+        }
+        // Once shutting down only saves still matter
+        if (stopping && job.type == ChunkJob::Load) continue;
+        runChunkJob(job);
+    }
+    streamer.liveWorkers--;
+}
+
+void startChunkStreaming() {
+    int count = std::clamp((int)std::thread::hardware_concurrency() - 1, 1, 4);
+    streamer.liveWorkers = count;
+    for (int i = 0; i < count; i++) streamer.workers.emplace_back(chunkWorker);
+}
+
+// Finishes all queued jobs (pending saves included) and joins the workers
+void stopChunkStreaming() {
+    {
+        std::lock_guard<std::mutex> lock(streamer.jobMutex);
+        streamer.stopping = true;
+    }
+    streamer.jobReady.notify_all();
+    // Keep draining so no worker is left spinning on a full result queue
+    Chunk* chunk;
+    LodResult* lod;
+    while (streamer.liveWorkers > 0) {
+        while (streamer.finished.pop(chunk)) delete chunk;
+        while (streamer.finishedLod.pop(lod)) delete lod;
+        std::this_thread::yield();
+    }
+    for (auto& t : streamer.workers) t.join();
+    streamer.workers.clear();
+    while (streamer.finished.pop(chunk)) delete chunk;
+    while (streamer.finishedLod.pop(lod)) delete lod;
+    streamer.lodJobs.clear();
+    streamer.pendingLoads.clear();
+    streamer.stopping = false;
+}
+
+void queueChunkJob(const ChunkJob& job) {
+    if (worldClient.active && job.type == ChunkJob::Load) {
+        subscribeChunk(job.cx, job.cz, 0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(streamer.jobMutex);
+        (job.type == ChunkJob::Lod ? streamer.lodJobs : streamer.jobs).push_back(job);
+    }
+    streamer.jobReady.notify_one();
+}
+
+void queueChunkSave(Chunk&& chunk) {
+    if (worldClient.active) return;
+    int cx = chunk.pos.x, cz = chunk.pos.z;
+    {
+        std::lock_guard<std::mutex> lock(streamer.savingMutex);
+        streamer.savingChunks[chunkKey(cx, cz)] = std::make_shared<const Chunk>(std::move(chunk));
+    }
+    queueChunkJob({ChunkJob::Save, cx, cz});
+}
+
+bool withinChunkDistance(int cx, int cz, int camChunkX, int camChunkZ, int distance) {
+    return abs(cx - camChunkX) <= distance && abs(cz - camChunkZ) <= distance;
+}
+
+void markNeighbourMeshesDirty(int cx, int cz) {
+    markChunkMeshDirty(cx - 1, cz);
+    markChunkMeshDirty(cx + 1, cz);
+    markChunkMeshDirty(cx, cz - 1);
+    markChunkMeshDirty(cx, cz + 1);
+}
+
+// --------------------
+// Chunk cache
+// --------------------
+// Chunks that left the unload distance are kept in memory, without GPU
+// buffers, up to a byte budget; coming back to one skips the disk read.
+// Dirty chunks are only saved when they fall out of the cache.
+struct ChunkCache {
+    std::list<std::pair<int64_t, Chunk>> entries;  // most recently used first
+    std::unordered_map<int64_t, std::list<std::pair<int64_t, Chunk>>::iterator> index;
+    size_t bytes = 0;
+    size_t budget = 32u << 20;  // --chunk-cache-mb
+    int hits = 0, misses = 0, evictions = 0;
+};
+
+ChunkCache chunkCache;
+
+size_t cachedChunkBytes(const Chunk& chunk) {
+    return sizeof(Chunk) + chunkMemoryBytes(chunk);
+}
+
+void cacheChunk(Chunk&& chunk) {
+    int64_t key = chunkKey(chunk.pos.x, chunk.pos.z);
+    chunk.light = ChunkLight();  // relit when loaded again
+    if (worldClient.active) unsubscribeChunk(chunk.pos.x, chunk.pos.z);
+    // A server can send a fresh copy of a chunk cached meanwhile. Locally
+    // the cached copy is the newest there is, and may hold unsaved edits.
+    auto stale = chunkCache.index.find(key);
+    if (stale != chunkCache.index.end() && !worldClient.active) return;
+    if (stale != chunkCache.index.end()) {
+        chunkCache.bytes -= cachedChunkBytes(stale->second->second);
+        chunkCache.entries.erase(stale->second);
+        chunkCache.index.erase(stale);
+    }
+    chunkCache.bytes += cachedChunkBytes(chunk);
+    chunkCache.entries.emplace_front(key, std::move(chunk));
+    chunkCache.index[key] = chunkCache.entries.begin();
+    while (chunkCache.bytes > chunkCache.budget && !chunkCache.entries.empty()) {
+        auto& [oldKey, old] = chunkCache.entries.back();
+        chunkCache.bytes -= cachedChunkBytes(old);
+        if (old.dirty) queueChunkSave(std::move(old));
+        chunkCache.index.erase(oldKey);
+        chunkCache.entries.pop_back();
+        chunkCache.evictions++;
+    }
+}
+
+bool takeCachedChunk(int64_t key, Chunk& chunk) {
+    auto it = chunkCache.index.find(key);
+    if (it == chunkCache.index.end()) return false;
+    chunkCache.bytes -= cachedChunkBytes(it->second->second);
+    chunk = std::move(it->second->second);
+    chunkCache.entries.erase(it->second);
+    chunkCache.index.erase(it);
+    // The server answers with the edits made since
+    if (worldClient.active) subscribeChunk(chunk.pos.x, chunk.pos.z, chunk.version);
+    return true;
+}
+
+// Keys of the finished chunks taken in since the main loop last cleared
+// it, in order. Workers finish chunks in no fixed order, so a recording
+// stores these to replay the same arrivals.
+std::vector<int64_t> frameIntegrations;
+// While replaying, the chunks to take in this frame, in place of whichever
+// the workers finished first
+const std::vector<int64_t>* scriptedIntegrations = nullptr;
+std::unordered_map<int64_t, Chunk*> earlyArrivals;  // finished, not scripted yet
+std::unordered_set<int64_t> lateArrivals;           // loaded here instead; drop the worker's copy
+const double SCRIPTED_CHUNK_TIMEOUT_MS = 5000;
+double scriptedChunkWaitMs = 0;  // total time spent waiting for scripted chunks
+
+// Chunks the camera has already left behind go straight to the cache.
+// Returns whether the chunk was loaded.
+bool integrateChunk(Chunk* chunk, int camChunkX, int camChunkZ) {
+    int cx = chunk->pos.x, cz = chunk->pos.z;
+    int64_t key = chunkKey(cx, cz);
+    streamer.pendingLoads.erase(key);
+    if (inputRecorder.isOpen()) frameIntegrations.push_back(key);
+    // Locally, a cached copy is newer than any load of it
+    if (!worldClient.active && chunkCache.index.count(key)) {
+        delete chunk;
+        return false;
+    }
+    bool integrated = false;
+    if (loadedChunks.count(key)) {
+        // A bulk edit loaded (and changed) it meanwhile, or it is the
+        // server's fresh copy of a loaded chunk, which replaces it
+        if (worldClient.active) {
+            destroyChunkMesh(loadedChunks[key]);
+            loadedChunks[key] = std::move(*chunk);
+            markNeighbourMeshesDirty(cx, cz);
+            integrated = true;
+        }
+    } else if (withinChunkDistance(cx, cz, camChunkX, camChunkZ, UNLOAD_DISTANCE)) {
+        loadedChunks[key] = std::move(*chunk);
+        markNeighbourMeshesDirty(cx, cz);
+        integrated = true;
+    } else {
+        cacheChunk(std::move(*chunk));
+    }
+    delete chunk;
+    return integrated;
+}
+
+// Takes in the scripted chunks in order, waiting for the workers to finish
+// them. A chunk the replay never queued (or that never arrives) is loaded
+// here.
+int integrateScriptedChunks(int camChunkX, int camChunkZ) {
+    int integrated = 0;
+    for (int64_t key : *scriptedIntegrations) {
+        auto waitStart = std::chrono::steady_clock::now();
+        while (!earlyArrivals.count(key)) {
+            Chunk* chunk;
+            if (streamer.finished.pop(chunk)) {
+                int64_t arrived = chunkKey(chunk->pos.x, chunk->pos.z);
+                if (lateArrivals.erase(arrived) || !earlyArrivals.emplace(arrived, chunk).second) delete chunk;
+                continue;
+            }
+            double waitedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+            if (streamer.pendingLoads.count(key) && waitedMs < SCRIPTED_CHUNK_TIMEOUT_MS) {
+                auto yieldStart = std::chrono::steady_clock::now();
+                std::this_thread::yield();
+                scriptedChunkWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - yieldStart).count();
+                continue;
+            }
+            if (streamer.pendingLoads.count(key)) lateArrivals.insert(key);
+            earlyArrivals[key] = new Chunk(loadNewestChunk((int)(key >> 32), (int)(int32_t)(key & 0xFFFFFFFF)));
+        }
+        Chunk* chunk = earlyArrivals[key];
+        earlyArrivals.erase(key);
+        if (integrateChunk(chunk, camChunkX, camChunkZ)) integrated++;
+    }
+    return integrated;
+}
+
+// Moves up to `budget` finished chunks into loadedChunks
+int integrateFinishedChunks(const Vec3& cameraPos, int budget) {
+    int camChunkX = (int)std::floor(cameraPos.x / CHUNK_SIZE);
+    int camChunkZ = (int)std::floor(cameraPos.z / CHUNK_SIZE);
+    if (scriptedIntegrations) return integrateScriptedChunks(camChunkX, camChunkZ);
+    int integrated = 0;
+    Chunk* chunk;
+    while (integrated < budget && streamer.finished.pop(chunk)) {
+        // An edit loaded it meanwhile; the edited copy may be in the cache by now
+        if (lateArrivals.erase(chunkKey(chunk->pos.x, chunk->pos.z))) {
+            delete chunk;
+            continue;
+        }
+        if (integrateChunk(chunk, camChunkX, camChunkZ)) integrated++;
+    }
+    return integrated;
+}
+
+// --------------------
+// World server sync
+// --------------------
+// Network thread: sends what the main thread queued and sorts what
+// arrives. Chunks are unpacked here and join the streamed ones; deltas and
+// acks wait for the main thread.
+void worldClientThread() {
+    profileSetThreadName("world server");
+    Connection& connection = worldClient.connection;
+    bool broken = false;
+    while (worldClient.running && !broken) {
+        {
+            std::lock_guard<std::mutex> lock(worldClient.mutex);
+            connection.out.insert(connection.out.end(), worldClient.outbox.begin(), worldClient.outbox.end());
+            worldClient.outbox.clear();
+        }
+        if (!connection.out.empty() && !connection.send()) break;
+        PollEntry entry = {};
+        entry.fd = connection.socket;
+        entry.events = POLLIN;
+        pollSockets(&entry, 1, WORLD_CLIENT_POLL_MS);
+        if (!connection.receive()) break;
+        Message msg;
+        while (connection.nextMessage(msg, broken)) {
+            if (msg.type == MSG_CHUNK) {
+                Chunk* chunk = new Chunk;
+                chunk->pos = Vec3(msg.cx, 0, msg.cz);
+                chunk->version = msg.version;
+                fillChunk(*chunk, msg.chunk.blocks);
+                while (!streamer.finished.push(chunk)) {
+                    if (!worldClient.running) {
+                        delete chunk;
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+            } else {
+                std::lock_guard<std::mutex> lock(worldClient.mutex);
+                worldClient.updates.push_back(std::move(msg));
+            }
+        }
+    }
+    if (worldClient.running) worldClient.lost = true;
+}
+
+// Connects and waits for the server's welcome, which carries the world
+// seed. Level-of-detail tiles beyond the loaded chunks come from the seed
+// alone, through a scratch store.
+bool connectToWorldServer(const std::string& address) {
+    std::string host;
+    uint16_t port;
+    parseServerAddress(address, host, port);
+    if (!startSockets()) return false;
+    Connection& connection = worldClient.connection;
+    connection.socket = connectTo(host, port);
+    if (!connection.isOpen()) {
+        std::cerr << "Cannot connect to a world server at " << host << ":" << port << std::endl;
+        return false;
+    }
+    encodeHello(connection.out);
+    auto start = std::chrono::steady_clock::now();
+    bool welcomed = false;
+    while (!welcomed) {
+        double waitedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (waitedMs > WORLD_CLIENT_CONNECT_TIMEOUT_MS || !connection.send() || !connection.receive()) break;
+        PollEntry entry = {};
+        entry.fd = connection.socket;
+        entry.events = POLLIN;
+        pollSockets(&entry, 1, WORLD_CLIENT_POLL_MS);
+        Message msg;
+        bool broken = false;
+        if (connection.nextMessage(msg, broken)) {
+            welcomed = msg.type == MSG_WELCOME;
+            if (!welcomed) break;
+            worldSeed = msg.seed;
+        }
+        if (broken) break;
+    }
+    if (!welcomed) {
+        std::cerr << host << ":" << port << " did not answer as a world server" << std::endl;
+        connection.close();
+        return false;
+    }
+
+    std::error_code ec;
+    worldClient.scratchDir = std::filesystem::temp_directory_path() / "mini-fps-client";
+    std::filesystem::remove_all(worldClient.scratchDir, ec);
+    std::filesystem::create_directories(worldClient.scratchDir, ec);
+    worldStore.reopen(worldClient.scratchDir.string());
+    worldClient.active = true;
+    worldClient.running = true;
+    worldClient.thread = std::thread(worldClientThread);
+    std::cout << "Connected to " << host << ":" << port << std::endl;
+    return true;
+}
+
+// Before streaming stops, so the network thread is not left waiting on it
+void stopWorldClient() {
+    if (!worldClient.thread.joinable()) return;
+    worldClient.running = false;
+    worldClient.thread.join();
+    worldClient.connection.close();
+    std::cout << "Left the world server: " << worldClient.editsSent << " edits sent, " << worldClient.editsRejected
+              << " rejected, " << worldClient.resyncs << " chunks resent" << std::endl;
+}
+
+// After streaming has stopped: drops the scratch store
+void endWorldClient() {
+    if (!worldClient.active) return;
+    worldClient.active = false;
+    worldStore.reopen("chunks");
+    std::error_code ec;
+    std::filesystem::remove_all(worldClient.scratchDir, ec);
+}
+
+// Sets one block to what the server says, remeshing whatever it touched
+void applyServerEdit(const BlockEdit& edit) {
+    BlockId before = blockAt(edit.x, edit.y, edit.z);
+    int lighting = blockLighting(edit.x, edit.y, edit.z);
+    if (edit.place) {
+        Vec3 color;
+        unpackColor(edit.color, color.x, color.y, color.z);
+        setBlock(edit.x, edit.y, edit.z, color, edit.rotate);
+    } else {
+        removeBlock(edit.x, edit.y, edit.z);
+    }
+    BlockId after = blockAt(edit.x, edit.y, edit.z);
+    if (before == after) return;  // our own edit coming back
+    if ((before | after) & DYNAMIC_BLOCK) markBlockInstancesDirty(edit.x, edit.z);
+    if ((before && !(before & DYNAMIC_BLOCK)) || (after && !(after & DYNAMIC_BLOCK))) markBlockMeshDirty(edit.x, edit.y, edit.z);
+    relightBlock(edit.x, edit.y, edit.z, lighting);
+}
+
+// Applies the deltas and acks that arrived since last frame. A delta for a
+// chunk that is not loaded is dropped: its copy in the cache resubscribes
+// from its own version. A delta starting past the loaded copy's version
+// means edits went missing, so a fresh copy is asked for.
+void applyServerUpdates() {
+    if (!worldClient.active) return;
+    if (worldClient.lost && !worldClient.lostReported) {
+        std::cerr << "Lost the connection to the world server; edits from now on are not kept" << std::endl;
+        worldClient.lostReported = true;
+    }
+    std::deque<Message> updates;
+    {
+        std::lock_guard<std::mutex> lock(worldClient.mutex);
+        updates.swap(worldClient.updates);
+    }
+    for (auto& msg : updates) {
+        if (msg.type == MSG_EDIT_ACK) {
+            if (msg.accepted) continue;
+            worldClient.editsRejected++;
+            applyServerEdit(msg.edit);
+            continue;
+        }
+        if (msg.type != MSG_CHUNK_DELTA) continue;
+        Chunk* chunk = findChunk(msg.cx, msg.cz);
+        if (!chunk || !chunk->version) continue;
+        uint32_t end = msg.version + (uint32_t)msg.edits.size();
+        if (msg.version > chunk->version) {
+            chunk->version = 0;
+            subscribeChunk(msg.cx, msg.cz, 0);
+            worldClient.resyncs++;
+            continue;
+        }
+        // A resubscribe can repeat edits a delta already brought
+        for (size_t i = chunk->version - msg.version; i < msg.edits.size(); i++) applyServerEdit(msg.edits[i]);
+        chunk->version = std::max(chunk->version, end);
+    }
+}
+
+// --------------------
+// Prefetching
+// --------------------
+// Loads are queued for where the camera will be PREFETCH_LOOKAHEAD seconds
+// from now, so moving (even sprinting) into new ground finds the chunks
+// already resident instead of waiting for them at the render edge.
+const float PREFETCH_LOOKAHEAD = 2.0f;  // seconds
+const float PREFETCH_MAX_SPEED = 64.0f;  // faster than this is a teleport, not movement
+const int PREFETCH_JOBS_PER_FRAME = 8;
+
+struct ChunkPrefetcher {
+    Vec3 lastPos;
+    Vec3 velocity;  // smoothed, blocks per second
+    bool hasLastPos = false;
+    std::unordered_set<int64_t> requested;  // prefetched, not yet needed
+    int issued = 0;
+    int hits = 0;    // resident by the time the load radius reached it
+    int late = 0;    // still loading when it was needed
+    int wasted = 0;  // camera turned away before it was needed
+};
+
+ChunkPrefetcher prefetcher;
+
+// Called for every chunk the load radius needs this frame
+void notePrefetchUse(int64_t key, bool resident) {
+    if (!prefetcher.requested.erase(key)) return;
+    if (resident) prefetcher.hits++;
+    else prefetcher.late++;
+}
+
+void updateLoadedChunks(const Vec3& cameraPos) {
+    applyServerUpdates();
+    int camChunkX = (int)std::floor(cameraPos.x / CHUNK_SIZE);
+    int camChunkZ = (int)std::floor(cameraPos.z / CHUNK_SIZE);
+    std::vector<std::pair<int, int>> missing;
+    for (int dx = -RENDER_DISTANCE; dx <= RENDER_DISTANCE; dx++) {
+        for (int dz = -RENDER_DISTANCE; dz <= RENDER_DISTANCE; dz++) {
+            int cx = camChunkX + dx;
+            int cz = camChunkZ + dz;
+            int64_t key = chunkKey(cx, cz);
+            if (loadedChunks.count(key) || streamer.pendingLoads.count(key)) {
+                notePrefetchUse(key, !streamer.pendingLoads.count(key));
+                continue;
+            }
+            notePrefetchUse(key, chunkCache.index.count(key));
+            Chunk cached;
+            if (takeCachedChunk(key, cached)) {
+                loadedChunks[key] = std::move(cached);
+                markNeighbourMeshesDirty(cx, cz);
+                chunkCache.hits++;
+            } else {
+                missing.push_back({cx, cz});
+            }
+        }
+    }
+    // Nearest chunks first
+    std::sort(missing.begin(), missing.end(), [&](const std::pair<int,int>& a, const std::pair<int,int>& b) {
+        int da = (a.first - camChunkX) * (a.first - camChunkX) + (a.second - camChunkZ) * (a.second - camChunkZ);
+        int db = (b.first - camChunkX) * (b.first - camChunkX) + (b.second - camChunkZ) * (b.second - camChunkZ);
+        return da < db;
+    });
+    for (auto& [cx, cz] : missing) {
+        streamer.pendingLoads.insert(chunkKey(cx, cz));
+        queueChunkJob({ChunkJob::Load, cx, cz});
+        chunkCache.misses++;
+    }
+
+    std::vector<int64_t> toUnload;
+    for (auto& [key, chunk] : loadedChunks) {
+        int cx = chunk.pos.x, cz = chunk.pos.z;
+        if (!withinChunkDistance(cx, cz, camChunkX, camChunkZ, UNLOAD_DISTANCE)) toUnload.push_back(key);
+    }
+    for (auto key : toUnload) {
+        Chunk& chunk = loadedChunks[key];
+        int cx = chunk.pos.x, cz = chunk.pos.z;
+        destroyChunkMesh(chunk);
+        cacheChunk(std::move(chunk));
+        loadedChunks.erase(key);
+        markNeighbourMeshesDirty(cx, cz);
+    }
+
+    integrateFinishedChunks(cameraPos, CHUNK_INTEGRATIONS_PER_FRAME);
+}
+
+// Queues loads for the chunks around the camera's predicted position,
+// those in front of the camera and nearest first
+void prefetchChunks(const Vec3& cameraPos, const Vec3& front, float dt) {
+    if (prefetcher.hasLastPos && dt > 0.0f) {
+        Vec3 v = (cameraPos - prefetcher.lastPos) * (1.0f / dt);
+        v.y = 0;
+        float speed = std::sqrt(v.x * v.x + v.z * v.z);
+        if (speed > PREFETCH_MAX_SPEED) v = Vec3(0, 0, 0);
+        prefetcher.velocity = prefetcher.velocity + (v - prefetcher.velocity) * std::min(1.0f, dt * 8.0f);
+    }
+    prefetcher.lastPos = cameraPos;
+    prefetcher.hasLastPos = true;
+
+    int camChunkX = (int)std::floor(cameraPos.x / CHUNK_SIZE);
+    int camChunkZ = (int)std::floor(cameraPos.z / CHUNK_SIZE);
+    // Prefetches the camera moved away from are forgotten; they are in the
+    // loaded set or the cache and get dropped from there as usual
+    for (auto it = prefetcher.requested.begin(); it != prefetcher.requested.end();) {
+        int cx = (int)(*it >> 32), cz = (int)(int32_t)(*it & 0xFFFFFFFF);
+        if (withinChunkDistance(cx, cz, camChunkX, camChunkZ, UNLOAD_DISTANCE + 1)) { ++it; continue; }
+        prefetcher.wasted++;
+        it = prefetcher.requested.erase(it);
+    }
+
+    Vec3 ahead = cameraPos + prefetcher.velocity * PREFETCH_LOOKAHEAD;
+    int aheadX = (int)std::floor(ahead.x / CHUNK_SIZE);
+    int aheadZ = (int)std::floor(ahead.z / CHUNK_SIZE);
+    if (aheadX == camChunkX && aheadZ == camChunkZ) return;
+
+    struct Candidate { int cx, cz; bool behind; float distance; };
+    std::vector<Candidate> candidates;
+    for (int dx = -RENDER_DISTANCE; dx <= RENDER_DISTANCE; dx++) {
+        for (int dz = -RENDER_DISTANCE; dz <= RENDER_DISTANCE; dz++) {
+            int cx = aheadX + dx, cz = aheadZ + dz;
+            if (withinChunkDistance(cx, cz, camChunkX, camChunkZ, RENDER_DISTANCE)) continue;  // the load radius covers it
+            int64_t key = chunkKey(cx, cz);
+            if (loadedChunks.count(key) || streamer.pendingLoads.count(key) || chunkCache.index.count(key)) continue;
+            float ox = (cx + 0.5f) * CHUNK_SIZE - cameraPos.x;
+            float oz = (cz + 0.5f) * CHUNK_SIZE - cameraPos.z;
+            candidates.push_back({cx, cz, ox * front.x + oz * front.z < 0.0f, ox * ox + oz * oz});
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        if (a.behind != b.behind) return !a.behind;
+        return a.distance < b.distance;
+    });
+    if ((int)candidates.size() > PREFETCH_JOBS_PER_FRAME) candidates.resize(PREFETCH_JOBS_PER_FRAME);
+    for (auto& c : candidates) {
+        int64_t key = chunkKey(c.cx, c.cz);
+        streamer.pendingLoads.insert(key);
+        queueChunkJob({ChunkJob::Load, c.cx, c.cz});
+        prefetcher.requested.insert(key);
+        prefetcher.issued++;
+    }
+}
+
+// Blocks until every chunk in range of cameraPos is loaded (used at startup)
+void loadChunksAround(const Vec3& cameraPos) {
+    updateLoadedChunks(cameraPos);
+    while (!streamer.pendingLoads.empty() && !worldClient.lost) {
+        if (!integrateFinishedChunks(cameraPos, INT32_MAX)) std::this_thread::yield();
+    }
+}
+
+// --------------------
+// Bulk edits
+// --------------------
+// Box fills, color replacement and clipboard copy/paste. The work is split
+// per chunk: each chunk's part of the box is written straight into its
+// section arrays, then the chunk is marked dirty and its touched sections
+// queued for remeshing once, however many blocks changed. Chunks in the box
+// that are not loaded are loaded first, so the result does not depend on
+// where the camera is (and replays the same from the journal).
+const uint32_t CLIPBOARD_SOLID = 1u << 24;   // the cell holds a block
+const uint32_t CLIPBOARD_ROTATE = 1u << 25;  // ... a dynamic one
+
+struct BlockBox {
+    int x0, y0, z0, x1, y1, z1;  // inclusive, x0 <= x1 etc.
+};
+
+BlockBox makeBlockBox(int ax, int ay, int az, int bx, int by, int bz) {
+    return {std::min(ax, bx), std::min(ay, by), std::min(az, bz),
+            std::max(ax, bx), std::max(ay, by), std::max(az, bz)};
+}
+
+// Cells indexed x fastest, then z, then y; packed color plus CLIPBOARD_*
+// flags, 0 for air
+struct BlockClipboard {
+    int sizeX = 0, sizeY = 0, sizeZ = 0;
+    std::vector<uint32_t> cells;
+};
+
+// Corners picked in game (Z and X keys) and the last copied volume
+struct BlockSelection {
+    int a[3] = {}, b[3] = {};
+    bool hasA = false, hasB = false;
+};
+
+BlockSelection selection;
+BlockClipboard clipboard;
+
+// Chunks whose level-of-detail tile no longer matches their blocks
+std::unordered_set<int64_t> lodStaleChunks;
+
+// The loaded chunk (cx, cz), brought in from the cache or the store first
+// if needed. A load still in flight for it is dropped when it arrives.
+Chunk& editableChunk(int cx, int cz) {
+    int64_t key = chunkKey(cx, cz);
+    auto it = loadedChunks.find(key);
+    if (it != loadedChunks.end()) return it->second;
+    Chunk chunk;
+    if (!takeCachedChunk(key, chunk)) chunk = loadNewestChunk(cx, cz);
+    if (!worldClient.active && streamer.pendingLoads.erase(key)) lateArrivals.insert(key);
+    markNeighbourMeshesDirty(cx, cz);
+    return loadedChunks[key] = std::move(chunk);
+}
+
+// Runs edit(id, x, y, z) over the blocks of `box` inside `chunk` and stores
+// the id it returns (0 is air). Layers are allocated for the whole box only
+// when `grow` is set; otherwise unallocated (all air) layers are skipped.
+// Returns the number of blocks changed.
+template <typename Edit>
+int editChunkBox(Chunk& chunk, const BlockBox& box, bool grow, Edit&& edit) {
+    int originX = chunk.pos.x * CHUNK_SIZE, originZ = chunk.pos.z * CHUNK_SIZE;
+    int lx0 = std::max(box.x0 - originX, 0), lx1 = std::min(box.x1 - originX, CHUNK_SIZE - 1);
+    int lz0 = std::max(box.z0 - originZ, 0), lz1 = std::min(box.z1 - originZ, CHUNK_SIZE - 1);
+    if (lx0 > lx1 || lz0 > lz1) return 0;
+    if (grow) {
+        for (int s = sectionIndex(box.y0); s <= sectionIndex(box.y1); s++) {
+            growChunkBlocks(chunk, std::max(box.y0, s * SECTION_HEIGHT));
+            growChunkBlocks(chunk, std::min(box.y1, s * SECTION_HEIGHT + SECTION_HEIGHT - 1));
+        }
+    }
+    int changed = 0;
+    bool dynamicChanged = false;
+    for (auto& section : chunk.sections) {
+        int y0 = std::max(box.y0, section.baseY), y1 = std::min(box.y1, section.baseY + section.height - 1);
+        for (int y = y0; y <= y1; y++) {
+            for (int lz = lz0; lz <= lz1; lz++) {
+                BlockId* row = &section.blocks[(size_t)(y - section.baseY) * CHUNK_LAYER + lz * CHUNK_SIZE];
+                for (int lx = lx0; lx <= lx1; lx++) {
+                    BlockId old = row[lx];
+                    BlockId now = edit(old, originX + lx, y, originZ + lz);
+                    if (now == old) continue;
+                    row[lx] = now;
+                    changed++;
+                    int delta = (now != 0) - (old != 0);
+                    section.blockCount += delta;
+                    chunk.blockCount += delta;
+                    if ((old | now) & DYNAMIC_BLOCK) {
+                        dynamicChanged = true;
+                        if (now & DYNAMIC_BLOCK) chunk.rotations[localKey(lx, y, lz)] = Vec3(0,0,0);
+                        else chunk.rotations.erase(localKey(lx, y, lz));
+                    }
+                }
+            }
+        }
+        if (section.height) elideEmptySection(section);
+    }
+    if (changed) chunk.dirty = true;
+    if (dynamicChanged) chunk.instancesDirty = true;
+    return changed;
+}
+
+// Calls editChunk(chunk) for every chunk the box overlaps, marks the
+// sections around the box for remeshing in the chunks that changed and
+// relights the box
+template <typename EditChunk>
+int editBoxChunks(const BlockBox& box, EditChunk&& editChunk) {
+    int changed = 0;
+    int lowSection = sectionIndex(box.y0) - 1, highSection = sectionIndex(box.y1) + 1;
+    for (int cz = floorDiv(box.z0, CHUNK_SIZE); cz <= floorDiv(box.z1, CHUNK_SIZE); cz++) {
+        for (int cx = floorDiv(box.x0, CHUNK_SIZE); cx <= floorDiv(box.x1, CHUNK_SIZE); cx++) {
+            int chunkChanged = editChunk(editableChunk(cx, cz));
+            if (!chunkChanged) continue;
+            changed += chunkChanged;
+            for (int s = lowSection; s <= highSection; s++) {
+                markSectionMeshDirty(cx, s, cz);
+                markSectionMeshDirty(cx - 1, s, cz);
+                markSectionMeshDirty(cx + 1, s, cz);
+                markSectionMeshDirty(cx, s, cz - 1);
+                markSectionMeshDirty(cx, s, cz + 1);
+            }
+            lodStaleChunks.insert(chunkKey(cx, cz));
+        }
+    }
+    if (changed) relightCells(box.x0, box.y0, box.z0, box.x1, box.y1, box.z1);
+    return changed;
+}
+
+// Applies a Fill, Hollow, Clear or Replace edit; returns the blocks changed
+int applyBoxEdit(const JournalEdit& edit) {
+    BlockBox box = makeBlockBox(edit.x, edit.y, edit.z, edit.x1, edit.y1, edit.z1);
+    BlockId dynamicFlag = edit.rotate ? DYNAMIC_BLOCK : 0;
+    return editBoxChunks(box, [&](Chunk& chunk) {
+        makePaletteRoom(chunk);
+        switch (edit.op) {
+        case JournalEdit::Fill: {
+            BlockId id = paletteId(chunk, edit.color) | dynamicFlag;
+            return editChunkBox(chunk, box, true, [&](BlockId, int, int, int) { return id; });
+        }
+        case JournalEdit::Hollow: {
+            BlockId id = paletteId(chunk, edit.color) | dynamicFlag;
+            return editChunkBox(chunk, box, true, [&](BlockId, int x, int y, int z) -> BlockId {
+                bool shell = x == box.x0 || x == box.x1 || y == box.y0 || y == box.y1 || z == box.z0 || z == box.z1;
+                return shell ? id : 0;
+            });
+        }
+        case JournalEdit::Clear:
+            return editChunkBox(chunk, box, false, [](BlockId, int, int, int) -> BlockId { return 0; });
+        case JournalEdit::Replace: {
+            auto from = std::find(chunk.palette.begin(), chunk.palette.end(), edit.color);
+            if (from == chunk.palette.end()) return 0;
+            BlockId fromId = (BlockId)(from - chunk.palette.begin() + 1);
+            BlockId toId = paletteId(chunk, edit.color1);
+            return editChunkBox(chunk, box, false, [&](BlockId id, int, int, int) -> BlockId {
+                return (id & PALETTE_MASK) == fromId ? toId | (id & DYNAMIC_BLOCK) : id;
+            });
+        }
+        default:
+            return 0;
+        }
+    });
+}
+
+// Applies a box edit and logs it
+int bulkEdit(const JournalEdit& edit) {
+    int changed = applyBoxEdit(edit);
+    if (changed) editJournal.append(edit);
+    return changed;
+}
+
+// The chunk (cx, cz) if it is in memory, loaded or cached; nothing is
+// loaded for it and it does not move in the cache
+const Chunk* residentChunk(int cx, int cz) {
+    if (const Chunk* chunk = findChunk(cx, cz)) return chunk;
+    auto cached = chunkCache.index.find(chunkKey(cx, cz));
+    return cached != chunkCache.index.end() ? &cached->second->second : nullptr;
+}
+
+// Copies what is in memory of the box; chunks that are not read as air.
+// Copying only reads, so it never loads a chunk (which, when connected,
+// would be one the server does not know the client holds).
+void copyBox(const BlockBox& box, BlockClipboard& out) {
+    out.sizeX = box.x1 - box.x0 + 1;
+    out.sizeY = box.y1 - box.y0 + 1;
+    out.sizeZ = box.z1 - box.z0 + 1;
+    out.cells.assign((size_t)out.sizeX * out.sizeY * out.sizeZ, 0);
+    for (int cz = floorDiv(box.z0, CHUNK_SIZE); cz <= floorDiv(box.z1, CHUNK_SIZE); cz++) {
+        for (int cx = floorDiv(box.x0, CHUNK_SIZE); cx <= floorDiv(box.x1, CHUNK_SIZE); cx++) {
+            const Chunk* chunk = residentChunk(cx, cz);
+            if (!chunk) continue;
+            int originX = cx * CHUNK_SIZE, originZ = cz * CHUNK_SIZE;
+            int lx0 = std::max(box.x0 - originX, 0), lx1 = std::min(box.x1 - originX, CHUNK_SIZE - 1);
+            int lz0 = std::max(box.z0 - originZ, 0), lz1 = std::min(box.z1 - originZ, CHUNK_SIZE - 1);
+            for (auto& section : chunk->sections) {
+                int y0 = std::max(box.y0, section.baseY), y1 = std::min(box.y1, section.baseY + section.height - 1);
+                for (int y = y0; y <= y1; y++) {
+                    for (int lz = lz0; lz <= lz1; lz++) {
+                        const BlockId* row = &section.blocks[(size_t)(y - section.baseY) * CHUNK_LAYER + lz * CHUNK_SIZE];
+                        uint32_t* cells = &out.cells[((size_t)(y - box.y0) * out.sizeZ + (originZ + lz - box.z0)) * out.sizeX];
+                        for (int lx = lx0; lx <= lx1; lx++) {
+                            BlockId id = row[lx];
+                            if (!id) continue;
+                            cells[originX + lx - box.x0] = chunk->palette[(id & PALETTE_MASK) - 1] | CLIPBOARD_SOLID |
+                                                           ((id & DYNAMIC_BLOCK) ? CLIPBOARD_ROTATE : 0);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Turns the clipboard 90 degrees clockwise seen from above
+void rotateClipboard(BlockClipboard& board) {
+    std::vector<uint32_t> rotated(board.cells.size());
+    for (int y = 0; y < board.sizeY; y++) {
+        for (int z = 0; z < board.sizeZ; z++) {
+            for (int x = 0; x < board.sizeX; x++) {
+                // (x, z) -> (sizeZ - 1 - z, x) in a sizeZ wide, sizeX deep box
+                size_t to = ((size_t)y * board.sizeX + x) * board.sizeZ + (board.sizeZ - 1 - z);
+                rotated[to] = board.cells[((size_t)y * board.sizeZ + z) * board.sizeX + x];
+            }
+        }
+    }
+    std::swap(board.sizeX, board.sizeZ);
+    board.cells.swap(rotated);
+}
+
+// Writes the clipboard (air included) with its low corner at (x, y, z).
+// The journal gets one Fill or Clear per run of equal cells along x rather
+// than a record per block.
+int pasteClipboard(const BlockClipboard& board, int x, int y, int z) {
+    if (board.cells.empty()) return 0;
+    BlockBox box = {x, y, z, x + board.sizeX - 1, y + board.sizeY - 1, z + board.sizeZ - 1};
+    int changed = editBoxChunks(box, [&](Chunk& chunk) {
+        makePaletteRoom(chunk);
+        // Palette lookups are linear; remember the last color seen
+        uint32_t lastCell = 0;
+        BlockId lastId = 0;
+        return editChunkBox(chunk, box, true, [&](BlockId, int bx, int by, int bz) -> BlockId {
+            uint32_t cell = board.cells[((size_t)(by - y) * board.sizeZ + (bz - z)) * board.sizeX + (bx - x)];
+            if (!cell) return 0;
+            if (cell != lastCell) {
+                lastCell = cell;
+                lastId = paletteId(chunk, cell & 0xFFFFFF) | ((cell & CLIPBOARD_ROTATE) ? DYNAMIC_BLOCK : 0);
+            }
+            return lastId;
+        });
+    });
+    if (!changed) return 0;
+    for (int by = 0; by < board.sizeY; by++) {
+        for (int bz = 0; bz < board.sizeZ; bz++) {
+            const uint32_t* row = &board.cells[((size_t)by * board.sizeZ + bz) * board.sizeX];
+            for (int start = 0, end; start < board.sizeX; start = end) {
+                for (end = start + 1; end < board.sizeX && row[end] == row[start]; end++) {}
+                JournalEdit edit;
+                edit.op = row[start] ? JournalEdit::Fill : JournalEdit::Clear;
+                edit.rotate = (row[start] & CLIPBOARD_ROTATE) != 0;
+                edit.color = row[start] & 0xFFFFFF;
+                edit.x = x + start; edit.y = edit.y1 = y + by; edit.z = edit.z1 = z + bz;
+                edit.x1 = x + end - 1;
+                editJournal.append(edit);
+            }
+        }
+    }
+    return changed;
+}
+
+// --------------------
+// Edit journal
+// --------------------
+// Every edit is logged before its chunk is saved, so nothing is lost if the
+// game dies with dirty chunks in memory. Compaction rotates the journal,
+// saves all dirty chunks in the background and drops the rotated journal
+// once no save is pending any more. Failed saves are retried every
+// JOURNAL_COMPACT_INTERVAL, and no new compaction starts until they land.
+bool journalCompacting = false;
+float lastJournalCompaction = 0;
+// The journals of an earlier session could not be folded into the store:
+// they are kept, new edits go after them, and nothing is compacted until
+// the next start replays them
+bool journalBacklog = false;
+
+std::string journalPath() { return worldStore.directory() + "/edits.journal"; }
+std::string rotatedJournalPath() { return journalPath() + ".old"; }
+
+void journalPlace(int x, int y, int z, const Vec3& color, bool rotate) {
+    JournalEdit edit;
+    edit.op = JournalEdit::Place;
+    edit.rotate = rotate;
+    edit.x = x; edit.y = y; edit.z = z;
+    edit.color = packColor(color.x, color.y, color.z);
+    editJournal.append(edit);
+}
+
+void journalBreak(int x, int y, int z) {
+    JournalEdit edit;
+    edit.op = JournalEdit::Break;
+    edit.x = x; edit.y = y; edit.z = z;
+    editJournal.append(edit);
+}
+
+// Copy of a loaded chunk's blocks for saving, without its GL objects
+Chunk chunkSnapshot(const Chunk& chunk) {
+    Chunk copy;
+    copy.pos = chunk.pos;
+    copy.dirty = chunk.dirty;
+    copy.baseSection = chunk.baseSection;
+    copy.sections.resize(chunk.sections.size());
+    for (size_t i = 0; i < chunk.sections.size(); i++) {
+        copy.sections[i].baseY = chunk.sections[i].baseY;
+        copy.sections[i].height = chunk.sections[i].height;
+        copy.sections[i].blocks = chunk.sections[i].blocks;
+        copy.sections[i].blockCount = chunk.sections[i].blockCount;
+    }
+    copy.blockCount = chunk.blockCount;
+    copy.palette = chunk.palette;
+    copy.rotations = chunk.rotations;
+    return copy;
+}
+
+// Applies the journals a crashed session left behind to the chunk store.
+// Edits are absolute (set or clear blocks, or recolor them), so replaying
+// them in order over chunks that were partly saved already gives the same
+// result. Runs at startup, before streaming, and returns the number of
+// edits replayed.
+int replayEditJournals() {
+    std::vector<JournalEdit> edits;
+    readJournal(rotatedJournalPath(), edits);  // older edits first
+    readJournal(journalPath(), edits);
+    for (auto& edit : edits) {
+        if (isBoxEdit(edit.op)) {
+            applyBoxEdit(edit);
+            continue;
+        }
+        int cx = floorDiv(edit.x, CHUNK_SIZE), cz = floorDiv(edit.z, CHUNK_SIZE);
+        if (!findChunk(cx, cz)) loadedChunks[chunkKey(cx, cz)] = loadChunk(cx, cz);
+        if (edit.op == JournalEdit::Place) {
+            float r, g, b;
+            unpackColor(edit.color, r, g, b);
+            setBlock(edit.x, edit.y, edit.z, Vec3(r, g, b), edit.rotate);
+        } else {
+            removeBlock(edit.x, edit.y, edit.z);
+        }
+    }
+    bool saved = true;
+    for (auto& [key, chunk] : loadedChunks) {
+        if (chunk.dirty) saved = saveChunk(chunk) && saved;
+    }
+    loadedChunks.clear();
+    lodStaleChunks.clear();
+    // Keep the journals around if anything failed to save
+    if (saved) {
+        std::error_code ec;
+        std::filesystem::remove(rotatedJournalPath(), ec);
+        std::filesystem::remove(journalPath(), ec);
+    } else if (!edits.empty()) {
+        journalBacklog = true;
+    }
+    return edits.size();
+}
+
+void startJournalCompaction(float now) {
+    lastJournalCompaction = now;
+    if (!editJournal.rotate(rotatedJournalPath())) return;
+    for (auto& [key, chunk] : loadedChunks) {
+        if (!chunk.dirty) continue;
+        queueChunkSave(chunkSnapshot(chunk));
+        chunk.dirty = false;
+    }
+    for (auto& [key, chunk] : chunkCache.entries) {
+        if (!chunk.dirty) continue;
+        queueChunkSave(chunkSnapshot(chunk));
+        chunk.dirty = false;
+    }
+    journalCompacting = true;
+}
+
+// Called once per frame: flushes this frame's edits and drives compaction
+void updateEditJournal(float now) {
+    editJournal.flush();
+    if (journalCompacting) {
+        std::vector<int64_t> retry;
+        {
+            std::lock_guard<std::mutex> lock(streamer.savingMutex);
+            if (streamer.savingChunks.empty()) {
+                std::error_code ec;
+                std::filesystem::remove(rotatedJournalPath(), ec);
+                journalCompacting = false;
+            } else if (!streamer.failedSaves.empty() && now - lastJournalCompaction >= JOURNAL_COMPACT_INTERVAL) {
+                retry.swap(streamer.failedSaves);
+            }
+        }
+        if (!retry.empty()) {
+            std::cerr << "Cannot save " << retry.size() << " chunks, retrying" << std::endl;
+            lastJournalCompaction = now;
+            for (int64_t key : retry) queueChunkJob({ChunkJob::Save, (int)(key >> 32), (int)(int32_t)(key & 0xFFFFFFFF)});
+        }
+    } else if (!journalBacklog && editJournal.size() && (editJournal.size() >= JOURNAL_COMPACT_EDITS ||
+                                      now - lastJournalCompaction >= JOURNAL_COMPACT_INTERVAL)) {
+        startJournalCompaction(now);
+    }
+}
+
+// --------------------
+// Chunk meshing
+// --------------------
+// Corner i of the quad gets color * shade[i]
+void emitShadedQuad(std::vector<float>& out, const Vec3 corners[4], const Vec3& color, const float shade[4]) {
+    // Same triangle split and barycentrics as cubeVertices so the edge shader
+    // outlines every quad the way it outlines a single cube face. The split
+    // runs along the brighter diagonal, so occlusion in one corner does not
+    // bleed across the whole quad.
+    static const int order[2][6] = {{0, 1, 2, 2, 3, 0}, {1, 2, 3, 3, 0, 1}};
+    static const float bary[3][3] = {{1,0,0},{0,1,0},{0,0,1}};
+    const int* split = order[shade[0] + shade[2] < shade[1] + shade[3]];
+    for (int i = 0; i < 6; i++) {
+        const Vec3& p = corners[split[i]];
+        const float* b = bary[i % 3];
+        float s = shade[split[i]];
+        float v[MESH_VERTEX_FLOATS] = {p.x, p.y, p.z, b[0], b[1], b[2], color.x * s, color.y * s, color.z * s};
+        out.insert(out.end(), v, v + MESH_VERTEX_FLOATS);
+    }
+}
+
+void emitQuad(std::vector<float>& out, const Vec3 corners[4], const Vec3& color) {
+    static const float unshaded[4] = {1, 1, 1, 1};
+    emitShadedQuad(out, corners, color, unshaded);
+}
+
+// Shade of a light level: a dark cave keeps a little of its color
+float lightBrightness(int level) {
+    return 0.08f + 0.92f * std::pow(0.82f, (float)(MAX_LIGHT - level));
+}
+
+// Shade of a face corner with 0 to 3 of its neighbours open (see
+// buildSectionMesh)
+const float AO_SHADE[4] = {0.45f, 0.65f, 0.82f, 1.0f};
+
+// Everything one section's mesh depends on, copied on the main thread so a
+// mesh worker can build it while the chunk keeps changing: the section's
+// occupied layers plus a one-cell border of the sections and chunks around
+// it, diagonals included, with the light levels of the same cells. Dynamic
+// blocks are left out, as they are drawn instanced.
+struct SectionSnapshot {
+    int cx = 0, cz = 0, sectionY = 0;
+    int baseY = 0, height = 0;   // occupied layers, as in ChunkSection
+    // (CHUNK_SIZE + 2)^2 x (height + 2) cells, x fastest, then z, then y,
+    // starting at (-1, baseY - 1, -1). Border cells are only 0 or 1.
+    std::vector<BlockId> cells;
+    std::vector<uint8_t> light;  // as in ChunkLight, laid out as cells
+    std::vector<uint32_t> palette;
+};
+
+const int SNAPSHOT_SPAN = CHUNK_SIZE + 2;
+
+// Index of cell (x, y, z) of a snapshot in section-local coordinates, -1
+// to size
+size_t snapshotIndex(int x, int y, int z) {
+    return ((size_t)(y + 1) * SNAPSHOT_SPAN + (z + 1)) * SNAPSHOT_SPAN + (x + 1);
+}
+
+BlockId snapshotCell(const SectionSnapshot& snapshot, int x, int y, int z) {
+    return snapshot.cells[snapshotIndex(x, y, z)];
+}
+
+SectionSnapshot snapshotSection(const Chunk& chunk, int sectionY) {
+    SectionSnapshot snapshot;
+    snapshot.cx = chunk.pos.x;
+    snapshot.cz = chunk.pos.z;
+    snapshot.sectionY = sectionY;
+    const ChunkSection* section = findSection(chunk, sectionY);
+    if (!section || !section->blockCount) return snapshot;
+    snapshot.baseY = section->baseY;
+    snapshot.height = section->height;
+    snapshot.palette = chunk.palette;
+    size_t cellCount = (size_t)SNAPSHOT_SPAN * SNAPSHOT_SPAN * (section->height + 2);
+    snapshot.cells.assign(cellCount, 0);
+    snapshot.light.assign(cellCount, OPEN_SKY);
+
+    // Border lookups go to the chunk that owns the cell; unloaded and unlit
+    // ones read as open sky
+    const Chunk* around[3][3];
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            around[dz + 1][dx + 1] = dx || dz ? findChunk(snapshot.cx + dx, snapshot.cz + dz) : &chunk;
+        }
+    }
+    for (int ly = -1; ly <= section->height; ly++) {
+        int y = section->baseY + ly;
+        bool inside = ly >= 0 && ly < section->height;
+        for (int z = -1; z <= CHUNK_SIZE; z++) {
+            size_t rowStart = snapshotIndex(0, ly, z);
+            BlockId* row = &snapshot.cells[rowStart];
+            uint8_t* lightRow = &snapshot.light[rowStart];
+            int oz = z < 0 ? 0 : z < CHUNK_SIZE ? 1 : 2;
+            int lz = z - (oz - 1) * CHUNK_SIZE;
+            for (int x = -1; x <= CHUNK_SIZE; x++) {
+                int ox = x < 0 ? 0 : x < CHUNK_SIZE ? 1 : 2;
+                int lx = x - (ox - 1) * CHUNK_SIZE;
+                const Chunk* owner = around[oz][ox];
+                if (!owner) continue;
+                BlockId id;
+                if (inside && owner == &chunk) id = section->blocks[(size_t)ly * CHUNK_LAYER + z * CHUNK_SIZE + x];
+                else id = chunkBlockAt(*owner, lx, y, lz);
+                if (id & DYNAMIC_BLOCK) id = 0;
+                bool border = !inside || owner != &chunk;
+                row[x] = border ? id != 0 : id;
+                if (owner->light.lit) lightRow[x] = chunkLightAt(*owner, lx, y, lz);
+            }
+        }
+    }
+    return snapshot;
+}
+
+// Builds world-space triangles for one section: faces touching another
+// cube (in this chunk or a loaded neighbour) are dropped, and coplanar
+// faces of the same color and shade are merged greedily into larger quads.
+// A face is shaded by the light of the cell in front of it, and each of its
+// corners by ambient occlusion: how many of the three cells around the
+// corner on the face's front layer are open. Lamps are drawn at full
+// brightness. Runs on the mesh workers.
+std::vector<float> buildSectionMesh(const SectionSnapshot& snapshot) {
+    std::vector<float> vertices;
+    if (!snapshot.height) return vertices;
+    int originX = snapshot.cx * CHUNK_SIZE, originZ = snapshot.cz * CHUNK_SIZE;
+
+    // Only the section's occupied layers; cells above and below come from
+    // the snapshot border
+    int minY = snapshot.baseY;
+    int dims[3] = {CHUNK_SIZE, snapshot.height, CHUNK_SIZE};
+    auto cell = [&](const int p[3]) { return snapshotCell(snapshot, p[0], p[1], p[2]); };
+    const ptrdiff_t stride[3] = {1, SNAPSHOT_SPAN * SNAPSHOT_SPAN, SNAPSHOT_SPAN};  // x, y, z
+
+    // Mask holds this chunk's block id (equal ids mean equal colors) in the
+    // low 16 bits, the light level above them and 2 bits of occlusion per
+    // corner from bit 20
+    std::vector<uint32_t> mask;
+    for (int d = 0; d < 3; d++) {
+        int u = (d + 1) % 3, v = (d + 2) % 3;
+        mask.assign((size_t)dims[u] * dims[v], 0);
+        for (int side = -1; side <= 1; side += 2) {
+            for (int k = 0; k < dims[d]; k++) {
+                // Visible faces of this slice
+                int p[3];
+                p[d] = k;
+                for (int j = 0; j < dims[v]; j++) {
+                    for (int i = 0; i < dims[u]; i++) {
+                        p[u] = i; p[v] = j;
+                        BlockId a = cell(p);
+                        p[d] = k + side;
+                        BlockId b = cell(p);
+                        uint32_t face = 0;
+                        if (a && !b) {
+                            int light = MAX_LIGHT;
+                            unsigned occlusion = 0xFF;
+                            if (snapshot.palette[(a & PALETTE_MASK) - 1] != LAMP_COLOR) {
+                                size_t front = snapshotIndex(p[0], p[1], p[2]);
+                                light = lightOf(snapshot.light[front]);
+                                occlusion = 0;
+                                for (int corner = 0; corner < 4; corner++) {
+                                    ptrdiff_t su = corner == 1 || corner == 2 ? stride[u] : -stride[u];
+                                    ptrdiff_t sv = corner >= 2 ? stride[v] : -stride[v];
+                                    bool s1 = snapshot.cells[front + su] != 0, s2 = snapshot.cells[front + sv] != 0;
+                                    bool c = snapshot.cells[front + su + sv] != 0;
+                                    unsigned open = s1 && s2 ? 0 : 3 - (s1 + s2 + c);
+                                    occlusion |= open << (2 * corner);
+                                }
+                            }
+                            face = a | light << 16 | occlusion << 20;
+                        }
+                        p[d] = k;
+                        mask[(size_t)j * dims[u] + i] = face;
+                    }
+                }
+                // Greedy merge into rectangles
+                for (int j = 0; j < dims[v]; j++) {
+                    for (int i = 0; i < dims[u];) {
+                        uint32_t c = mask[(size_t)j * dims[u] + i];
+                        if (!c) { i++; continue; }
+                        // Corners shaded apart would smear across a larger quad
+                        unsigned occlusion = c >> 20;
+                        bool even = occlusion == (occlusion & 3) * 0x55;
+                        int w = 1;
+                        while (even && i + w < dims[u] && mask[(size_t)j * dims[u] + i + w] == c) w++;
+                        int h = 1;
+                        for (; even && j + h < dims[v]; h++) {
+                            bool rowMatches = true;
+                            for (int x = 0; x < w && rowMatches; x++) {
+                                rowMatches = mask[(size_t)(j + h) * dims[u] + i + x] == c;
+                            }
+                            if (!rowMatches) break;
+                        }
+                        for (int y = 0; y < h; y++)
+                            for (int x = 0; x < w; x++)
+                                mask[(size_t)(j + y) * dims[u] + i + x] = 0;
+
+                        float base[3], du[3] = {0,0,0}, dv[3] = {0,0,0};
+                        base[d] = k + side * 0.5f;
+                        base[u] = i - 0.5f;
+                        base[v] = j - 0.5f;
+                        du[u] = (float)w;
+                        dv[v] = (float)h;
+                        Vec3 origin(base[0] + originX, base[1] + minY, base[2] + originZ);
+                        Vec3 corners[4] = {
+                            origin,
+                            origin + Vec3(du[0], du[1], du[2]),
+                            origin + Vec3(du[0] + dv[0], du[1] + dv[1], du[2] + dv[2]),
+                            origin + Vec3(dv[0], dv[1], dv[2])
+                        };
+                        Vec3 color;
+                        unpackColor(snapshot.palette[(c & PALETTE_MASK) - 1], color.x, color.y, color.z);
+                        float brightness = lightBrightness(c >> 16 & MAX_LIGHT), shade[4];
+                        for (int corner = 0; corner < 4; corner++) shade[corner] = brightness * AO_SHADE[occlusion >> (2 * corner) & 3];
+                        emitShadedQuad(vertices, corners, color, shade);
+                        i += w;
+                    }
+                }
+            }
+        }
+    }
+    return vertices;
+}
+
+// Flood-fills the empty cells of a section (dynamic blocks count as empty,
+// as in the mesh) and links every pair of faces one connected region of
+// them touches. Culling walks from section to section only through linked
+// faces, so chunks sealed off by terrain are never reached.
+uint64_t sectionFaceLinks(const SectionSnapshot& snapshot) {
+    if (!snapshot.height) return ALL_FACES_LINKED;
+    const int cells = CHUNK_LAYER * SECTION_HEIGHT;
+    // 0 empty, 1 solid or already filled; indexed y-major then z then x
+    static thread_local std::vector<uint8_t> closed;
+    static thread_local std::vector<int> stack;
+    closed.assign(cells, 0);
+    int offset = snapshot.baseY - snapshot.sectionY * SECTION_HEIGHT;
+    for (int ly = 0; ly < snapshot.height; ly++) {
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            for (int x = 0; x < CHUNK_SIZE; x++) {
+                closed[(ly + offset) * CHUNK_LAYER + z * CHUNK_SIZE + x] = snapshotCell(snapshot, x, ly, z) != 0;
+            }
+        }
+    }
+    uint64_t links = 0;
+    for (int start = 0; start < cells; start++) {
+        if (closed[start]) continue;
+        closed[start] = 1;
+        stack.assign(1, start);
+        unsigned faces = 0;
+        while (!stack.empty()) {
+            int c = stack.back();
+            stack.pop_back();
+            int x = c % CHUNK_SIZE, z = c / CHUNK_SIZE % CHUNK_SIZE, y = c / CHUNK_LAYER;
+            faces |= (x == 0) << FACE_WEST | (x == CHUNK_SIZE - 1) << FACE_EAST |
+                     (y == 0) << FACE_DOWN | (y == SECTION_HEIGHT - 1) << FACE_UP |
+                     (z == 0) << FACE_NORTH | (z == CHUNK_SIZE - 1) << FACE_SOUTH;
+            auto visit = [&](bool inside, int next) {
+                if (inside && !closed[next]) {
+                    closed[next] = 1;
+                    stack.push_back(next);
+                }
+            };
+            visit(x > 0, c - 1);
+            visit(x < CHUNK_SIZE - 1, c + 1);
+            visit(z > 0, c - CHUNK_SIZE);
+            visit(z < CHUNK_SIZE - 1, c + CHUNK_SIZE);
+            visit(y > 0, c - CHUNK_LAYER);
+            visit(y < SECTION_HEIGHT - 1, c + CHUNK_LAYER);
+        }
+        for (int a = 0; a < SECTION_FACES; a++) {
+            if (faces >> a & 1) links |= (uint64_t)faces << (a * SECTION_FACES);
+        }
+        if (links == ALL_FACES_LINKED) break;
+    }
+    return links;
+}
+
+bool facesLinked(uint64_t links, int a, int b) {
+    return links >> (a * SECTION_FACES + b) & 1;
+}
+
+bool sectionInRange(int sectionY, const Vec3& cameraPos) {
+    return abs(sectionY - sectionIndex(blockCoord(cameraPos.y))) <= SECTION_RENDER_DISTANCE;
+}
+
+// --------------------
+// Mesh workers
+// --------------------
+// Dirty sections are snapshotted on the main thread and meshed by a pool of
+// workers; finished meshes replace the old ones at the start of the next
+// frame's meshing, and the old mesh is drawn until then. Jobs are taken
+// from one queue: sections an edit touched go to its front, the rest are
+// queued nearest first. Each job carries a generation number that its
+// section remembers, so results for sections that were unloaded, re-queued
+// or scrolled out of range meanwhile are dropped.
+const int MESH_JOBS_IN_FLIGHT = 512;
+
+struct MeshJob {
+    SectionSnapshot snapshot;
+    uint64_t generation;
+};
+
+struct MeshResult {
+    int cx, cz, sectionY;
+    uint64_t generation;
+    std::vector<float> vertices;
+    uint64_t faceLinks;
+};
+
+struct MeshPipeline {
+    std::vector<std::thread> workers;
+    std::mutex jobMutex;
+    std::condition_variable jobReady;
+    std::deque<MeshJob*> jobs;
+    bool stopping = false;
+    LockFreeQueue<MeshResult*> finished{1024};  // more than MESH_JOBS_IN_FLIGHT
+    // Main thread only
+    uint64_t nextGeneration = 1;
+    int inFlight = 0;
+    int queuedThisFrame = 0, swappedThisFrame = 0;
+};
+
+MeshPipeline meshPipeline;
+
+void meshWorker() {
+    profileSetThreadName("mesh worker");
+    while (true) {
+        MeshJob* job;
+        {
+            std::unique_lock<std::mutex> lock(meshPipeline.jobMutex);
+            meshPipeline.jobReady.wait(lock, []{ return meshPipeline.stopping || !meshPipeline.jobs.empty(); });
+            if (meshPipeline.stopping) break;
+            job = meshPipeline.jobs.front();
+            meshPipeline.jobs.pop_front();
+        }
+        ProfileZone zone("mesh_build");
+        const SectionSnapshot& snapshot = job->snapshot;
+        MeshResult* result = new MeshResult{snapshot.cx, snapshot.cz, snapshot.sectionY, job->generation,
+                                            buildSectionMesh(snapshot), sectionFaceLinks(snapshot)};
+        delete job;
+        while (!meshPipeline.finished.push(result)) std::this_thread::yield();
+    }
+}
+
+void startMeshWorkers() {
+    int count = std::clamp((int)std::thread::hardware_concurrency() - 1, 1, 8);
+    for (int i = 0; i < count; i++) meshPipeline.workers.emplace_back(meshWorker);
+}
+
+// Drops queued jobs and unclaimed results and joins the workers
+void stopMeshWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(meshPipeline.jobMutex);
+        meshPipeline.stopping = true;
+        for (MeshJob* job : meshPipeline.jobs) delete job;
+        meshPipeline.jobs.clear();
+    }
+    meshPipeline.jobReady.notify_all();
+    for (auto& t : meshPipeline.workers) t.join();
+    meshPipeline.workers.clear();
+    MeshResult* result;
+    while (meshPipeline.finished.pop(result)) delete result;
+    meshPipeline.inFlight = 0;
+    meshPipeline.stopping = false;
+}
+
+void uploadSectionMesh(ChunkSection& section, const std::vector<float>& vertices) {
+    uploadArenaMesh(section.mesh, vertices);
+    section.meshDirty = false;
+}
+
+// Swaps in the meshes finished since the last call
+void collectFinishedMeshes(const Vec3& cameraPos) {
+    MeshResult* result;
+    while (meshPipeline.finished.pop(result)) {
+        meshPipeline.inFlight--;
+        Chunk* chunk = findChunk(result->cx, result->cz);
+        ChunkSection* section = chunk ? findSection(*chunk, result->sectionY) : nullptr;
+        if (section && section->meshJob == result->generation) {
+            section->meshJob = 0;
+            if (sectionInRange(result->sectionY, cameraPos)) {
+                uploadArenaMesh(section->mesh, result->vertices);
+                section->faceLinks = result->faceLinks;
+                meshPipeline.swappedThisFrame++;
+            } else {
+                section->meshDirty = true;
+            }
+        }
+        delete result;
+    }
+}
+
+// Swaps in finished meshes, frees the meshes of sections the camera has
+// moved away from vertically, lights new chunks and queues dirty sections
+// near its height
+void rebuildDirtyChunkMeshes(const Vec3& cameraPos) {
+    meshPipeline.queuedThisFrame = meshPipeline.swappedThisFrame = 0;
+    collectFinishedMeshes(cameraPos);
+    lightLoadedChunks();
+    int camChunkX = (int)std::floor(cameraPos.x / CHUNK_SIZE);
+    int camChunkZ = (int)std::floor(cameraPos.z / CHUNK_SIZE);
+    int camSection = sectionIndex(blockCoord(cameraPos.y));
+    struct Candidate {
+        int priority;  // lower first; edits before everything else
+        Chunk* chunk;
+        int sectionY;
+    };
+    std::vector<Candidate> candidates;
+    for (auto& [key, chunk] : loadedChunks) {
+        int distance = std::max(abs((int)chunk.pos.x - camChunkX), abs((int)chunk.pos.z - camChunkZ));
+        for (size_t i = 0; i < chunk.sections.size(); i++) {
+            ChunkSection& section = chunk.sections[i];
+            int sectionY = chunk.baseSection + (int)i;
+            if (!sectionInRange(sectionY, cameraPos)) {
+                if (section.mesh.uploaded) destroySectionMesh(section);
+                continue;
+            }
+            if (!section.meshDirty || section.meshJob) continue;
+            if (!section.blockCount) {
+                // Nothing to build
+                uploadSectionMesh(section, {});
+                section.faceLinks = ALL_FACES_LINKED;
+                continue;
+            }
+            int priority = std::max(distance, abs(sectionY - camSection)) - (section.meshUrgent ? 1000 : 0);
+            candidates.push_back({priority, &chunk, sectionY});
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.priority < b.priority;
+    });
+    int budget = std::min((int)candidates.size(), MESH_JOBS_IN_FLIGHT - meshPipeline.inFlight);
+    if (budget <= 0) return;
+    std::vector<MeshJob*> urgent, normal;
+    for (int i = 0; i < budget; i++) {
+        Candidate& c = candidates[i];
+        ChunkSection& section = *findSection(*c.chunk, c.sectionY);
+        MeshJob* job = new MeshJob{snapshotSection(*c.chunk, c.sectionY), meshPipeline.nextGeneration++};
+        section.meshJob = job->generation;
+        (section.meshUrgent ? urgent : normal).push_back(job);
+        section.meshDirty = section.meshUrgent = false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(meshPipeline.jobMutex);
+        // Edits overtake everything queued earlier, in priority order
+        for (auto it = urgent.rbegin(); it != urgent.rend(); ++it) meshPipeline.jobs.push_front(*it);
+        for (MeshJob* job : normal) meshPipeline.jobs.push_back(job);
+    }
+    meshPipeline.jobReady.notify_all();
+    meshPipeline.inFlight += budget;
+    meshPipeline.queuedThisFrame = budget;
+}
+
+// --------------------
+// Level of detail
+// --------------------
+// Chunks between RENDER_DISTANCE and viewDistance are drawn as heightfield
+// tiles: the top block of every step x step column group becomes one
+// raised cell, with step growing with distance. Workers read or generate
+// the chunks and hand back only their column summary; the tiny tile mesh is
+// built here, so changing a tile's step never touches the disk. A tile
+// keeps drawing its old mesh until the new one is uploaded, and stays
+// until the full chunk mesh that replaces it is ready.
+const int LOD_2X_DISTANCE = 7;   // furthest chunk distance drawn at step 2
+const int LOD_4X_DISTANCE = 12;  // ... at step 4, step 8 beyond
+const int LOD_MESHES_PER_FRAME = 64;
+
+struct LodTile {
+    int cx = 0, cz = 0;
+    LodColumns columns;
+    int minY = 0, maxY = 0;  // occupied height range, for culling
+    int step = 0;            // of the current mesh, 0 before the first one
+    int targetStep = 0;
+    bool covered = false;    // the full chunk mesh is drawn instead
+    ArenaMesh mesh;
+};
+
+std::unordered_map<int64_t, LodTile> lodTiles;
+std::unordered_set<int64_t> pendingLodTiles;
+int lodScanX = INT32_MIN, lodScanZ = INT32_MIN, lodScanDistance = 0;
+
+int chunkDistance(int cx, int cz, int camChunkX, int camChunkZ) {
+    return std::max(abs(cx - camChunkX), abs(cz - camChunkZ));
+}
+
+int lodStep(int distance) {
+    if (distance <= LOD_2X_DISTANCE) return 2;
+    if (distance <= LOD_4X_DISTANCE) return 4;
+    return 8;
+}
+
+// True once every section the camera would see has a mesh (stale or not)
+bool chunkMeshReady(const Chunk& chunk, const Vec3& cameraPos) {
+    for (size_t i = 0; i < chunk.sections.size(); i++) {
+        const ChunkSection& section = chunk.sections[i];
+        if (!section.blockCount || !sectionInRange(chunk.baseSection + (int)i, cameraPos)) continue;
+        if (section.meshDirty && !section.mesh.uploaded) return false;
+    }
+    return true;
+}
+
+void addLodTile(int cx, int cz, const LodColumns& columns) {
+    LodTile& tile = lodTiles[chunkKey(cx, cz)];
+    tile.cx = cx;
+    tile.cz = cz;
+    tile.columns = columns;
+    tile.minY = INT32_MAX;
+    tile.maxY = INT32_MIN;
+    for (int h : columns.height) {
+        if (h == LOD_EMPTY_COLUMN) continue;
+        tile.minY = std::min(tile.minY, h);
+        tile.maxY = std::max(tile.maxY, h);
+    }
+}
+
+void destroyLodTileMesh(LodTile& tile) {
+    releaseArenaMesh(tile.mesh);
+    tile.step = 0;
+}
+
+// Top quad per cell plus walls down to lower neighbour cells; at the tile
+// edge walls drop to the tile's lowest column so no gap shows against the
+// next tile or a full chunk
+std::vector<float> buildLodMesh(const LodTile& tile, int step) {
+    std::vector<float> vertices;
+    if (tile.minY > tile.maxY) return vertices;
+    int cells = CHUNK_SIZE / step;
+    std::vector<int> height((size_t)cells * cells, LOD_EMPTY_COLUMN);
+    std::vector<uint32_t> color((size_t)cells * cells, 0);
+    for (int z = 0; z < CHUNK_SIZE; z++) {
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            int c = (z / step) * cells + x / step;
+            int h = tile.columns.height[z * CHUNK_SIZE + x];
+            if (h > height[c]) {
+                height[c] = h;
+                color[c] = tile.columns.color[z * CHUNK_SIZE + x];
+            }
+        }
+    }
+    float skirt = tile.minY - 0.5f;
+    float originX = tile.cx * CHUNK_SIZE - 0.5f, originZ = tile.cz * CHUNK_SIZE - 0.5f;
+    for (int j = 0; j < cells; j++) {
+        for (int i = 0; i < cells; i++) {
+            int h = height[j * cells + i];
+            if (h == LOD_EMPTY_COLUMN) continue;
+            Vec3 rgb;
+            unpackColor(color[j * cells + i], rgb.x, rgb.y, rgb.z);
+            float x0 = originX + i * step, x1 = x0 + step;
+            float z0 = originZ + j * step, z1 = z0 + step;
+            float top = h + 0.5f;
+            Vec3 topQuad[4] = {Vec3(x0, top, z0), Vec3(x1, top, z0), Vec3(x1, top, z1), Vec3(x0, top, z1)};
+            emitQuad(vertices, topQuad, rgb);
+            // -x, +x, -z, +z
+            const int di[4] = {-1, 1, 0, 0}, dj[4] = {0, 0, -1, 1};
+            for (int side = 0; side < 4; side++) {
+                int ni = i + di[side], nj = j + dj[side];
+                float bottom = skirt;
+                if (ni >= 0 && ni < cells && nj >= 0 && nj < cells) {
+                    int nh = height[nj * cells + ni];
+                    if (nh != LOD_EMPTY_COLUMN) bottom = nh + 0.5f;
+                }
+                if (bottom >= top) continue;
+                float wx0 = side == 1 ? x1 : x0, wx1 = side == 0 ? x0 : x1;
+                float wz0 = side == 3 ? z1 : z0, wz1 = side == 2 ? z0 : z1;
+                Vec3 wall[4] = {Vec3(wx0, bottom, wz0), Vec3(wx1, bottom, wz1), Vec3(wx1, top, wz1), Vec3(wx0, top, wz0)};
+                emitQuad(vertices, wall, rgb);
+            }
+        }
+    }
+    return vertices;
+}
+
+void uploadLodTileMesh(LodTile& tile, const std::vector<float>& vertices) {
+    uploadArenaMesh(tile.mesh, vertices);
+    tile.step = tile.targetStep;
+}
+
+// Takes finished column summaries, requests missing tiles, picks each
+// tile's step and drops tiles that are out of range or fully replaced.
+// Meshes are (re)built separately by uploadLodTiles.
+void updateLodTiles(const Vec3& cameraPos) {
+    int camChunkX = (int)std::floor(cameraPos.x / CHUNK_SIZE);
+    int camChunkZ = (int)std::floor(cameraPos.z / CHUNK_SIZE);
+    LodResult* result;
+    while (streamer.finishedLod.pop(result)) {
+        int64_t key = chunkKey(result->cx, result->cz);
+        pendingLodTiles.erase(key);
+        if (!lodTiles.count(key) && chunkDistance(result->cx, result->cz, camChunkX, camChunkZ) <= viewDistance) {
+            addLodTile(result->cx, result->cz, result->columns);
+        }
+        delete result;
+    }
+
+    // Bulk edits reach past the render distance; resummarise the tiles they
+    // touched (or are about to get from a worker, with the old blocks). The
+    // old mesh stays up until the new one is built.
+    for (int64_t key : lodStaleChunks) {
+        auto tile = lodTiles.find(key);
+        if (tile == lodTiles.end() && !pendingLodTiles.count(key)) continue;
+        int cx = (int)(key >> 32), cz = (int)(int32_t)(key & 0xFFFFFFFF);
+        const Chunk* chunk = findChunk(cx, cz);
+        auto cached = chunkCache.index.find(key);
+        if (!chunk && cached != chunkCache.index.end()) chunk = &cached->second->second;
+        if (chunk) {
+            LodColumns columns;
+            lodColumns(*chunk, columns);
+            addLodTile(cx, cz, columns);
+            lodTiles[key].step = 0;
+        } else if (tile != lodTiles.end()) {
+            destroyLodTileMesh(tile->second);
+            lodTiles.erase(tile);
+            lodScanX = INT32_MIN;
+        }
+    }
+    lodStaleChunks.clear();
+
+    // New tiles only appear when the camera crosses a chunk line or the
+    // view distance changes
+    if (camChunkX != lodScanX || camChunkZ != lodScanZ || viewDistance != lodScanDistance) {
+        lodScanX = camChunkX;
+        lodScanZ = camChunkZ;
+        lodScanDistance = viewDistance;
+        std::vector<std::pair<int, int>> missing;
+        for (int dz = -viewDistance; dz <= viewDistance; dz++) {
+            for (int dx = -viewDistance; dx <= viewDistance; dx++) {
+                if (std::max(abs(dx), abs(dz)) <= RENDER_DISTANCE) continue;
+                int cx = camChunkX + dx, cz = camChunkZ + dz;
+                int64_t key = chunkKey(cx, cz);
+                if (lodTiles.count(key) || pendingLodTiles.count(key)) continue;
+                // Chunks already in memory may have unsaved edits; summarise them here
+                const Chunk* chunk = findChunk(cx, cz);
+                auto cached = chunkCache.index.find(key);
+                if (!chunk && cached != chunkCache.index.end()) chunk = &cached->second->second;
+                if (chunk) {
+                    LodColumns columns;
+                    lodColumns(*chunk, columns);
+                    addLodTile(cx, cz, columns);
+                } else {
+                    missing.push_back({cx, cz});
+                }
+            }
+        }
+        std::sort(missing.begin(), missing.end(), [&](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+            return chunkDistance(a.first, a.second, camChunkX, camChunkZ) <
+                   chunkDistance(b.first, b.second, camChunkX, camChunkZ);
+        });
+        for (auto& [cx, cz] : missing) {
+            pendingLodTiles.insert(chunkKey(cx, cz));
+            queueChunkJob({ChunkJob::Lod, cx, cz});
+        }
+    }
+
+    for (auto it = lodTiles.begin(); it != lodTiles.end();) {
+        LodTile& tile = it->second;
+        int distance = chunkDistance(tile.cx, tile.cz, camChunkX, camChunkZ);
+        const Chunk* chunk = findChunk(tile.cx, tile.cz);
+        tile.covered = chunk && chunkMeshReady(*chunk, cameraPos);
+        if (distance > viewDistance || (distance <= RENDER_DISTANCE && tile.covered)) {
+            destroyLodTileMesh(tile);
+            it = lodTiles.erase(it);
+            continue;
+        }
+        // One chunk of slack before switching steps so a camera sitting on
+        // a ring boundary does not flip the tile back and forth
+        int step = lodStep(distance);
+        bool nearBoundary = tile.step == lodStep(distance - 1) || tile.step == lodStep(distance + 1);
+        tile.targetStep = (tile.step && nearBoundary) ? tile.step : step;
+        ++it;
+    }
+}
+
+// Tiles whose step changed, nearest first, at most LOD_MESHES_PER_FRAME
+std::vector<LodTile*> staleLodTiles(const Vec3& cameraPos) {
+    int camChunkX = (int)std::floor(cameraPos.x / CHUNK_SIZE);
+    int camChunkZ = (int)std::floor(cameraPos.z / CHUNK_SIZE);
+    std::vector<LodTile*> stale;
+    for (auto& [key, tile] : lodTiles) {
+        if (tile.step != tile.targetStep && !tile.covered) stale.push_back(&tile);
+    }
+    std::sort(stale.begin(), stale.end(), [&](const LodTile* a, const LodTile* b) {
+        return chunkDistance(a->cx, a->cz, camChunkX, camChunkZ) < chunkDistance(b->cx, b->cz, camChunkX, camChunkZ);
+    });
+    if ((int)stale.size() > LOD_MESHES_PER_FRAME) stale.resize(LOD_MESHES_PER_FRAME);
+    return stale;
+}
+
+void uploadLodTiles(const Vec3& cameraPos) {
+    for (LodTile* tile : staleLodTiles(cameraPos)) uploadLodTileMesh(*tile, buildLodMesh(*tile, tile->targetStep));
+}
+
+void destroyLodTiles() {
+    for (auto& [key, tile] : lodTiles) destroyLodTileMesh(tile);
+    lodTiles.clear();
+    pendingLodTiles.clear();
+    lodScanX = lodScanZ = INT32_MIN;
+}
+
+// --------------------
+// Instanced dynamic blocks
+// --------------------
+// Instance layout: offset(3) rotation(3) color(3) highlight(1)
+const int INSTANCE_FLOATS = 10;
+
+std::vector<float> buildChunkInstances(const Chunk& chunk, uint32_t highlightKey) {
+    std::vector<float> instances;
+    instances.reserve(chunk.rotations.size() * INSTANCE_FLOATS);
+    int originX = (int)chunk.pos.x * CHUNK_SIZE, originZ = (int)chunk.pos.z * CHUNK_SIZE;
+    for (auto& [key, rot] : chunk.rotations) {
+        int lx = key & 0x0F, lz = (key >> 4) & 0x0F, y = (int)(key >> 8) - (1 << 23);
+        BlockId id = chunkBlockAt(chunk, lx, y, lz);
+        if (!(id & DYNAMIC_BLOCK)) continue;
+        // Shaded by the light of its own cell, as it lets light through
+        Vec3 color = paletteColor(chunk, id);
+        if (chunk.light.lit && !blockEmission(chunk, id)) color = color * lightBrightness(lightOf(chunkLightAt(chunk, lx, y, lz)));
+        float v[INSTANCE_FLOATS] = {
+            (float)(originX + lx), (float)y, (float)(originZ + lz),
+            rot.x, rot.y, rot.z,
+            color.x, color.y, color.z,
+            key == highlightKey ? 1.0f : 0.0f
+        };
+        instances.insert(instances.end(), v, v + INSTANCE_FLOATS);
+    }
+    return instances;
+}
+
+void uploadChunkInstances(Chunk& chunk, GLuint cubeVBO, uint32_t highlightKey) {
+    std::vector<float> instances = buildChunkInstances(chunk, highlightKey);
+    if (!chunk.instanceVAO) {
+        glGenVertexArrays(1, &chunk.instanceVAO);
+        glGenBuffers(1, &chunk.instanceVBO);
+        glBindVertexArray(chunk.instanceVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+        glVertexAttribPointer(0,3,GL_FLOAT,GL_FALSE,6*sizeof(float),(void*)0); glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,6*sizeof(float),(void*)(3*sizeof(float))); glEnableVertexAttribArray(1);
+        glBindBuffer(GL_ARRAY_BUFFER, chunk.instanceVBO);
+        GLsizei stride = INSTANCE_FLOATS * sizeof(float);
+        glVertexAttribPointer(3,3,GL_FLOAT,GL_FALSE,stride,(void*)0);
+        glVertexAttribPointer(4,3,GL_FLOAT,GL_FALSE,stride,(void*)(3*sizeof(float)));
+        glVertexAttribPointer(2,3,GL_FLOAT,GL_FALSE,stride,(void*)(6*sizeof(float)));
+        glVertexAttribPointer(5,1,GL_FLOAT,GL_FALSE,stride,(void*)(9*sizeof(float)));
+        for (GLuint attrib = 2; attrib <= 5; attrib++) {
+            glEnableVertexAttribArray(attrib);
+            glVertexAttribDivisor(attrib, 1);
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, chunk.instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(float), instances.data(), GL_DYNAMIC_DRAW);
+    chunk.instanceCount = instances.size() / INSTANCE_FLOATS;
+    chunk.instancesDirty = false;
+    chunk.highlightedInstance = highlightKey;
+}
+
+// highlightX/Y/Z is the targeted block if it is dynamic (hasHighlight false
+// otherwise); only the chunks whose flag changes are re-uploaded
+void updateChunkInstances(GLuint cubeVBO, bool hasHighlight, int highlightX, int highlightY, int highlightZ) {
+    int64_t highlightChunk = chunkKey(floorDiv(highlightX, CHUNK_SIZE), floorDiv(highlightZ, CHUNK_SIZE));
+    for (auto& [key, chunk] : loadedChunks) {
+        uint32_t highlightKey = NO_INSTANCE;
+        if (hasHighlight && key == highlightChunk) {
+            highlightKey = localKey(highlightX - (int)chunk.pos.x * CHUNK_SIZE, highlightY,
+                                    highlightZ - (int)chunk.pos.z * CHUNK_SIZE);
+        }
+        if (chunk.instancesDirty || chunk.highlightedInstance != highlightKey) {
+            uploadChunkInstances(chunk, cubeVBO, highlightKey);
+        }
+    }
+}
+
+// --------------------
+// Chunk culling
+// --------------------
+struct CullStats {
+    int drawn = 0;
+    int frustumCulled = 0;
+    int distanceCulled = 0;
+    int occlusionCulled = 0;
+    int sectionsReached = 0;  // by the walk from the camera's section
+};
+
+CullStats cullStats;
+bool occlusionCulling = true;  // O key
+
+// Sections the camera can see into, found by a walk from the camera's
+// section to neighbouring sections through faces its empty cells link (see
+// sectionFaceLinks). The walk never steps back in a direction opposite to
+// one it already took, so it cannot wrap around an occluder and come back
+// towards the camera. Covers loaded chunks within UNLOAD_DISTANCE and
+// sections within SECTION_RENDER_DISTANCE; anything outside that counts
+// as reached.
+struct SectionReach {
+    bool enabled = false;
+    int originX = 0, originY = 0, originZ = 0;  // chunk x, section y, chunk z of cell 0
+    int sizeX = 0, sizeY = 0, sizeZ = 0;
+    std::vector<uint64_t> links;   // per cell, 0 where the chunk is not loaded
+    std::vector<uint8_t> loaded;
+    std::vector<uint8_t> entered;  // faces the walk entered through, bit per face
+
+    int cell(int cx, int sy, int cz) const {
+        int x = cx - originX, y = sy - originY, z = cz - originZ;
+        if (x < 0 || y < 0 || z < 0 || x >= sizeX || y >= sizeY || z >= sizeZ) return -1;
+        return (y * sizeZ + z) * sizeX + x;
+    }
+
+    bool reached(int cx, int sy, int cz) const {
+        int i = cell(cx, sy, cz);
+        return !enabled || i < 0 || entered[i];
+    }
+};
+
+SectionReach sectionReach;
+
+void findReachableSections(const Vec3& cameraPos, SectionReach& reach) {
+    int camX = floorDiv(blockCoord(cameraPos.x), CHUNK_SIZE);
+    int camY = sectionIndex(blockCoord(cameraPos.y));
+    int camZ = floorDiv(blockCoord(cameraPos.z), CHUNK_SIZE);
+    reach.enabled = occlusionCulling && findChunk(camX, camZ);
+    if (!reach.enabled) return;
+    reach.originX = camX - UNLOAD_DISTANCE;
+    reach.originY = camY - SECTION_RENDER_DISTANCE;
+    reach.originZ = camZ - UNLOAD_DISTANCE;
+    reach.sizeX = reach.sizeZ = 2 * UNLOAD_DISTANCE + 1;
+    reach.sizeY = 2 * SECTION_RENDER_DISTANCE + 1;
+    size_t cells = (size_t)reach.sizeX * reach.sizeY * reach.sizeZ;
+    reach.links.assign(cells, 0);
+    reach.loaded.assign(cells, 0);
+    reach.entered.assign(cells, 0);
+    for (auto& [key, chunk] : loadedChunks) {
+        int cx = chunk.pos.x, cz = chunk.pos.z;
+        if (reach.cell(cx, reach.originY, cz) < 0) continue;
+        for (int sy = reach.originY; sy < reach.originY + reach.sizeY; sy++) {
+            int i = reach.cell(cx, sy, cz);
+            const ChunkSection* section = findSection(chunk, sy);
+            // Sections not meshed since their last edit may have opened up
+            bool current = section && !section->meshDirty && !section->meshJob;
+            reach.links[i] = current ? section->faceLinks : ALL_FACES_LINKED;
+            reach.loaded[i] = 1;
+        }
+    }
+
+    static const int step[SECTION_FACES][3] = {{-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1}};
+    struct Visit {
+        int cx, sy, cz;
+        int from;         // face entered through, -1 for the camera's section
+        unsigned taken;   // directions stepped so far, bit per face
+    };
+    std::vector<Visit> queue = {{camX, camY, camZ, -1, 0}};
+    reach.entered[reach.cell(camX, camY, camZ)] = 0xFF;
+    for (size_t head = 0; head < queue.size(); head++) {
+        Visit v = queue[head];
+        uint64_t links = reach.links[reach.cell(v.cx, v.sy, v.cz)];
+        for (int face = 0; face < SECTION_FACES; face++) {
+            if (v.taken >> (face ^ 1) & 1) continue;
+            if (v.from >= 0 && !facesLinked(links, v.from, face)) continue;
+            int nx = v.cx + step[face][0], ny = v.sy + step[face][1], nz = v.cz + step[face][2];
+            int next = reach.cell(nx, ny, nz);
+            if (next < 0 || !reach.loaded[next] || (reach.entered[next] >> (face ^ 1) & 1)) continue;
+            reach.entered[next] |= 1 << (face ^ 1);
+            queue.push_back({nx, ny, nz, face ^ 1, v.taken | 1u << face});
+        }
+    }
+    for (uint8_t faces : reach.entered) cullStats.sectionsReached += faces != 0;
+}
+
+// Frustum planes (a, b, c, d with ax + by + cz + d >= 0 inside) taken from the
+// rows of a column-major view-projection matrix (Gribb/Hartmann)
+void extractFrustumPlanes(const Mat4& viewProj, float planes[6][4]) {
+    auto row = [&](int r, int c) { return viewProj.m[c * 4 + r]; };
+    for (int i = 0; i < 6; i++) {
+        int axis = i / 2;
+        float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+        for (int c = 0; c < 4; c++) planes[i][c] = row(3, c) + sign * row(axis, c);
+        float len = std::sqrt(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+        for (int c = 0; c < 4; c++) planes[i][c] /= len;
+    }
+}
+
+// What survived culling: section meshes, chunks whose dynamic blocks are
+// drawn instanced, and level-of-detail tiles
+struct VisibleSet {
+    std::vector<ChunkSection*> sections;
+    std::vector<Chunk*> instanced;
+    std::vector<LodTile*> lodTiles;
+};
+
+// Lowest and highest occupied layer of a chunk, false if it is empty
+bool chunkHeightRange(const Chunk& chunk, int& minY, int& maxY) {
+    minY = INT32_MAX;
+    maxY = INT32_MIN;
+    for (auto& section : chunk.sections) {
+        if (!section.height) continue;
+        minY = std::min(minY, section.baseY);
+        maxY = std::max(maxY, section.baseY + section.height - 1);
+    }
+    return minY <= maxY;
+}
+
+// Collects the section meshes, instanced chunks and tiles whose bounds
+// intersect the view frustum and lie within farPlane() of the camera, leaving
+// out sections the camera cannot see into (findReachableSections). Bounds are
+// gathered into flat arrays first so each plane test runs as one tight loop
+// over all boxes.
+void cullChunks(const Mat4& viewProj, const Vec3& cameraPos, VisibleSet& visible) {
+    visible.sections.clear();
+    visible.instanced.clear();
+    visible.lodTiles.clear();
+    cullStats = CullStats();
+    findReachableSections(cameraPos, sectionReach);
+    float farDistance = farPlane();
+    // Each box belongs to a section mesh, a chunk's instances or a tile
+    std::vector<ChunkSection*> boxSections;
+    std::vector<Chunk*> boxChunks;
+    std::vector<LodTile*> boxTiles;
+    std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+    auto addBox = [&](ChunkSection* section, Chunk* chunk, LodTile* tile,
+                      float x0, float y0, float z0, float x1, float y1, float z1) {
+        // Distance from the camera to the nearest point of the box
+        float dx = std::max({x0 - cameraPos.x, 0.0f, cameraPos.x - x1});
+        float dy = std::max({y0 - cameraPos.y, 0.0f, cameraPos.y - y1});
+        float dz = std::max({z0 - cameraPos.z, 0.0f, cameraPos.z - z1});
+        if (dx * dx + dy * dy + dz * dz > farDistance * farDistance) {
+            cullStats.distanceCulled++;
+            return;
+        }
+        boxSections.push_back(section);
+        boxChunks.push_back(chunk);
+        boxTiles.push_back(tile);
+        minX.push_back(x0); minY.push_back(y0); minZ.push_back(z0);
+        maxX.push_back(x1); maxY.push_back(y1); maxZ.push_back(z1);
+    };
+    for (auto& [key, chunk] : loadedChunks) {
+        float x0 = chunk.pos.x * CHUNK_SIZE - 0.5f, z0 = chunk.pos.z * CHUNK_SIZE - 0.5f;
+        float x1 = x0 + CHUNK_SIZE, z1 = z0 + CHUNK_SIZE;
+        int cx = chunk.pos.x, cz = chunk.pos.z;
+        for (size_t i = 0; i < chunk.sections.size(); i++) {
+            ChunkSection& section = chunk.sections[i];
+            if (!section.mesh.vertexCount) continue;
+            if (!sectionReach.reached(cx, chunk.baseSection + (int)i, cz)) {
+                cullStats.occlusionCulled++;
+                continue;
+            }
+            float y0 = section.baseY - 0.5f;
+            addBox(&section, nullptr, nullptr, x0, y0, z0, x1, y0 + section.height, z1);
+        }
+        int lowY, highY;
+        if (chunk.instanceCount && chunkHeightRange(chunk, lowY, highY)) {
+            bool reached = false;
+            for (int sy = sectionIndex(lowY); sy <= sectionIndex(highY) && !reached; sy++) {
+                reached = sectionReach.reached(cx, sy, cz);
+            }
+            if (reached) addBox(nullptr, &chunk, nullptr, x0, lowY - 0.5f, z0, x1, highY + 0.5f, z1);
+            else cullStats.occlusionCulled++;
+        }
+    }
+    for (auto& [key, tile] : lodTiles) {
+        if (tile.covered || !tile.mesh.vertexCount) continue;
+        float x0 = tile.cx * CHUNK_SIZE - 0.5f, z0 = tile.cz * CHUNK_SIZE - 0.5f;
+        addBox(nullptr, nullptr, &tile, x0, tile.minY - 0.5f, z0, x0 + CHUNK_SIZE, tile.maxY + 0.5f, z0 + CHUNK_SIZE);
+    }
+
+    float planes[6][4];
+    extractFrustumPlanes(viewProj, planes);
+    size_t n = boxSections.size();
+    std::vector<uint8_t> inside(n, 1);
+    for (auto& pl : planes) {
+        // Test the box corner furthest along the plane normal
+        const float* px = pl[0] >= 0 ? maxX.data() : minX.data();
+        const float* py = pl[1] >= 0 ? maxY.data() : minY.data();
+        const float* pz = pl[2] >= 0 ? maxZ.data() : minZ.data();
+        for (size_t i = 0; i < n; i++) {
+            inside[i] &= (pl[0] * px[i] + pl[1] * py[i] + pl[2] * pz[i] + pl[3] >= 0);
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (!inside[i]) cullStats.frustumCulled++;
+        else if (boxSections[i]) visible.sections.push_back(boxSections[i]);
+        else if (boxChunks[i]) visible.instanced.push_back(boxChunks[i]);
+        else visible.lodTiles.push_back(boxTiles[i]);
+    }
+    cullStats.drawn = visible.sections.size() + visible.instanced.size() + visible.lodTiles.size();
+}
+
+// All visible section and tile meshes in one call
+void drawArenaMeshes(const VisibleSet& visible) {
+    static std::vector<GLint> firsts;
+    static std::vector<GLsizei> counts;
+    firsts.clear();
+    counts.clear();
+    for (const ChunkSection* section : visible.sections) {
+        firsts.push_back(section->mesh.first);
+        counts.push_back(section->mesh.vertexCount);
+    }
+    for (const LodTile* tile : visible.lodTiles) {
+        firsts.push_back(tile->mesh.first);
+        counts.push_back(tile->mesh.vertexCount);
+    }
+    if (firsts.empty()) return;
+    glBindVertexArray(meshArena.vao);
+    glMultiDrawArrays(GL_TRIANGLES, firsts.data(), counts.data(), (GLsizei)firsts.size());
+}
+
+struct RayHit {
+    Cube cube;
+    int x = 0, y = 0, z = 0;  // block that was hit
+    Vec3 normal;              // face the ray entered through
+    float distance = 0;
+};
+
+// Amanatides-Woo voxel traversal: visits the cells along the ray in order and
+// stops at the first occupied one, so the cost depends on ray length only.
+bool raycastBlocks(const Vec3& rayOrigin, const Vec3& rayDir, float maxDistance, RayHit& hit) {
+    // Shift by half a block so cell i spans [i, i+1)
+    float origin[3] = {rayOrigin.x + 0.5f, rayOrigin.y + 0.5f, rayOrigin.z + 0.5f};
+    float dir[3] = {rayDir.x, rayDir.y, rayDir.z};
+    int cell[3], step[3];
+    float tMax[3], tDelta[3];
+    for (int i = 0; i < 3; i++) {
+        cell[i] = (int)std::floor(origin[i]);
+        if (dir[i] > 0) {
+            step[i] = 1;
+            tDelta[i] = 1.0f / dir[i];
+            tMax[i] = (cell[i] + 1 - origin[i]) * tDelta[i];
+        } else if (dir[i] < 0) {
+            step[i] = -1;
+            tDelta[i] = -1.0f / dir[i];
+            tMax[i] = (origin[i] - cell[i]) * tDelta[i];
+        } else {
+            step[i] = 0;
+            tDelta[i] = tMax[i] = INFINITY;
+        }
+    }
+
+    // Starting inside a block: report it with no entry face
+    if (getBlock(cell[0], cell[1], cell[2], hit.cube)) {
+        hit.x = cell[0]; hit.y = cell[1]; hit.z = cell[2];
+        hit.normal = Vec3(0,0,0);
+        hit.distance = 0;
+        return true;
+    }
+
+    while (true) {
+        int axis = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+        float t = tMax[axis];
+        if (t > maxDistance) return false;
+        cell[axis] += step[axis];
+        tMax[axis] += tDelta[axis];
+        if (blockAt(cell[0], cell[1], cell[2])) {
+            float n[3] = {0,0,0};
+            n[axis] = (float)-step[axis];
+            getBlock(cell[0], cell[1], cell[2], hit.cube);
+            hit.x = cell[0]; hit.y = cell[1]; hit.z = cell[2];
+            hit.normal = Vec3(n[0], n[1], n[2]);
+            hit.distance = t;
+            return true;
+        }
+    }
+}
+
+Vec3 calculatePlacementPosition(const RayHit& hit) {
+    return Vec3(hit.x + hit.normal.x, hit.y + hit.normal.y, hit.z + hit.normal.z);
+}
+
+bool isPositionOccupied(const Vec3& pos) {
+    return blockAt(blockCoord(pos.x), blockCoord(pos.y), blockCoord(pos.z)) != 0;
+}
+
+// Places a cube against the face that was hit. Player-placed cubes are
+// dynamic, so only the instance buffer needs refreshing.
+bool placeBlockAtHit(const RayHit& hit, const Vec3& color) {
+    Vec3 placePos = calculatePlacementPosition(hit);
+    if (isPositionOccupied(placePos)) return false;
+    int x = blockCoord(placePos.x), y = blockCoord(placePos.y), z = blockCoord(placePos.z);
+    int lighting = blockLighting(x, y, z);
+    if (!setBlock(x, y, z, color, true)) return false;
+    relightBlock(x, y, z, lighting);
+    journalPlace(x, y, z, color, true);
+    sendServerEdit(true, x, y, z, packColor(color.x, color.y, color.z), true);
+    markBlockInstancesDirty(x, z);
+    return true;
+}
+
+bool breakBlockAtHit(const RayHit& hit) {
+    int lighting = blockLighting(hit.x, hit.y, hit.z);
+    if (!removeBlock(hit.x, hit.y, hit.z)) return false;
+    relightBlock(hit.x, hit.y, hit.z, lighting);
+    journalBreak(hit.x, hit.y, hit.z);
+    sendServerEdit(false, hit.x, hit.y, hit.z, 0, false);
+    if (hit.cube.do_rotate) markBlockInstancesDirty(hit.x, hit.z);
+    else markBlockMeshDirty(hit.x, hit.y, hit.z);
+    return true;
+}
+
+// Selection and volume keys: Z and X mark the corners at the targeted
+// block, G fills the box with `color`, H builds a hollow shell of it, K
+// clears it, R turns blocks of the targeted block's color into `color`, C
+// copies it, V pastes at the placement position and T turns the clipboard
+void bulkEditKey(int key, bool hasTarget, const RayHit& hit, const Vec3& color) {
+    if ((key == 'Z' || key == 'X') && hasTarget) {
+        int* corner = key == 'Z' ? selection.a : selection.b;
+        corner[0] = hit.x; corner[1] = hit.y; corner[2] = hit.z;
+        (key == 'Z' ? selection.hasA : selection.hasB) = true;
+        std::cout << "Selection corner " << (char)key << " at " << hit.x << ", " << hit.y << ", " << hit.z << std::endl;
+        return;
+    }
+    if (key == 'T') {
+        rotateClipboard(clipboard);
+        return;
+    }
+    // The server only takes single-block edits. Copying is fine: it only
+    // reads chunks already here and brings in none.
+    if (worldClient.active && key != 'C') {
+        std::cout << "Volume edits are not available on a world server" << std::endl;
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    int changed = 0;
+    if (key == 'V') {
+        if (!hasTarget) return;
+        Vec3 at = calculatePlacementPosition(hit);
+        changed = pasteClipboard(clipboard, blockCoord(at.x), blockCoord(at.y), blockCoord(at.z));
+    } else {
+        if (!selection.hasA || !selection.hasB) return;
+        BlockBox box = makeBlockBox(selection.a[0], selection.a[1], selection.a[2],
+                                    selection.b[0], selection.b[1], selection.b[2]);
+        JournalEdit edit;
+        edit.x = box.x0; edit.y = box.y0; edit.z = box.z0;
+        edit.x1 = box.x1; edit.y1 = box.y1; edit.z1 = box.z1;
+        edit.color = packColor(color.x, color.y, color.z);
+        if (key == 'G') edit.op = JournalEdit::Fill;
+        else if (key == 'H') edit.op = JournalEdit::Hollow;
+        else if (key == 'K') edit.op = JournalEdit::Clear;
+        else if (key == 'R' && hasTarget) {
+            edit.op = JournalEdit::Replace;
+            edit.color1 = edit.color;
+            edit.color = packColor(hit.cube.color.x, hit.cube.color.y, hit.cube.color.z);
+        } else if (key == 'C') {
+            copyBox(box, clipboard);
+            changed = (int)clipboard.cells.size();
+        } else {
+            return;
+        }
+        if (key != 'C') changed = bulkEdit(edit);
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << (key == 'C' ? "Copied " : "Changed ") << changed << " blocks in " << ms << " ms" << std::endl;
+}
+
+// Function to create a quad for UI elements
+void createQuad(float x, float y, float width, float height, float* vertices) {
+    // Triangle 1
+    vertices[0] = x;           vertices[1] = y;            vertices[2] = 0.0f; vertices[3] = 0.0f;
+    vertices[4] = x + width;   vertices[5] = y;            vertices[6] = 1.0f; vertices[7] = 0.0f;
+    vertices[8] = x + width;   vertices[9] = y + height;   vertices[10] = 1.0f; vertices[11] = 1.0f;
+    // Triangle 2
+    vertices[12] = x;          vertices[13] = y;           vertices[14] = 0.0f; vertices[15] = 0.0f;
+    vertices[16] = x + width;  vertices[17] = y + height;  vertices[18] = 1.0f; vertices[19] = 1.0f;
+    vertices[20] = x;          vertices[21] = y + height;  vertices[22] = 0.0f; vertices[23] = 1.0f;
+}
 
 // --------------------
-// Cube data
+// Input
 // --------------------
-float cubeVertices[] = {
-    -0.5f,-0.5f,0.5f, 1,0,0,  0.5f,-0.5f,0.5f, 0,1,0,  0.5f,0.5f,0.5f, 0,0,1,
-     0.5f,0.5f,0.5f, 1,0,0, -0.5f,0.5f,0.5f, 0,1,0, -0.5f,-0.5f,0.5f, 0,0,1,
-    -0.5f,-0.5f,-0.5f, 1,0,0,  0.5f,0.5f,-0.5f, 0,1,0,  0.5f,-0.5f,-0.5f, 0,0,1,
-     0.5f,0.5f,-0.5f, 1,0,0, -0.5f,-0.5f,-0.5f, 0,1,0, -0.5f,0.5f,-0.5f, 0,0,1,
-    -0.5f,-0.5f,-0.5f, 1,0,0, -0.5f,0.5f,0.5f, 0,1,0, -0.5f,0.5f,-0.5f, 0,0,1,
-    -0.5f,-0.5f,-0.5f, 1,0,0, -0.5f,-0.5f,0.5f, 0,1,0, -0.5f,0.5f,0.5f, 0,0,1,
-     0.5f,-0.5f,-0.5f, 1,0,0,  0.5f,0.5f,-0.5f, 0,1,0,  0.5f,0.5f,0.5f, 0,0,1,
-     0.5f,-0.5f,-0.5f, 1,0,0,  0.5f,0.5f,0.5f, 0,1,0,  0.5f,-0.5f,0.5f, 0,0,1,
-    -0.5f,0.5f,-0.5f, 1,0,0,  0.5f,0.5f,0.5f, 0,1,0,  0.5f,0.5f,-0.5f, 0,0,1,
-    -0.5f,0.5f,-0.5f, 1,0,0, -0.5f,0.5f,0.5f, 0,1,0,  0.5f,0.5f,0.5f, 0,0,1,
-    -0.5f,-0.5f,-0.5f, 1,0,0,  0.5f,-0.5f,-0.5f, 0,1,0,  0.5f,-0.5f,0.5f, 0,0,1,
-    -0.5f,-0.5f,-0.5f, 1,0,0,  0.5f,-0.5f,0.5f, 0,1,0, -0.5f,-0.5f,0.5f, 0,0,1
+// Every key and mouse button the game reacts to. A key's position here is
+// its bit in an input recording, so new keys go at the end.
+const int INPUT_KEYS[] = {
+    GLFW_KEY_W, GLFW_KEY_A, GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_SPACE, GLFW_KEY_LEFT_SHIFT, GLFW_KEY_LEFT_CONTROL,
+    GLFW_KEY_ESCAPE, 'F', 'O', GLFW_KEY_F3, GLFW_KEY_F4, GLFW_KEY_LEFT_BRACKET, GLFW_KEY_RIGHT_BRACKET,
+    '1', '2', '3', '4', '5', '6', '7', '8', '9', 'Z', 'X', 'G', 'H', 'K', 'R', 'C', 'V', 'T'
 };
+const int INPUT_KEY_COUNT = sizeof(INPUT_KEYS) / sizeof(INPUT_KEYS[0]);
+const int INPUT_BUTTONS[] = {GLFW_MOUSE_BUTTON_LEFT, GLFW_MOUSE_BUTTON_RIGHT};  // bits after the keys
+const int INPUT_BUTTON_COUNT = sizeof(INPUT_BUTTONS) / sizeof(INPUT_BUTTONS[0]);
+static_assert(INPUT_KEY_COUNT + INPUT_BUTTON_COUNT <= 64, "input state is one 64-bit mask");
 
-float crosshairVertices[] = {
-    -0.02f,  0.0f,
-     0.02f,  0.0f,
-     0.0f, -0.02f,
-     0.0f,  0.02f
+// Keys and buttons held this frame and the last, read from the window or
+// from a recording
+struct InputState {
+    uint64_t held = 0, previous = 0;
+
+    static uint64_t keyBit(int key) {
+        for (int i = 0; i < INPUT_KEY_COUNT; i++) {
+            if (INPUT_KEYS[i] == key) return 1ull << i;
+        }
+        return 0;
+    }
+    static uint64_t buttonBit(int button) {
+        for (int i = 0; i < INPUT_BUTTON_COUNT; i++) {
+            if (INPUT_BUTTONS[i] == button) return 1ull << (INPUT_KEY_COUNT + i);
+        }
+        return 0;
+    }
+    bool down(int key) const { return held & keyBit(key); }
+    bool pressed(int key) const { return held & ~previous & keyBit(key); }
+    bool buttonPressed(int button) const { return held & ~previous & buttonBit(button); }
+    void advance(uint64_t now) {
+        previous = held;
+        held = now;
+    }
 };
 
+InputState frameInput;
+
+uint64_t windowInput() {
+    uint64_t held = 0;
+    for (int i = 0; i < INPUT_KEY_COUNT; i++) {
+        if (keyboard.curr_keys[INPUT_KEYS[i]]) held |= 1ull << i;
+    }
+    for (int i = 0; i < INPUT_BUTTON_COUNT; i++) {
+        if (mouse.curr_buttons[INPUT_BUTTONS[i]]) held |= 1ull << (INPUT_KEY_COUNT + i);
+    }
+    return held;
+}
+
+// Hotbar, movement and view keys for one frame
+void applyControlInput(const InputState& input, float dt) {
+    for (int i = 0; i < HOTBAR_SLOTS; i++) {
+        if (input.pressed(GLFW_KEY_1 + i)) selectedHotbarSlot = i;
+    }
+
+    float speed = 5.0f * dt;
+    if (input.down(GLFW_KEY_LEFT_CONTROL)) speed *= 2;
+    Vec3 right = camera.front().cross(Vec3(0,1,0)).normalize();
+    Vec3 forwardDir = camera.front();
+    forwardDir.y = 0;
+    forwardDir = forwardDir.normalize();
+    Vec3 rightDir = right;
+    rightDir.y = 0;
+    rightDir = rightDir.normalize();
+
+    if (input.down(GLFW_KEY_W)) camera.pos = camera.pos + forwardDir * speed;
+    if (input.down(GLFW_KEY_S)) camera.pos = camera.pos - forwardDir * speed;
+    if (input.down(GLFW_KEY_A)) camera.pos = camera.pos - rightDir * speed;
+    if (input.down(GLFW_KEY_D)) camera.pos = camera.pos + rightDir * speed;
+    if (input.down(GLFW_KEY_SPACE)) camera.pos.y += speed;
+    if (input.down(GLFW_KEY_LEFT_SHIFT)) camera.pos.y -= speed;
+    if (input.pressed('F')) wireframeMode = !wireframeMode;
+    if (input.pressed('O')) occlusionCulling = !occlusionCulling;
+    if (input.pressed(GLFW_KEY_LEFT_BRACKET)) viewDistance = std::max(RENDER_DISTANCE, viewDistance - 1);
+    if (input.pressed(GLFW_KEY_RIGHT_BRACKET)) viewDistance = std::min(MAX_VIEW_DISTANCE, viewDistance + 1);
+}
+
+// Place (left button), break (right button) and volume keys at the
+// targeted block. Returns false if the target was broken.
+bool applyEditInput(const InputState& input, bool hasTarget, const RayHit& hit) {
+    bool targetKept = true;
+    if (input.buttonPressed(GLFW_MOUSE_BUTTON_LEFT) && hasTarget) placeBlockAtHit(hit, hotbarColors[selectedHotbarSlot]);
+    if (input.buttonPressed(GLFW_MOUSE_BUTTON_RIGHT) && hasTarget && breakBlockAtHit(hit)) targetKept = false;
+    for (int key : {'Z', 'X', 'G', 'H', 'K', 'R', 'C', 'V', 'T'}) {
+        if (input.pressed(key)) bulkEditKey(key, hasTarget, hit, hotbarColors[selectedHotbarSlot]);
+    }
+    return targetKept;
+}
+
 // --------------------
-// Globals
+// Profiler overlay
 // --------------------
-Camera3d camera;
-Keyboard keyboard;
-Mouse mouse;
-float deltaTime=0,lastFrame=0;
-bool wireframeMode = false;
-int selectedHotbarSlot = 0;
+// Main loop stages, timed with ProfileZones every frame (F3 shows them as
+// stacked bars, F4 dumps the recorded zones as a Chrome trace)
+enum FrameStage { STAGE_INPUT, STAGE_PICKING, STAGE_STREAMING, STAGE_EDITS, STAGE_MESHING,
+                  STAGE_SCENE, STAGE_PRESENT, STAGE_HOTBAR, FRAME_STAGE_COUNT };
+const char* frameStageNames[FRAME_STAGE_COUNT] = {
+    "input", "picking", "chunk_streaming", "edits", "meshing", "scene", "present", "hotbar"
+};
+Vec3 frameStageColors[FRAME_STAGE_COUNT] = {
+    Vec3(0.6f, 0.6f, 0.6f), Vec3(0.9f, 0.9f, 0.2f), Vec3(0.2f, 0.8f, 0.8f), Vec3(0.9f, 0.5f, 0.2f),
+    Vec3(0.6f, 0.2f, 0.8f), Vec3(0.2f, 0.8f, 0.2f), Vec3(0.2f, 0.2f, 0.8f), Vec3(0.8f, 0.2f, 0.2f)
+};
 
-// Hotbar colors
-Vec3 hotbarColors[HOTBAR_SLOTS] = {
-    Vec3(0.8f, 0.2f, 0.2f),  // Red
-    Vec3(0.2f, 0.8f, 0.2f),  // Green
-    Vec3(0.2f, 0.2f, 0.8f),  // Blue
-    Vec3(0.9f, 0.9f, 0.2f),  // Yellow
-    Vec3(0.9f, 0.5f, 0.2f),  // Orange
-    Vec3(0.6f, 0.2f, 0.8f),  // Purple
-    Vec3(0.2f, 0.8f, 0.8f),  // Cyan
-    Vec3(0.9f, 0.9f, 0.9f),  // White
-    Vec3(0.5f, 0.35f, 0.2f)  // Brown
+// Render passes timed on the GPU with GL_TIME_ELAPSED queries
+enum GpuPass { GPU_SCENE, GPU_PRESENT, GPU_HOTBAR, GPU_PASS_COUNT };
+const char* gpuPassNames[GPU_PASS_COUNT] = {"gpu_scene", "gpu_present", "gpu_hotbar"};
+const FrameStage gpuPassStages[GPU_PASS_COUNT] = {STAGE_SCENE, STAGE_PRESENT, STAGE_HOTBAR};
+// Query results are read this many frames later so reading them never stalls
+const int GPU_TIMER_FRAMES = 3;
+
+struct FrameProfiler {
+    float cpuMs[FRAME_STAGE_COUNT] = {};  // smoothed over recent frames
+    float gpuMs[GPU_PASS_COUNT] = {};
+    bool overlay = false;
+
+    GLuint queries[GPU_TIMER_FRAMES][GPU_PASS_COUNT] = {};
+    int64_t submitNs[GPU_TIMER_FRAMES][GPU_PASS_COUNT] = {};
+    bool issued[GPU_TIMER_FRAMES][GPU_PASS_COUNT] = {};
+    int frame = 0;
+    ProfileThread* gpuTrace = nullptr;
 };
 
+const float PROFILE_SMOOTHING = 0.1f;
+
+void initFrameProfiler(FrameProfiler& profiler) {
+    glGenQueries(GPU_TIMER_FRAMES * GPU_PASS_COUNT, &profiler.queries[0][0]);
+    profiler.gpuTrace = profileNamedThread("GPU");
+}
+
+void destroyFrameProfiler(FrameProfiler& profiler) {
+    glDeleteQueries(GPU_TIMER_FRAMES * GPU_PASS_COUNT, &profiler.queries[0][0]);
+}
+
+// Collects the GPU timings of the frame that last used this frame's query set
+void beginProfiledFrame(FrameProfiler& profiler) {
+    int set = profiler.frame % GPU_TIMER_FRAMES;
+    for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+        if (!profiler.issued[set][pass]) continue;
+        profiler.issued[set][pass] = false;
+        GLuint available = 0;
+        glGetQueryObjectuiv(profiler.queries[set][pass], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(profiler.queries[set][pass], GL_QUERY_RESULT, &elapsedNs);
+        // The trace places GPU work at the time it was submitted
+        int64_t start = profiler.submitNs[set][pass];
+        profileRecord(*profiler.gpuTrace, gpuPassNames[pass], start, start + (int64_t)elapsedNs);
+        profiler.gpuMs[pass] += (elapsedNs / 1e6f - profiler.gpuMs[pass]) * PROFILE_SMOOTHING;
+    }
+}
+
+void beginGpuPass(FrameProfiler& profiler, GpuPass pass) {
+    int set = profiler.frame % GPU_TIMER_FRAMES;
+    glBeginQuery(GL_TIME_ELAPSED, profiler.queries[set][pass]);
+    profiler.submitNs[set][pass] = profileNow();
+    profiler.issued[set][pass] = true;
+}
+
+void endGpuPass() {
+    glEndQuery(GL_TIME_ELAPSED);
+}
+
+void endProfiledFrame(FrameProfiler& profiler, const double stageMs[FRAME_STAGE_COUNT]) {
+    for (int i = 0; i < FRAME_STAGE_COUNT; i++) {
+        profiler.cpuMs[i] += ((float)stageMs[i] - profiler.cpuMs[i]) * PROFILE_SMOOTHING;
+    }
+    profiler.frame++;
+}
+
+void drawOverlayQuad(GLuint uiShaderProgram, GLuint uiVBO, float x, float y, float width, float height, const Vec3& color) {
+    float quadVerts[24];
+    createQuad(x, y, width, height, quadVerts);
+    glBindBuffer(GL_ARRAY_BUFFER, uiVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(quadVerts), quadVerts);
+    glUniform3f(glGetUniformLocation(uiShaderProgram, "uColor"), color.x, color.y, color.z);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+// Two stacked bars in the top left corner, CPU stages above GPU passes, each
+// segment in its stage's color. The white marker is the 60 fps budget.
+// Expects the UI program and VAO to be bound.
+void drawProfilerOverlay(const FrameProfiler& profiler, GLuint uiShaderProgram, GLuint uiVBO, int screenHeight) {
+    const float pixelsPerMs = 24.0f;
+    const float budgetMs = 1000.0f / 60.0f;
+    const float barHeight = 14.0f, left = 20.0f;
+    float cpuY = screenHeight - 40.0f, gpuY = cpuY - barHeight - 6.0f;
+
+    glUniform1i(glGetUniformLocation(uiShaderProgram, "uIsBorder"), 0);
+    glUniform1i(glGetUniformLocation(uiShaderProgram, "uIsSelected"), 1);
+    drawOverlayQuad(uiShaderProgram, uiVBO, left - 4, gpuY - 4, budgetMs * 2 * pixelsPerMs + 8,
+                    cpuY - gpuY + barHeight + 8, Vec3(0.05f, 0.05f, 0.05f));
+    float x = left;
+    for (int i = 0; i < FRAME_STAGE_COUNT; i++) {
+        float width = profiler.cpuMs[i] * pixelsPerMs;
+        drawOverlayQuad(uiShaderProgram, uiVBO, x, cpuY, width, barHeight, frameStageColors[i]);
+        x += width;
+    }
+    x = left;
+    for (int pass = 0; pass < GPU_PASS_COUNT; pass++) {
+        float width = profiler.gpuMs[pass] * pixelsPerMs;
+        drawOverlayQuad(uiShaderProgram, uiVBO, x, gpuY, width, barHeight, frameStageColors[gpuPassStages[pass]]);
+        x += width;
+    }
+    drawOverlayQuad(uiShaderProgram, uiVBO, left + budgetMs * pixelsPerMs - 1, gpuY - 2, 2,
+                    cpuY - gpuY + barHeight + 4, Vec3(1, 1, 1));
+}
+
 // --------------------
-// Structures
+// Headless benchmark
 // --------------------
-struct Cube {
-    Vec3 pos;
-    Vec3 rot;
-    Vec3 color;
-    bool do_rotate = 0;
+// `--bench [--frames N] [--out file.json]` replays a scripted camera path
+// and edit sequence without opening a window or touching GL, then reports
+// per-stage timings as JSON. Meshes and instance data are built on the CPU
+// but not uploaded, and draw submission stops at the culled draw list.
+const int BENCH_DEFAULT_FRAMES = 1800;
+const float BENCH_DT = 1.0f / 60.0f;
+const int BENCH_EDIT_INTERVAL = 15;
+const uint64_t BENCH_SEED = 1;
+const int BENCH_TERRAIN_CHUNKS = 1024;
+const int BENCH_BULK_SIZE = 100;  // edge of the cube filled, copied and pasted once
+
+enum BenchStage { BENCH_STREAMING, BENCH_PICKING, BENCH_PLACEMENT, BENCH_MESH_BUILD, BENCH_DRAW_SUBMISSION, BENCH_STAGE_COUNT };
+const char* benchStageNames[BENCH_STAGE_COUNT] = {
+    "chunk_streaming", "picking", "placement", "mesh_build", "draw_submission"
 };
 
-struct Chunk {
-    Vec3 pos;
-    std::vector<Cube> cubes;
-    bool dirty = false;
+struct BenchBulkEdit {
+    int blocks = 0;
+    double fillMs = 0, remeshMs = 0, copyMs = 0, pasteMs = 0, clearMs = 0;
+    int sectionsRemeshed = 0;
 };
 
-std::unordered_map<int64_t, Chunk> loadedChunks;
+// Fills a BENCH_BULK_SIZE cube next to the camera, copies it, pastes the
+// copy beside it and clears both, remeshing after the fill
+BenchBulkEdit benchBulkEdit() {
+    BenchBulkEdit result;
+    int size = BENCH_BULK_SIZE;
+    int x = blockCoord(camera.pos.x) + CHUNK_SIZE, y = TERRAIN_BASE_HEIGHT + 40, z = blockCoord(camera.pos.z);
+    JournalEdit edit;
+    edit.op = JournalEdit::Fill;
+    edit.x = x; edit.y = y; edit.z = z;
+    edit.x1 = x + size - 1; edit.y1 = y + size - 1; edit.z1 = z + size - 1;
+    edit.color = packColor(0.8f, 0.3f, 0.2f);
 
-std::string chunkFilename(int cx, int cz) {
-    return "chunks/chunk_" + std::to_string(cx) + "_" + std::to_string(cz) + ".bin";
-}
+    auto t0 = std::chrono::steady_clock::now();
+    result.blocks = bulkEdit(edit);
+    result.fillMs = elapsedMs(t0);
+
+    t0 = std::chrono::steady_clock::now();
+    lightLoadedChunks();
+    for (auto& [key, chunk] : loadedChunks) {
+        for (size_t i = 0; i < chunk.sections.size(); i++) {
+            ChunkSection& section = chunk.sections[i];
+            if (!section.meshDirty) continue;
+            section.mesh.vertexCount = buildSectionMesh(snapshotSection(chunk, chunk.baseSection + (int)i)).size() / MESH_VERTEX_FLOATS;
+            section.meshDirty = false;
+            result.sectionsRemeshed++;
+        }
+    }
+    result.remeshMs = elapsedMs(t0);
+
+    t0 = std::chrono::steady_clock::now();
+    BlockClipboard board;
+    copyBox(makeBlockBox(edit.x, edit.y, edit.z, edit.x1, edit.y1, edit.z1), board);
+    result.copyMs = elapsedMs(t0);
+
+    t0 = std::chrono::steady_clock::now();
+    pasteClipboard(board, x + size, y, z);
+    result.pasteMs = elapsedMs(t0);
 
-int64_t chunkKey(int cx, int cz) {
-    return (int64_t)cx << 32 | (uint32_t)cz;
+    t0 = std::chrono::steady_clock::now();
+    edit.op = JournalEdit::Clear;
+    edit.x1 += size;
+    bulkEdit(edit);
+    result.clearMs = elapsedMs(t0);
+    return result;
 }
 
-float getHighestBlockY(float x, float z) {
-    float highestY = -10000.0f;
-    for(auto& [key, chunk] : loadedChunks){
-        for(auto& c : chunk.cubes){
-            if((int)c.pos.x == (int)std::floor(x) && (int)c.pos.z == (int)std::floor(z)){
-                if(c.pos.y > highestY) highestY = c.pos.y;
+// Builds dirty meshes and instance data on the CPU, keeping only their
+// sizes, in place of rebuildDirtyChunkMeshes and uploadLodTiles
+void buildHeadlessMeshes(int& meshesBuilt, int& lodMeshesBuilt) {
+    lightLoadedChunks();
+    for (auto& [key, chunk] : loadedChunks) {
+        for (size_t i = 0; i < chunk.sections.size(); i++) {
+            ChunkSection& section = chunk.sections[i];
+            int sectionY = chunk.baseSection + (int)i;
+            if (!sectionInRange(sectionY, camera.pos)) {
+                section.mesh.vertexCount = 0;
+                section.meshDirty = true;
+            } else if (section.meshDirty) {
+                SectionSnapshot snapshot = snapshotSection(chunk, sectionY);
+                section.faceLinks = sectionFaceLinks(snapshot);
+                section.mesh.vertexCount = buildSectionMesh(snapshot).size() / MESH_VERTEX_FLOATS;
+                section.meshDirty = false;
+                meshesBuilt++;
             }
         }
+        if (chunk.instancesDirty) {
+            chunk.instanceCount = buildChunkInstances(chunk, NO_INSTANCE).size() / INSTANCE_FLOATS;
+            chunk.instancesDirty = false;
+        }
+    }
+    for (LodTile* tile : staleLodTiles(camera.pos)) {
+        tile->mesh.vertexCount = buildLodMesh(*tile, tile->targetStep).size() / MESH_VERTEX_FLOATS;
+        tile->step = tile->targetStep;
+        lodMeshesBuilt++;
     }
-    return highestY;
 }
 
-void saveChunk(const Chunk& chunk) {
-    fs::create_directories("chunks");
-    std::ofstream ofs(chunkFilename(chunk.pos.x, chunk.pos.z), std::ios::binary);
-    size_t n = chunk.cubes.size();
-    ofs.write((char*)&n, sizeof(size_t));
-    for (auto& c : chunk.cubes) {
-        ofs.write((char*)&c.pos, sizeof(Vec3));
-        ofs.write((char*)&c.color, sizeof(Vec3));
+// Scripted path: a slow circle around the origin, looking ahead and down at
+// the ground so every frame has something to pick
+void benchCameraAt(int frame) {
+    float t = frame * BENCH_DT;
+    float angle = t * 0.25f;
+    float radius = 40.0f;
+    camera.pos.x = std::sin(angle) * radius;
+    camera.pos.z = std::cos(angle) * radius;
+    int groundY;
+    if (highestBlockY(blockCoord(camera.pos.x), blockCoord(camera.pos.z), groundY)) camera.pos.y = groundY + 2.0f;
+    // Tangent of the circle, swept a little to either side
+    camera.yaw = std::atan2(-std::sin(angle), std::cos(angle)) * 180.0f / M_PI + std::sin(t) * 30.0f;
+    camera.pitch = -35.0f + std::sin(t * 0.7f) * 10.0f;
+}
+
+// Chunks per second generating BENCH_TERRAIN_CHUNKS chunks on `threads` threads
+double terrainChunksPerSecond(int threads) {
+    std::atomic<int> next{0};
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&] {
+            StoredChunk chunk;
+            for (int i = next++; i < BENCH_TERRAIN_CHUNKS; i = next++) {
+                generateTerrainChunk(BENCH_SEED, i % 32 - 16, i / 32 - 16, chunk);
+            }
+        });
     }
+    for (auto& thread : pool) thread.join();
+    return BENCH_TERRAIN_CHUNKS / (elapsedMs(begin) / 1000.0);
 }
 
-Chunk loadChunk(int cx, int cz) {
-    Chunk chunk;
-    chunk.pos = Vec3(cx, 0, cz);
-    std::ifstream ifs(chunkFilename(cx, cz), std::ios::binary);
-    if (ifs) {
-        size_t n;
-        ifs.read((char*)&n, sizeof(size_t));
-        chunk.cubes.resize(n);
-        for (size_t i = 0; i < n; i++) {
-            ifs.read((char*)&chunk.cubes[i].pos, sizeof(Vec3));
-            ifs.read((char*)&chunk.cubes[i].color, sizeof(Vec3));
-        }
-    } else {
-        for (int x = 0; x < CHUNK_SIZE; x++) {
-            for (int z = 0; z < CHUNK_SIZE; z++) {
-                Cube c;
-                c.pos = Vec3(cx * CHUNK_SIZE + x, 0, cz * CHUNK_SIZE + z);
-                c.color = Vec3(0.3f + (rand()%70)/100.0f, 0.3f + (rand()%70)/100.0f, 0.3f + (rand()%70)/100.0f);
-                chunk.cubes.push_back(c);
+// Sections per second meshing `snapshots` on `threads` threads, as the
+// mesh workers do
+double meshSectionsPerSecond(const std::vector<SectionSnapshot>& snapshots, int threads) {
+    if (snapshots.empty()) return 0;
+    std::atomic<size_t> next{0};
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&] {
+            for (size_t i = next++; i < snapshots.size(); i = next++) {
+                buildSectionMesh(snapshots[i]);
+                sectionFaceLinks(snapshots[i]);
             }
-        }
+        });
     }
-    return chunk;
+    for (auto& thread : pool) thread.join();
+    return snapshots.size() / (elapsedMs(begin) / 1000.0);
 }
 
-void updateLoadedChunks(const Vec3& cameraPos) {
-    int camChunkX = (int)std::floor(cameraPos.x / CHUNK_SIZE);
-    int camChunkZ = (int)std::floor(cameraPos.z / CHUNK_SIZE);
-    for (int dx = -RENDER_DISTANCE; dx <= RENDER_DISTANCE; dx++) {
-        for (int dz = -RENDER_DISTANCE; dz <= RENDER_DISTANCE; dz++) {
-            int cx = camChunkX + dx;
-            int cz = camChunkZ + dz;
-            int64_t key = chunkKey(cx, cz);
-            if (loadedChunks.find(key) == loadedChunks.end()) {
-                loadedChunks[key] = loadChunk(cx, cz);
+int runBenchmark(int frames, const std::string& outPath) {
+    // Run against a scratch world so results do not depend on (or change)
+    // the player's saved chunks
+    std::filesystem::path worldDir = std::filesystem::temp_directory_path() / "mini-fps-bench";
+    std::error_code ec;
+    std::filesystem::remove_all(worldDir, ec);
+    std::filesystem::create_directories(worldDir, ec);
+    worldStore.reopen(worldDir.string());
+    worldSeed = BENCH_SEED;
+    editJournal.open(journalPath());
+    lightSearch.stats = LightStats();
+    lightSearch.stats.keepSamples = true;
+
+    auto startupBegin = std::chrono::steady_clock::now();
+    startChunkStreaming();
+    benchCameraAt(0);
+    loadChunksAround(camera.pos);
+    benchCameraAt(0);
+    double startupMs = elapsedMs(startupBegin);
+
+    std::vector<double> frameMs, stageMs[BENCH_STAGE_COUNT];
+    int edits = 0, meshesBuilt = 0, lodMeshesBuilt = 0;
+    long long drawCalls = 0, occlusionCulled = 0, sectionsReached = 0;
+    Mat4 proj = Mat4::perspective(45.0f*M_PI/180.0f, 16.0f/9.0f, 0.1f, farPlane());
+    VisibleSet visible;
+
+    for (int frame = 0; frame < frames; frame++) {
+        auto frameBegin = std::chrono::steady_clock::now();
+        double stage[BENCH_STAGE_COUNT] = {};
+
+        auto t0 = std::chrono::steady_clock::now();
+        RayHit hit;
+        bool hasTarget = raycastBlocks(camera.pos, camera.front(), 7.5f, hit);
+        stage[BENCH_PICKING] = elapsedMs(t0);
+
+        benchCameraAt(frame);
+        t0 = std::chrono::steady_clock::now();
+        updateLoadedChunks(camera.pos);
+        prefetchChunks(camera.pos, camera.front(), BENCH_DT);
+        updateLodTiles(camera.pos);
+        stage[BENCH_STREAMING] = elapsedMs(t0);
+
+        // Alternate placing and breaking at the target
+        t0 = std::chrono::steady_clock::now();
+        if (hasTarget && frame % BENCH_EDIT_INTERVAL == 0) {
+            bool place = (frame / BENCH_EDIT_INTERVAL) % 2 == 0;
+            if (place ? placeBlockAtHit(hit, hotbarColors[(frame / BENCH_EDIT_INTERVAL) % HOTBAR_SLOTS])
+                      : breakBlockAtHit(hit)) {
+                edits++;
             }
         }
+        updateEditJournal(frame * BENCH_DT);
+        stage[BENCH_PLACEMENT] = elapsedMs(t0);
+
+        t0 = std::chrono::steady_clock::now();
+        buildHeadlessMeshes(meshesBuilt, lodMeshesBuilt);
+        stage[BENCH_MESH_BUILD] = elapsedMs(t0);
+
+        t0 = std::chrono::steady_clock::now();
+        Mat4 viewProj = multiply(proj, camera.getViewMatrix());
+        cullChunks(viewProj, camera.pos, visible);
+        // One multi-draw for all meshes plus one instanced draw per chunk
+        drawCalls += (visible.sections.size() + visible.lodTiles.size() ? 1 : 0) + visible.instanced.size();
+        occlusionCulled += cullStats.occlusionCulled;
+        sectionsReached += cullStats.sectionsReached;
+        stage[BENCH_DRAW_SUBMISSION] = elapsedMs(t0);
+
+        frameMs.push_back(elapsedMs(frameBegin));
+        for (int i = 0; i < BENCH_STAGE_COUNT; i++) stageMs[i].push_back(stage[i]);
     }
-    std::vector<int64_t> toUnload;
+
+    size_t chunksLoaded = loadedChunks.size(), lodTileCount = lodTiles.size();
+    LightStats lighting = lightSearch.stats;  // without the bulk edit's
+    lightSearch.stats.keepSamples = false;
+    BenchBulkEdit bulk = benchBulkEdit();
+    int cacheHits = chunkCache.hits, cacheMisses = chunkCache.misses, cacheEvictions = chunkCache.evictions;
+    ChunkPrefetcher prefetchStats = prefetcher;
+    stopChunkStreaming();
+    int terrainThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    double terrainSingle = terrainChunksPerSecond(1);
+    double terrainParallel = terrainChunksPerSecond(terrainThreads);
+    std::vector<SectionSnapshot> meshSnapshots;
     for (auto& [key, chunk] : loadedChunks) {
-        int cx = chunk.pos.x, cz = chunk.pos.z;
-        if (abs(cx - camChunkX) > RENDER_DISTANCE || abs(cz - camChunkZ) > RENDER_DISTANCE) {
-            if (chunk.dirty) saveChunk(chunk);
-            toUnload.push_back(key);
-        }
-    }
-    for (auto key : toUnload) loadedChunks.erase(key);
-}
-
-bool rayIntersectsCube(const Vec3& rayOrigin, const Vec3& rayDir, const Vec3& cubePos, float& tNear) {
-    Vec3 min = cubePos - Vec3(0.5f,0.5f,0.5f);
-    Vec3 max = cubePos + Vec3(0.5f,0.5f,0.5f);
-    float t1 = (min.x - rayOrigin.x) / rayDir.x;
-    float t2 = (max.x - rayOrigin.x) / rayDir.x;
-    float t3 = (min.y - rayOrigin.y) / rayDir.y;
-    float t4 = (max.y - rayOrigin.y) / rayDir.y;
-    float t5 = (min.z - rayOrigin.z) / rayDir.z;
-    float t6 = (max.z - rayOrigin.z) / rayDir.z;
-    float tmin = std::fmax(std::fmax(std::fmin(t1,t2), std::fmin(t3,t4)), std::fmin(t5,t6));
-    float tmax = std::fmin(std::fmin(std::fmax(t1,t2), std::fmax(t3,t4)), std::fmax(t5,t6));
-    if(tmax < 0 || tmin > tmax) return false;
-    tNear = tmin;
-    return true;
+        for (size_t i = 0; i < chunk.sections.size(); i++) {
+            if (chunk.sections[i].blockCount) meshSnapshots.push_back(snapshotSection(chunk, chunk.baseSection + (int)i));
+        }
+    }
+    double meshSingle = meshSectionsPerSecond(meshSnapshots, 1);
+    double meshParallel = meshSectionsPerSecond(meshSnapshots, terrainThreads);
+    loadedChunks.clear();
+    chunkCache = ChunkCache{};
+    prefetcher = ChunkPrefetcher{};
+    destroyLodTiles();
+    editJournal.close();
+    worldStore.reopen("chunks");
+    std::filesystem::remove_all(worldDir, ec);
+    for (double& ms : lighting.relightMs) ms *= 1000;  // reported in microseconds
+
+    std::ofstream file;
+    if (!outPath.empty()) {
+        file.open(outPath);
+        if (!file) {
+            std::cerr << "Cannot write " << outPath << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = outPath.empty() ? std::cout : file;
+    out << "{\n  \"frames\": " << frames << ",\n  \"startup_ms\": " << startupMs << ",\n  \"frame_ms\": ";
+    writeTimingJson(out, frameMs);
+    out << ",\n  \"stages_ms\": {";
+    for (int i = 0; i < BENCH_STAGE_COUNT; i++) {
+        out << (i ? "," : "") << "\n    \"" << benchStageNames[i] << "\": ";
+        writeTimingJson(out, stageMs[i]);
+    }
+    out << "\n  },\n  \"chunks_loaded\": " << chunksLoaded << ",\n  \"edits\": " << edits
+        << ",\n  \"meshes_built\": " << meshesBuilt << ",\n  \"view_distance\": " << viewDistance
+        << ",\n  \"lod_tiles\": " << lodTileCount << ",\n  \"lod_meshes_built\": " << lodMeshesBuilt
+        << ",\n  \"draw_calls\": " << drawCalls << ",\n  \"occlusion\": {\"culled_per_frame\": "
+        << (frames ? (double)occlusionCulled / frames : 0) << ", \"sections_reached_per_frame\": "
+        << (frames ? (double)sectionsReached / frames : 0) << "}"
+        << ",\n  \"terrain\": {\"chunks\": " << BENCH_TERRAIN_CHUNKS << ", \"threads\": " << terrainThreads
+        << ", \"chunks_per_second_1_thread\": " << terrainSingle
+        << ", \"chunks_per_second\": " << terrainParallel << "}"
+        << ",\n  \"meshing\": {\"sections\": " << meshSnapshots.size() << ", \"threads\": " << terrainThreads
+        << ", \"sections_per_second_1_thread\": " << meshSingle << ", \"sections_per_second\": " << meshParallel << "}"
+        << ",\n  \"chunk_cache\": {\"hits\": " << cacheHits << ", \"misses\": " << cacheMisses
+        << ", \"evictions\": " << cacheEvictions << "}"
+        << ",\n  \"prefetch\": {\"issued\": " << prefetchStats.issued << ", \"hits\": " << prefetchStats.hits
+        << ", \"late\": " << prefetchStats.late << ", \"wasted\": " << prefetchStats.wasted << "}"
+        << ",\n  \"lighting\": {\"chunks_lit\": " << lighting.chunksLit << ", \"chunk_light_ms\": "
+        << (lighting.chunksLit ? lighting.chunkLightMs / lighting.chunksLit : 0) << ", \"relights\": " << lighting.relights
+        << ", \"cells_per_relight\": " << (lighting.relights ? (double)lighting.cellsChanged / lighting.relights : 0)
+        << ", \"relight_us\": ";
+    writeTimingJson(out, lighting.relightMs);
+    out << "}"
+        << ",\n  \"bulk_edit\": {\"blocks\": " << bulk.blocks << ", \"fill_ms\": " << bulk.fillMs
+        << ", \"remesh_ms\": " << bulk.remeshMs << ", \"sections_remeshed\": " << bulk.sectionsRemeshed
+        << ", \"copy_ms\": " << bulk.copyMs << ", \"paste_ms\": " << bulk.pasteMs
+        << ", \"clear_ms\": " << bulk.clearMs << "}\n}" << std::endl;
+    return 0;
 }
 
-Cube* getCubeUnderCursor(Vec3 rayOrigin, Vec3 rayDir, float maxDistance, Vec3& hitPos, Vec3& hitNormal) {
-    Cube* closest = nullptr;
-    float closestT = maxDistance;
-    for(auto& [key, chunk] : loadedChunks){
-        for(auto& c : chunk.cubes){
-            float t;
-            if(rayIntersectsCube(rayOrigin, rayDir, c.pos, t)){
-                if(t < closestT){
-                    closestT = t;
-                    closest = &c;
-                }
-            }
+// --------------------
+// Input recording
+// --------------------
+// `--record file` logs every frame's input to file (see
+// input-recording.hpp) and copies the world as it was before the first
+// frame to file.world. `--replay file` plays the log back in a window
+// against a scratch copy of that world; with `--headless` it runs without a
+// window as fast as it can and reports timings like --bench. Either way the
+// replay ends by checking the world came out as it did when recorded.
+// `--fixed-dt S` replays every frame with an S second time step instead of
+// the recorded ones (the camera then takes a different path, so the end
+// state is not compared).
+struct Replay {
+    std::string path;
+    RecordingHeader header;
+    std::vector<RecordedFrame> frames;
+    size_t next = 0;
+    bool hasWorldHash = false;
+    uint64_t worldHash = 0;
+    float fixedDt = 0;
+    std::filesystem::path worldDir;  // scratch copy of the recorded world
+};
+
+std::string recordingWorldPath(const std::string& recording) { return recording + ".world"; }
+
+// Hash of the player and every resident chunk's blocks, whatever order the
+// chunks were loaded in and their palettes were built
+uint64_t worldStateHash() {
+    std::vector<std::pair<int64_t, const Chunk*>> chunks;
+    for (auto& [key, chunk] : loadedChunks) chunks.push_back({key, &chunk});
+    for (auto& [key, chunk] : chunkCache.entries) chunks.push_back({key, &chunk});
+    std::sort(chunks.begin(), chunks.end());
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&](uint64_t v) { hash = (hash ^ v) * 1099511628211ull; };
+    for (auto& [key, chunk] : chunks) {
+        StoredChunk stored = toStoredChunk(*chunk);
+        mix(key);
+        mix(stored.blocks.size());
+        for (auto& b : stored.blocks) {
+            mix((uint64_t)b.x | (uint64_t)b.z << 8 | (uint64_t)(uint32_t)b.y << 16);
+            mix((uint64_t)b.color << 1 | b.rotate);
         }
     }
-    if(closest){
-        hitPos = rayOrigin + rayDir * closestT;
-        Vec3 local = hitPos - closest->pos;
-        float absX = std::abs(local.x), absY = std::abs(local.y), absZ = std::abs(local.z);
-        if(absX > absY && absX > absZ) hitNormal = Vec3(local.x>0?1:-1,0,0);
-        else if(absY > absX && absY > absZ) hitNormal = Vec3(0,local.y>0?1:-1,0);
-        else hitNormal = Vec3(0,0,local.z>0?1:-1);
-        return closest;
+    for (float v : {camera.pos.x, camera.pos.y, camera.pos.z}) {
+        uint32_t bits;
+        std::memcpy(&bits, &v, 4);
+        mix(bits);
     }
-    return nullptr;
+    mix(selectedHotbarSlot);
+    return hash;
 }
 
-Vec3 calculatePlacementPosition(const Vec3& hitPos, const Vec3& hitNormal) {
-    Vec3 placePos = hitPos + hitNormal * 0.5f;
-    placePos.x = std::floor(placePos.x + 0.5f);
-    placePos.y = std::floor(placePos.y + 0.5f);
-    placePos.z = std::floor(placePos.z + 0.5f);
-    return placePos;
+std::string hashString(uint64_t hash) {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+    return text;
 }
 
-bool isPositionOccupied(const Vec3& pos) {
-    for(auto& [key, chunk] : loadedChunks){
-        for(auto& c : chunk.cubes){
-            if(c.pos.x == pos.x && c.pos.y == pos.y && c.pos.z == pos.z)
-                return true;
-        }
+// Copies the world next to the recording before anything streams, so the
+// replay starts from the same blocks
+bool snapshotRecordingWorld(const std::string& recording) {
+    std::error_code ec;
+    std::filesystem::path target = recordingWorldPath(recording);
+    worldStore.reopen(worldStore.directory());  // close region files so nothing is left buffered
+    std::filesystem::remove_all(target, ec);
+    std::filesystem::create_directories(target, ec);
+    if (!ec) std::filesystem::copy(worldStore.directory(), target, std::filesystem::copy_options::recursive, ec);
+    if (ec) {
+        std::cerr << "Cannot copy the world to " << target.string() << ": " << ec.message() << std::endl;
+        return false;
     }
-    return false;
+    return true;
 }
 
-// Function to create a quad for UI elements
-void createQuad(float x, float y, float width, float height, float* vertices) {
-    // Triangle 1
-    vertices[0] = x;           vertices[1] = y;            vertices[2] = 0.0f; vertices[3] = 0.0f;
-    vertices[4] = x + width;   vertices[5] = y;            vertices[6] = 1.0f; vertices[7] = 0.0f;
-    vertices[8] = x + width;   vertices[9] = y + height;   vertices[10] = 1.0f; vertices[11] = 1.0f;
-    // Triangle 2
-    vertices[12] = x;          vertices[13] = y;           vertices[14] = 0.0f; vertices[15] = 0.0f;
-    vertices[16] = x + width;  vertices[17] = y + height;  vertices[18] = 1.0f; vertices[19] = 1.0f;
-    vertices[20] = x;          vertices[21] = y + height;  vertices[22] = 0.0f; vertices[23] = 1.0f;
+// Called once the camera is placed, just before the first frame
+bool startRecording(const std::string& recording) {
+    RecordingHeader header;
+    header.seed = worldSeed;
+    header.x = camera.pos.x; header.y = camera.pos.y; header.z = camera.pos.z;
+    header.yaw = camera.yaw; header.pitch = camera.pitch;
+    header.viewDistance = viewDistance;
+    header.hotbarSlot = selectedHotbarSlot;
+    header.chunkCacheBytes = chunkCache.budget;
+    if (!inputRecorder.open(recording, header)) {
+        std::cerr << "Cannot write " << recording << std::endl;
+        return false;
+    }
+    frameIntegrations.clear();
+    std::cout << "Recording input to " << recording << std::endl;
+    return true;
+}
+
+// Appends the frame just played to the recording, if there is one
+void recordFrame(float dt) {
+    if (!inputRecorder.isOpen()) return;
+    RecordedFrame frame;
+    frame.deltaTime = dt;
+    frame.yaw = camera.yaw;
+    frame.pitch = camera.pitch;
+    frame.keys = frameInput.held;
+    frame.chunks.swap(frameIntegrations);
+    inputRecorder.append(frame);
+}
+
+// Reads the recording, opens a scratch copy of its world and loads the
+// chunks around the recorded start, as the recorded session did at startup
+bool startReplay(const std::string& path, float fixedDt, Replay& replay) {
+    replay.path = path;
+    replay.fixedDt = fixedDt;
+    if (!readInputRecording(path, replay.header, replay.frames, replay.hasWorldHash, replay.worldHash)) {
+        std::cerr << "Cannot read the input recording " << path << std::endl;
+        return false;
+    }
+    if (!replay.hasWorldHash) std::cerr << path << " was cut short; replaying its " << replay.frames.size() << " frames" << std::endl;
+
+    std::error_code ec;
+    replay.worldDir = std::filesystem::temp_directory_path() / "mini-fps-replay";
+    std::filesystem::remove_all(replay.worldDir, ec);
+    std::filesystem::create_directories(replay.worldDir, ec);
+    std::string source = recordingWorldPath(path);
+    if (!std::filesystem::is_directory(source, ec)) {
+        std::cerr << "No world copy at " << source << ", replaying against " << worldStore.directory()
+                  << "; the world may not match" << std::endl;
+        source = worldStore.directory();
+    }
+    worldStore.reopen(worldStore.directory());
+    std::filesystem::copy(source, replay.worldDir, std::filesystem::copy_options::recursive, ec);
+    worldStore.reopen(replay.worldDir.string());
+    worldSeed = replay.header.seed;
+    viewDistance = std::clamp((int)replay.header.viewDistance, RENDER_DISTANCE, MAX_VIEW_DISTANCE);
+    selectedHotbarSlot = std::clamp((int)replay.header.hotbarSlot, 0, HOTBAR_SLOTS - 1);
+    chunkCache.budget = replay.header.chunkCacheBytes;
+    editJournal.open(journalPath());
+
+    camera.pos = Vec3(replay.header.x, replay.header.y, replay.header.z);
+    camera.yaw = replay.header.yaw;
+    camera.pitch = replay.header.pitch;
+    startChunkStreaming();
+    loadChunksAround(camera.pos);
+    std::cout << "Replaying " << replay.frames.size() << " frames from " << path << std::endl;
+    return true;
+}
+
+// Sets up the next recorded frame: input, orientation, time step and the
+// chunks it takes in. False once the recording is played out.
+bool nextReplayFrame(Replay& replay) {
+    if (replay.next >= replay.frames.size()) {
+        scriptedIntegrations = nullptr;
+        return false;
+    }
+    const RecordedFrame& frame = replay.frames[replay.next++];
+    frameInput.advance(frame.keys);
+    camera.yaw = frame.yaw;
+    camera.pitch = frame.pitch;
+    deltaTime = replay.fixedDt > 0 ? replay.fixedDt : frame.deltaTime;
+    scriptedIntegrations = &frame.chunks;
+    return true;
+}
+
+enum ReplayVerdict { REPLAY_MATCHED, REPLAY_DIVERGED, REPLAY_NOT_COMPARED };
+
+// Compares the world after the replay with the recorded one and says so
+ReplayVerdict checkReplay(const Replay& replay, uint64_t worldHash) {
+    ReplayVerdict verdict = REPLAY_NOT_COMPARED;
+    if (replay.hasWorldHash && replay.fixedDt <= 0 && replay.next == replay.frames.size()) {
+        verdict = worldHash == replay.worldHash ? REPLAY_MATCHED : REPLAY_DIVERGED;
+    }
+    std::cout << "Replayed " << replay.next << " of " << replay.frames.size() << " frames, world "
+              << hashString(worldHash);
+    if (verdict == REPLAY_MATCHED) std::cout << " matches the recording" << std::endl;
+    else if (verdict == REPLAY_DIVERGED) std::cout << " differs from the recorded " << hashString(replay.worldHash) << std::endl;
+    else std::cout << " (not compared)" << std::endl;
+    return verdict;
+}
+
+// After streaming has stopped: drops the chunks held back for the script
+// and the scratch world
+void endReplay(Replay& replay) {
+    scriptedIntegrations = nullptr;
+    for (auto& [key, chunk] : earlyArrivals) delete chunk;
+    earlyArrivals.clear();
+    lateArrivals.clear();
+    worldStore.reopen("chunks");
+    std::error_code ec;
+    std::filesystem::remove_all(replay.worldDir, ec);
+}
+
+// `--replay file --headless`: the main loop's simulation without a window,
+// timed per stage like --bench. Time spent waiting for the workers to finish
+// a scripted chunk is left out of the stage and frame timings. Returns 1 if
+// the world diverged from the recording.
+int runHeadlessReplay(const std::string& path, float fixedDt, const std::string& outPath) {
+    Replay replay;
+    if (!startReplay(path, fixedDt, replay)) return 1;
+
+    std::vector<double> frameMs, stageMs[BENCH_STAGE_COUNT];
+    int meshesBuilt = 0, lodMeshesBuilt = 0;
+    long long drawCalls = 0;
+    float simulatedTime = 0;
+    VisibleSet visible;
+    scriptedChunkWaitMs = 0;
+
+    while (nextReplayFrame(replay)) {
+        auto frameBegin = std::chrono::steady_clock::now();
+        double stage[BENCH_STAGE_COUNT] = {};
+        double waitedBefore = scriptedChunkWaitMs;
+        simulatedTime += deltaTime;
+
+        // Same order as the main loop
+        auto t0 = std::chrono::steady_clock::now();
+        RayHit hit;
+        bool hasTarget = raycastBlocks(camera.pos, camera.front(), 7.5f, hit);
+        stage[BENCH_PICKING] = elapsedMs(t0);
+
+        applyControlInput(frameInput, deltaTime);
+        if (frameInput.down(GLFW_KEY_ESCAPE)) break;
+
+        t0 = std::chrono::steady_clock::now();
+        updateLoadedChunks(camera.pos);
+        prefetchChunks(camera.pos, camera.front(), deltaTime);
+        updateLodTiles(camera.pos);
+        stage[BENCH_STREAMING] = elapsedMs(t0) - (scriptedChunkWaitMs - waitedBefore);
+
+        t0 = std::chrono::steady_clock::now();
+        applyEditInput(frameInput, hasTarget, hit);
+        updateEditJournal(simulatedTime);
+        stage[BENCH_PLACEMENT] = elapsedMs(t0);
+
+        t0 = std::chrono::steady_clock::now();
+        buildHeadlessMeshes(meshesBuilt, lodMeshesBuilt);
+        stage[BENCH_MESH_BUILD] = elapsedMs(t0);
+
+        t0 = std::chrono::steady_clock::now();
+        Mat4 proj = Mat4::perspective(45.0f*M_PI/180.0f, 16.0f/9.0f, 0.1f, farPlane());
+        cullChunks(multiply(proj, camera.getViewMatrix()), camera.pos, visible);
+        drawCalls += (visible.sections.size() + visible.lodTiles.size() ? 1 : 0) + visible.instanced.size();
+        stage[BENCH_DRAW_SUBMISSION] = elapsedMs(t0);
+
+        frameMs.push_back(elapsedMs(frameBegin) - (scriptedChunkWaitMs - waitedBefore));
+        for (int i = 0; i < BENCH_STAGE_COUNT; i++) stageMs[i].push_back(stage[i]);
+    }
+
+    uint64_t worldHash = worldStateHash();
+    size_t chunksLoaded = loadedChunks.size();
+    stopChunkStreaming();
+    endReplay(replay);
+    loadedChunks.clear();
+    chunkCache = ChunkCache{};
+    prefetcher = ChunkPrefetcher{};
+    destroyLodTiles();
+    editJournal.close();
+    ReplayVerdict verdict = checkReplay(replay, worldHash);
+
+    std::ofstream file;
+    if (!outPath.empty()) {
+        file.open(outPath);
+        if (!file) {
+            std::cerr << "Cannot write " << outPath << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = outPath.empty() ? std::cout : file;
+    static const char* verdictNames[] = {"true", "false", "null"};
+    out << "{\n  \"frames\": " << frameMs.size() << ",\n  \"fixed_dt\": " << fixedDt
+        << ",\n  \"frame_ms\": ";
+    writeTimingJson(out, frameMs);
+    out << ",\n  \"stages_ms\": {";
+    for (int i = 0; i < BENCH_STAGE_COUNT; i++) {
+        out << (i ? "," : "") << "\n    \"" << benchStageNames[i] << "\": ";
+        writeTimingJson(out, stageMs[i]);
+    }
+    out << "\n  },\n  \"chunk_wait_ms\": " << scriptedChunkWaitMs << ",\n  \"chunks_loaded\": " << chunksLoaded
+        << ",\n  \"meshes_built\": " << meshesBuilt << ",\n  \"lod_meshes_built\": " << lodMeshesBuilt
+        << ",\n  \"draw_calls\": " << drawCalls << ",\n  \"world_hash\": \"" << hashString(worldHash) << "\""
+        << ",\n  \"recorded_world_hash\": ";
+    if (replay.hasWorldHash) out << "\"" << hashString(replay.worldHash) << "\"";
+    else out << "null";
+    out << ",\n  \"world_state_matches\": " << verdictNames[verdict] << "\n}" << std::endl;
+    return verdict == REPLAY_DIVERGED ? 1 : 0;
 }
 
 // --------------------
 // Main
 // --------------------
-int main(){
+int main(int argc, char** argv){
+    bool bench = false;
+    int benchFrames = BENCH_DEFAULT_FRAMES;
+    std::string benchOut, recordPath, replayPath, connectAddress;
+    bool headless = false;
+    float fixedDt = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--bench")) bench = true;
+        else if (!std::strcmp(argv[i], "--frames") && i + 1 < argc) benchFrames = std::max(1, atoi(argv[++i]));
+        else if (!std::strcmp(argv[i], "--out") && i + 1 < argc) benchOut = argv[++i];
+        else if (!std::strcmp(argv[i], "--view-distance") && i + 1 < argc)
+            viewDistance = std::clamp(atoi(argv[++i]), RENDER_DISTANCE, MAX_VIEW_DISTANCE);
+        else if (!std::strcmp(argv[i], "--chunk-cache-mb") && i + 1 < argc) chunkCache.budget = (size_t)std::max(0, atoi(argv[++i])) << 20;
+        else if (!std::strcmp(argv[i], "--record") && i + 1 < argc) recordPath = argv[++i];
+        else if (!std::strcmp(argv[i], "--replay") && i + 1 < argc) replayPath = argv[++i];
+        else if (!std::strcmp(argv[i], "--headless")) headless = true;
+        else if (!std::strcmp(argv[i], "--fixed-dt") && i + 1 < argc) fixedDt = std::max(0.0f, (float)atof(argv[++i]));
+        else if (!std::strcmp(argv[i], "--connect") && i + 1 < argc) connectAddress = argv[++i];
+    }
+    // Chunks from a server arrive in no reproducible order
+    if (!connectAddress.empty() && (!recordPath.empty() || !replayPath.empty())) {
+        std::cerr << "--record and --replay are not available with --connect" << std::endl;
+        recordPath.clear();
+        replayPath.clear();
+    }
+    if (bench) return runBenchmark(benchFrames, benchOut);
+    if (!replayPath.empty() && headless) return runHeadlessReplay(replayPath, fixedDt, benchOut);
+
     if(!glfwInit()) return -1;
-    camera.pos = Vec3(0,0,0);
-    updateLoadedChunks(camera.pos);
-    
-    camera.pos.y = getHighestBlockY(camera.pos.x, camera.pos.z) + 1.0f;
-    camera.pos.y += 1;
+    profileSetThreadName("main");
+    bool replaying = !replayPath.empty();
+    Replay replay;
+    if (replaying) {
+        if (!startReplay(replayPath, fixedDt, replay)) { glfwTerminate(); return 1; }
+    } else if (!connectAddress.empty()) {
+        camera.pos = Vec3(0,0,0);
+        if (!connectToWorldServer(connectAddress)) { glfwTerminate(); return 1; }
+        startChunkStreaming();
+        loadChunksAround(camera.pos);
+        camera.pos.y = getHighestBlockY(camera.pos.x, camera.pos.z) + 2.0f;
+    } else {
+        camera.pos = Vec3(0,0,0);
+        int migrated = migrateLegacyChunks(worldStore);
+        if (migrated) std::cout << "Migrated " << migrated << " chunk files to region storage" << std::endl;
+        worldSeed = loadWorldSeed(worldStore.directory());
+        int recovered = replayEditJournals();
+        if (recovered) std::cout << "Recovered " << recovered << " edits from the journal" << std::endl;
+        if (!recordPath.empty() && !snapshotRecordingWorld(recordPath)) { glfwTerminate(); return 1; }
+        if (!editJournal.open(journalPath(), journalBacklog)) std::cerr << "Cannot open the edit journal, edits are only saved on exit" << std::endl;
+        startChunkStreaming();
+        loadChunksAround(camera.pos);
+
+        camera.pos.y = getHighestBlockY(camera.pos.x, camera.pos.z) + 1.0f;
+        camera.pos.y += 1;
+        if (!recordPath.empty()) startRecording(recordPath);
+    }
     
     GLFWmonitor* monitor = glfwGetPrimaryMonitor();
     const GLFWvidmode* mode = glfwGetVideoMode(monitor);
     
     GLFWwindow* window = glfwCreateWindow(mode->width, mode->height, "Mini FPS Game", monitor, nullptr);
-    if(!window){ glfwTerminate(); return -1; }
+    if(!window){ stopWorldClient(); stopChunkStreaming(); endWorldClient(); glfwTerminate(); return -1; }
     
     int screenWidth = mode->width;
     int screenHeight = mode->height;
@@ -351,6 +4536,9 @@ int main(){
     glfwSetInputMode(window,GLFW_CURSOR,GLFW_CURSOR_DISABLED);
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
         std::cerr << "Failed to initialize GLAD!" << std::endl;
+        stopWorldClient();
+        stopChunkStreaming();
+        endWorldClient();
         return -1;
     }
 
@@ -362,7 +4550,15 @@ int main(){
     GLuint shaderProgram=glCreateProgram();
     glAttachShader(shaderProgram,vs); glAttachShader(shaderProgram,fs);
     glLinkProgram(shaderProgram);
-    glDeleteShader(vs); glDeleteShader(fs);
+    glDeleteShader(vs);
+
+    // Instanced program for dynamic cubes shares the fragment shader
+    GLuint vsInstance=glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vsInstance,1,&instanceVertexShaderSource,nullptr); glCompileShader(vsInstance);
+    GLuint instanceShaderProgram=glCreateProgram();
+    glAttachShader(instanceShaderProgram,vsInstance); glAttachShader(instanceShaderProgram,fs);
+    glLinkProgram(instanceShaderProgram);
+    glDeleteShader(vsInstance); glDeleteShader(fs);
 
     // Setup cube VAO
     GLuint VAO,VBO;
@@ -375,6 +4571,9 @@ int main(){
     glVertexAttribPointer(1,3,GL_FLOAT,GL_FALSE,6*sizeof(float),(void*)(3*sizeof(float))); glEnableVertexAttribArray(1);
     glEnable(GL_DEPTH_TEST);
 
+    initMeshArena();
+    startMeshWorkers();
+
     // Compile crosshair shader
     GLuint vsCrosshair = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vsCrosshair, 1, &crosshairVertexShader, nullptr);
@@ -450,138 +4649,133 @@ int main(){
     
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    float lastStatsTime = 0;
+    float simulatedTime = 0;  // sum of frame time steps, recorded or replayed
+    FrameProfiler profiler;
+    initFrameProfiler(profiler);
+
     // Main loop
     while(!glfwWindowShouldClose(window)){
+        ProfileZone frameZone("frame");
+        double stageMs[FRAME_STAGE_COUNT] = {};
+        beginProfiledFrame(profiler);
+        ProfileZone inputZone(frameStageNames[STAGE_INPUT]);
         float currentFrame=glfwGetTime();
         deltaTime=currentFrame-lastFrame;
         lastFrame=currentFrame;
         keyboard.Update(window);
         mouse.Update(window);
-
-        // Hotbar slot selection
-        for(int i = 0; i < HOTBAR_SLOTS; i++) {
-            if(!keyboard.prev_keys[GLFW_KEY_1 + i] && keyboard.curr_keys[GLFW_KEY_1 + i]) {
-                selectedHotbarSlot = i;
-            }
+        // A replay takes everything but Escape (which stops it) from the recording
+        if (replaying) {
+            if (keyboard.curr_keys[GLFW_KEY_ESCAPE] || !nextReplayFrame(replay)) break;
+        } else {
+            frameInput.advance(windowInput());
         }
+        simulatedTime += deltaTime;
+        stageMs[STAGE_INPUT] += inputZone.end();
 
         // Get target cube
-        Vec3 hitPos, hitNormal;
-        Cube* targetCube = getCubeUnderCursor(camera.pos, camera.front(), 7.5f, hitPos, hitNormal);
+        ProfileZone pickingZone(frameStageNames[STAGE_PICKING]);
+        RayHit hit;
+        bool hasTarget = raycastBlocks(camera.pos, camera.front(), 7.5f, hit);
+        bool hasHighlight = hasTarget;
+        Cube highlightCube = hit.cube;
+        stageMs[STAGE_PICKING] += pickingZone.end();
 
         // Movement
-        float speed=5.0f*deltaTime;
-        if(keyboard.curr_keys[GLFW_KEY_LEFT_CONTROL]){speed *= 2;}
-        Vec3 right = camera.front().cross(Vec3(0,1,0)).normalize();
-        Vec3 forwardDir = camera.front();
-        forwardDir.y = 0;
-        forwardDir = forwardDir.normalize();
-        Vec3 rightDir = right;
-        rightDir.y = 0;
-        rightDir = rightDir.normalize();
-        
-        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) camera.pos = camera.pos + forwardDir * speed;
-        if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) camera.pos = camera.pos - forwardDir * speed;
-        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) camera.pos = camera.pos - rightDir * speed;
-        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) camera.pos = camera.pos + rightDir * speed;
-        if(glfwGetKey(window,GLFW_KEY_SPACE)==GLFW_PRESS) camera.pos.y += speed; 
-        if(glfwGetKey(window,GLFW_KEY_LEFT_SHIFT)==GLFW_PRESS) camera.pos.y -= speed;
-        if(glfwGetKey(window,GLFW_KEY_ESCAPE)==GLFW_PRESS) break;
-        if(!keyboard.prev_keys['F'] && keyboard.curr_keys['F']) wireframeMode = !wireframeMode;
+        ProfileZone movementZone(frameStageNames[STAGE_INPUT]);
+        applyControlInput(frameInput, deltaTime);
+        if(frameInput.down(GLFW_KEY_ESCAPE)){
+            recordFrame(deltaTime);
+            break;
+        }
+        if(frameInput.pressed(GLFW_KEY_F3)) profiler.overlay = !profiler.overlay;
+        if(frameInput.pressed(GLFW_KEY_F4)){
+            if(writeChromeTrace("profile-trace.json")) std::cout << "Wrote profile-trace.json" << std::endl;
+            else std::cerr << "Failed to write profile-trace.json" << std::endl;
+        }
+        stageMs[STAGE_INPUT] += movementZone.end();
         
+        ProfileZone streamingZone(frameStageNames[STAGE_STREAMING]);
         updateLoadedChunks(camera.pos);
+        prefetchChunks(camera.pos, camera.front(), deltaTime);
+        updateLodTiles(camera.pos);
+        stageMs[STAGE_STREAMING] += streamingZone.end();
 
-        // Place cube with selected hotbar color
-        if(!mouse.prev_buttons[GLFW_MOUSE_BUTTON_LEFT] && mouse.curr_buttons[GLFW_MOUSE_BUTTON_LEFT]){
-            if(targetCube){
-                Vec3 placePos = calculatePlacementPosition(hitPos, hitNormal);
-                if(!isPositionOccupied(placePos)){
-                    int cx = (int)std::floor(placePos.x / CHUNK_SIZE);
-                    int cz = (int)std::floor(placePos.z / CHUNK_SIZE);
-                    int64_t key = chunkKey(cx, cz);
-                    Chunk& chunk = loadedChunks[key];
-                    Cube c;
-                    c.do_rotate = 1;
-                    c.pos = placePos;
-                    c.rot = Vec3(0,0,0);
-                    c.color = hotbarColors[selectedHotbarSlot];
-                    chunk.cubes.push_back(c);
-                    chunk.dirty = true;
-                }
-            }
-        }
+        // Place, break and volume edits
+        ProfileZone editsZone(frameStageNames[STAGE_EDITS]);
+        if(!applyEditInput(frameInput, hasTarget, hit)) hasHighlight = false;
+        updateEditJournal(simulatedTime);
+        stageMs[STAGE_EDITS] += editsZone.end();
 
-        // Break cube
-        if(!mouse.prev_buttons[GLFW_MOUSE_BUTTON_RIGHT] && mouse.curr_buttons[GLFW_MOUSE_BUTTON_RIGHT]){
-            if(targetCube){
-                int cx = (int)std::floor(targetCube->pos.x / CHUNK_SIZE);
-                int cz = (int)std::floor(targetCube->pos.z / CHUNK_SIZE);
-                int64_t key = chunkKey(cx, cz);
-                Chunk& chunk = loadedChunks[key];
-                auto it = std::find_if(chunk.cubes.begin(), chunk.cubes.end(),
-                                       [&](const Cube& c){ return &c == targetCube; });
-                if(it != chunk.cubes.end()){
-                    chunk.cubes.erase(it);
-                    chunk.dirty = true;
-                }
-            }
-        }
+        // === Render scene to framebuffer ===
+        ProfileZone meshingZone(frameStageNames[STAGE_MESHING]);
+        rebuildDirtyChunkMeshes(camera.pos);
+        uploadLodTiles(camera.pos);
+        // Dynamic blocks carry their highlight in the instance data
+        updateChunkInstances(VBO, hasHighlight && highlightCube.do_rotate, blockCoord(highlightCube.pos.x),
+                             blockCoord(highlightCube.pos.y), blockCoord(highlightCube.pos.z));
+        stageMs[STAGE_MESHING] += meshingZone.end();
+        ProfileZone sceneZone(frameStageNames[STAGE_SCENE]);
+        beginGpuPass(profiler, GPU_SCENE);
+        Mat4 view = camera.getViewMatrix();
+        Mat4 proj = Mat4::perspective(45.0f*M_PI/180.0f,(float)screenWidth/(float)screenHeight,0.1f,farPlane());
+        Mat4 viewProj = multiply(proj, view);
+        VisibleSet visible;
+        cullChunks(viewProj, camera.pos, visible);
+        GLuint loc = glGetUniformLocation(shaderProgram,"uMVP");
+        GLuint highlightLoc = glGetUniformLocation(shaderProgram,"uHighlight");
 
-        // === FIRST PASS: Render to framebuffer ===
         glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
         glViewport(0, 0, screenWidth, screenHeight);
         glClearColor(0.1f,0.1f,0.1f,1.0f);
         glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
         glUseProgram(shaderProgram);
         glEnable(GL_DEPTH_TEST);
-        
-        GLuint loc = glGetUniformLocation(shaderProgram,"uMVP");
-        GLuint colorLoc = glGetUniformLocation(shaderProgram,"uColor");
-        GLuint highlightLoc = glGetUniformLocation(shaderProgram,"uHighlight");
-
-        for (auto& [key, chunk] : loadedChunks) {
-            for (auto& c : chunk.cubes) {
-                Mat4 model = Mat4::identity();
-                model = multiply(model, model.translate(c.pos));
-                Mat4 view = camera.getViewMatrix();
-                Mat4 proj = Mat4::perspective(45.0f*M_PI/180.0f,(float)screenWidth/(float)screenHeight,0.1f,100.0f);
-                Mat4 mvp = multiply(proj, multiply(view, model));
-                glUniformMatrix4fv(loc,1,GL_FALSE,mvp.m);
-                glUniform3f(colorLoc,c.color.x,c.color.y,c.color.z);
-                bool isHighlighted = (targetCube == &c);
-                glUniform1i(highlightLoc, isHighlighted);
-                glBindVertexArray(VAO);
-                glPolygonMode(GL_FRONT_AND_BACK, wireframeMode ? GL_LINE : GL_FILL);
-                glDrawArrays(GL_TRIANGLES,0,36);
-            }
+        glPolygonMode(GL_FRONT_AND_BACK, wireframeMode ? GL_LINE : GL_FILL);
+        glUniformMatrix4fv(loc,1,GL_FALSE,viewProj.m);
+        glUniform1i(highlightLoc, 0);
+        drawArenaMeshes(visible);
+        // One instanced draw per chunk for its dynamic cubes
+        glUseProgram(instanceShaderProgram);
+        glUniformMatrix4fv(glGetUniformLocation(instanceShaderProgram,"uMVP"),1,GL_FALSE,viewProj.m);
+        glUniform1i(glGetUniformLocation(instanceShaderProgram,"uHighlight"), 0);
+        for (Chunk* chunk : visible.instanced) {
+            glBindVertexArray(chunk->instanceVAO);
+            glDrawArraysInstanced(GL_TRIANGLES,0,36,chunk->instanceCount);
         }
+        glUseProgram(shaderProgram);
+        // A targeted mesh cube is drawn again on top of its chunk mesh
+        if (hasHighlight && !highlightCube.do_rotate) {
+            Mat4 model = Mat4::identity();
+            model = multiply(model, model.translate(highlightCube.pos));
+            Mat4 mvp = multiply(viewProj, model);
+            glUniformMatrix4fv(loc,1,GL_FALSE,mvp.m);
+            glUniform1i(highlightLoc, 1);
+            glVertexAttrib3f(2, highlightCube.color.x, highlightCube.color.y, highlightCube.color.z);
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glEnable(GL_POLYGON_OFFSET_LINE);
+            glPolygonOffset(-1.0f, -1.0f);
+            glBindVertexArray(VAO);
+            glDrawArrays(GL_TRIANGLES,0,36);
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            glDisable(GL_POLYGON_OFFSET_LINE);
+        }
+        endMeshArenaFrame();
+        endGpuPass();
+        stageMs[STAGE_SCENE] += sceneZone.end();
 
-        // === SECOND PASS: Render to screen ===
+        // === Present: copy the scene to the screen ===
+        ProfileZone presentZone(frameStageNames[STAGE_PRESENT]);
+        beginGpuPass(profiler, GPU_PRESENT);
+        // The crosshair below samples colorTexture, so the scene is drawn
+        // once offscreen and blitted instead of being rendered twice
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, screenWidth, screenHeight, 0, 0, screenWidth, screenHeight,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         glViewport(0, 0, screenWidth, screenHeight);
-        glClearColor(0.1f,0.1f,0.1f,1.0f);
-        glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-        
-        // Render the scene again
-        glUseProgram(shaderProgram);
-        glEnable(GL_DEPTH_TEST);
-        
-        for (auto& [key, chunk] : loadedChunks) {
-            for (auto& c : chunk.cubes) {
-                Mat4 model = Mat4::identity();
-                model = multiply(model, model.translate(c.pos));
-                Mat4 view = camera.getViewMatrix();
-                Mat4 proj = Mat4::perspective(45.0f*M_PI/180.0f,(float)screenWidth/(float)screenHeight,0.1f,100.0f);
-                Mat4 mvp = multiply(proj, multiply(view, model));
-                glUniformMatrix4fv(loc,1,GL_FALSE,mvp.m);
-                glUniform3f(colorLoc,c.color.x,c.color.y,c.color.z);
-                bool isHighlighted = (targetCube == &c);
-                glUniform1i(highlightLoc, isHighlighted);
-                glBindVertexArray(VAO);
-                glPolygonMode(GL_FRONT_AND_BACK, wireframeMode ? GL_LINE : GL_FILL);
-                glDrawArrays(GL_TRIANGLES,0,36);
-            }
-        }
 
         // === Render crosshair ===
         glDisable(GL_DEPTH_TEST);
@@ -595,8 +4789,12 @@ int main(){
         glBindVertexArray(crosshairVAO);
         glLineWidth(2.0f);
         glDrawArrays(GL_LINES, 0, 4);
+        endGpuPass();
+        stageMs[STAGE_PRESENT] += presentZone.end();
 
         // === Render hotbar ===
+        ProfileZone hotbarZone(frameStageNames[STAGE_HOTBAR]);
+        beginGpuPass(profiler, GPU_HOTBAR);
         glUseProgram(uiShaderProgram);
         
         // Create orthographic projection for UI
@@ -645,16 +4843,60 @@ int main(){
             glUniform1i(glGetUniformLocation(uiShaderProgram, "uIsSelected"), i == selectedHotbarSlot);
             glDrawArrays(GL_TRIANGLES, 0, 6);
         }
+
+        if(profiler.overlay) drawProfilerOverlay(profiler, uiShaderProgram, uiVBO, screenHeight);
+        endGpuPass();
+        stageMs[STAGE_HOTBAR] += hotbarZone.end();
+        endProfiledFrame(profiler, stageMs);
         
         glEnable(GL_DEPTH_TEST);
+
+        // Culling counters in the title bar, refreshed once a second
+        if (currentFrame - lastStatsTime >= 1.0f) {
+            lastStatsTime = currentFrame;
+            std::string title = "Mini FPS Game - view distance " + std::to_string(viewDistance) +
+                                ", meshes drawn " + std::to_string(cullStats.drawn) +
+                                ", frustum culled " + std::to_string(cullStats.frustumCulled) +
+                                ", distance culled " + std::to_string(cullStats.distanceCulled) +
+                                ", occluded " + std::to_string(cullStats.occlusionCulled) +
+                                (occlusionCulling ? "" : " (off)") +
+                                ", prefetch hits " + std::to_string(prefetcher.hits) + "/" +
+                                std::to_string(prefetcher.hits + prefetcher.late);
+            glfwSetWindowTitle(window, title.c_str());
+        }
+
+        recordFrame(deltaTime);
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
+    if (replaying) checkReplay(replay, worldStateHash());
+    else if (inputRecorder.isOpen()) inputRecorder.close(worldStateHash());
     
-    // Save chunks before exit
+    // Save chunks before exit; the journal is only dropped once they are all on disk
+    stopMeshWorkers();
+    stopWorldClient();
+    stopChunkStreaming();
+    // Saves that failed in the background get a last try, before any newer
+    // copy of the same chunk
+    bool saved = !journalBacklog;
+    for (auto& [key, snapshot] : streamer.savingChunks) saved = saveChunk(*snapshot) && saved;
     for (auto& [key, chunk] : loadedChunks) {
-        if (chunk.dirty) saveChunk(chunk);
+        if (chunk.dirty) saved = saveChunk(chunk) && saved;
+        destroyChunkMesh(chunk);
+    }
+    for (auto& [key, chunk] : chunkCache.entries) {
+        if (chunk.dirty) saved = saveChunk(chunk) && saved;
+    }
+    destroyLodTiles();
+    destroyMeshArena();
+    editJournal.close();
+    if (saved) {
+        std::error_code ec;
+        std::filesystem::remove(rotatedJournalPath(), ec);
+        std::filesystem::remove(journalPath(), ec);
     }
+    if (replaying) endReplay(replay);
+    endWorldClient();
     
     glDeleteVertexArrays(1,&VAO);
     glDeleteBuffers(1,&VBO);
@@ -663,11 +4905,13 @@ int main(){
     glDeleteVertexArrays(1,&uiVAO);
     glDeleteBuffers(1,&uiVBO);
     glDeleteProgram(shaderProgram);
+    glDeleteProgram(instanceShaderProgram);
     glDeleteProgram(crosshairShaderProgram);
     glDeleteProgram(uiShaderProgram);
     glDeleteFramebuffers(1, &framebuffer);
     glDeleteTextures(1, &colorTexture);
     glDeleteRenderbuffers(1, &depthBuffer);
+    destroyFrameProfiler(profiler);
     glfwTerminate();
     return 0;
 }
@@ -0,0 +1,156 @@
+#pragma once
+// Scoped CPU timers. Every thread records finished zones into its own ring
+// buffer, so recording never takes a lock; the rings can be dumped as a
+// Chrome trace (chrome://tracing, Perfetto). A thread's ring goes away with
+// the thread. No GL in here, GPU timings are fed in from the renderer
+// through a named pseudo-thread.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+const size_t PROFILE_RING_SIZE = 16384;  // zones kept per thread
+
+struct ProfileEvent {
+    const char* name = nullptr;  // must be a string literal or otherwise outlive the profiler
+    int64_t startNs = 0;
+    int64_t endNs = 0;
+};
+
+// A ring entry. Fields are atomic so the trace dump can read them while the
+// owner overwrites them; see writeChromeTrace for how torn reads are caught.
+struct ProfileSlot {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<int64_t> startNs{0};
+    std::atomic<int64_t> endNs{0};
+};
+
+struct ProfileThread {
+    uint32_t id = 0;
+    std::string name;
+    std::unique_ptr<ProfileSlot[]> ring{new ProfileSlot[PROFILE_RING_SIZE]};
+    std::atomic<uint64_t> written{0};  // total events ever recorded
+};
+
+inline std::mutex profileThreadsMutex;
+inline std::vector<std::unique_ptr<ProfileThread>> profileThreads;
+inline uint32_t profileNextThreadId = 1;
+
+inline int64_t profileNow() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+// Creates a ring not tied to the calling thread (e.g. for GPU timings).
+// Only one thread may record into it.
+inline ProfileThread* profileNamedThread(const std::string& name) {
+    std::lock_guard<std::mutex> lock(profileThreadsMutex);
+    profileThreads.push_back(std::make_unique<ProfileThread>());
+    ProfileThread* thread = profileThreads.back().get();
+    thread->id = profileNextThreadId++;
+    thread->name = name;
+    return thread;
+}
+
+// Unregisters and frees a ring; its zones leave the trace with it
+inline void profileReleaseThread(ProfileThread* thread) {
+    std::lock_guard<std::mutex> lock(profileThreadsMutex);
+    profileThreads.erase(std::remove_if(profileThreads.begin(), profileThreads.end(),
+                                        [&](const std::unique_ptr<ProfileThread>& t) { return t.get() == thread; }),
+                         profileThreads.end());
+}
+
+// The calling thread's ring, registered on first use and released when the
+// thread exits
+inline ProfileThread& profileThread() {
+    struct Owner {
+        ProfileThread* thread = profileNamedThread("thread");
+        ~Owner() { profileReleaseThread(thread); }
+    };
+    thread_local Owner owner;
+    return *owner.thread;
+}
+
+inline void profileSetThreadName(const std::string& name) {
+    ProfileThread& thread = profileThread();
+    std::lock_guard<std::mutex> lock(profileThreadsMutex);
+    thread.name = name;
+}
+
+inline void profileRecord(ProfileThread& thread, const char* name, int64_t startNs, int64_t endNs) {
+    uint64_t index = thread.written.load(std::memory_order_relaxed);
+    // A reader that sees any of the stores below also sees written == index
+    std::atomic_thread_fence(std::memory_order_release);
+    ProfileSlot& slot = thread.ring[index % PROFILE_RING_SIZE];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.startNs.store(startNs, std::memory_order_relaxed);
+    slot.endNs.store(endNs, std::memory_order_relaxed);
+    thread.written.store(index + 1, std::memory_order_release);
+}
+
+// Times the enclosing scope, or up to end() if that comes first
+struct ProfileZone {
+    const char* name;
+    int64_t startNs;
+    bool open = true;
+
+    explicit ProfileZone(const char* name) : name(name), startNs(profileNow()) {}
+    ~ProfileZone() { end(); }
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+    // Returns the zone's duration in milliseconds
+    double end() {
+        if (!open) return 0.0;
+        open = false;
+        int64_t endNs = profileNow();
+        profileRecord(profileThread(), name, startNs, endNs);
+        return (endNs - startNs) / 1e6;
+    }
+};
+
+// Writes every zone still held in the rings in Chrome's trace event format.
+// Threads keep recording meanwhile; entries that may have been overwritten
+// during the copy, or were being overwritten, are dropped. Holding the
+// registry lock keeps the rings from being freed under the copy.
+inline bool writeChromeTrace(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) return false;
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    std::lock_guard<std::mutex> lock(profileThreadsMutex);
+    for (auto& thread : profileThreads) {
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->id
+            << ",\"args\":{\"name\":\"" << thread->name << "\"}}";
+        first = false;
+
+        uint64_t before = thread->written.load(std::memory_order_acquire);
+        uint64_t begin = before > PROFILE_RING_SIZE ? before - PROFILE_RING_SIZE : 0;
+        std::vector<ProfileEvent> events;
+        for (uint64_t i = begin; i < before; i++) {
+            const ProfileSlot& slot = thread->ring[i % PROFILE_RING_SIZE];
+            events.push_back({slot.name.load(std::memory_order_relaxed), slot.startNs.load(std::memory_order_relaxed),
+                              slot.endNs.load(std::memory_order_relaxed)});
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // Event i is intact unless event i + PROFILE_RING_SIZE was written,
+        // or being written, meanwhile
+        uint64_t after = thread->written.load(std::memory_order_relaxed);
+        size_t skip = after >= begin + PROFILE_RING_SIZE ? std::min<size_t>(after - begin - PROFILE_RING_SIZE + 1, events.size()) : 0;
+
+        out.precision(3);
+        out << std::fixed;
+        for (size_t i = skip; i < events.size(); i++) {
+            const ProfileEvent& e = events[i];
+            out << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+                << ",\"ts\":" << e.startNs / 1e3 << ",\"dur\":" << (e.endNs - e.startNs) / 1e3 << "}";
+        }
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
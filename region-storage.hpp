@@ -0,0 +1,554 @@
+#pragma once
+// Region-file world storage. 32x32 chunks share one file holding an offset
+// table followed by compressed chunk payloads. No GL or engine types in
+// here so offline tools can use it too.
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
+#include <filesystem>
+#include <fstream>
+
+const int REGION_SIZE = 32;  // chunks per region side
+const int REGION_CHUNKS = REGION_SIZE * REGION_SIZE;
+const uint32_t REGION_MAGIC = 0x47525042;  // "BPRG"
+const uint32_t REGION_VERSION = 1;
+const uint8_t CHUNK_PAYLOAD_VERSION = 1;
+const int STORED_CHUNK_SIZE = 16;  // must match CHUNK_SIZE in the game
+// Distinct colors a chunk can hold; the game's block ids keep a bit for
+// the dynamic flag. Further colors become the nearest one held.
+const size_t MAX_PALETTE_COLORS = 0x7FFF;
+
+// --------------------
+// Stored data
+// --------------------
+struct StoredBlock {
+    uint8_t x = 0, z = 0;  // chunk-local
+    int32_t y = 0;
+    uint32_t color = 0;    // 0xRRGGBB
+    bool rotate = false;
+};
+
+struct StoredChunk {
+    int cx = 0, cz = 0;
+    std::vector<StoredBlock> blocks;
+};
+
+// Key of chunk (cx, cz) in maps of chunks: cx in the high half
+inline int64_t chunkKey(int cx, int cz) {
+    return (int64_t)((uint64_t)(uint32_t)cx << 32 | (uint32_t)cz);
+}
+
+// Colors are kept at 8 bits per channel, the precision they end up at in
+// the framebuffer anyway
+inline uint32_t packColor(float r, float g, float b) {
+    auto channel = [](float v) { return (uint32_t)std::clamp((int)(v * 255.0f + 0.5f), 0, 255); };
+    return channel(r) << 16 | channel(g) << 8 | channel(b);
+}
+
+inline void unpackColor(uint32_t color, float& r, float& g, float& b) {
+    r = ((color >> 16) & 0xFF) / 255.0f;
+    g = ((color >> 8) & 0xFF) / 255.0f;
+    b = (color & 0xFF) / 255.0f;
+}
+
+inline int floorDivStorage(int a, int b) {
+    return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+// --------------------
+// Byte helpers
+// --------------------
+inline void putU32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int i = 0; i < 4; i++) out.push_back((v >> (8 * i)) & 0xFF);
+}
+
+inline uint32_t getU32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+inline void putVarint(std::vector<uint8_t>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(v);
+}
+
+inline bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (p >= end) return false;
+        uint8_t b = *p++;
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+inline uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+inline int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+inline uint32_t fnv1a(const uint8_t* data, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// --------------------
+// LZ4 block compression
+// --------------------
+// Greedy single-pass compressor producing the standard LZ4 block format
+// (token, literals, 16-bit offset, match length).
+inline void lz4WriteLength(std::vector<uint8_t>& out, size_t len) {
+    while (len >= 255) {
+        out.push_back(255);
+        len -= 255;
+    }
+    out.push_back((uint8_t)len);
+}
+
+inline void lz4EmitSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t litLen,
+                            size_t offset, size_t matchLen) {
+    uint8_t token = (uint8_t)(std::min<size_t>(litLen, 15) << 4);
+    if (matchLen) token |= (uint8_t)std::min<size_t>(matchLen - 4, 15);
+    out.push_back(token);
+    if (litLen >= 15) lz4WriteLength(out, litLen - 15);
+    out.insert(out.end(), literals, literals + litLen);
+    if (!matchLen) return;
+    out.push_back(offset & 0xFF);
+    out.push_back(offset >> 8);
+    if (matchLen - 4 >= 15) lz4WriteLength(out, matchLen - 4 - 15);
+}
+
+inline std::vector<uint8_t> lz4Compress(const std::vector<uint8_t>& in) {
+    const int HASH_BITS = 12;
+    const size_t MIN_MATCH = 4, LAST_LITERALS = 5, MATCH_LIMIT = 12;
+    std::vector<uint8_t> out;
+    out.reserve(in.size() / 2 + 16);
+    const uint8_t* src = in.data();
+    size_t n = in.size(), anchor = 0, i = 0;
+    std::vector<int64_t> table((size_t)1 << HASH_BITS, -1);
+    auto read32 = [&](size_t p) { uint32_t v; std::memcpy(&v, src + p, 4); return v; };
+    auto hash = [&](uint32_t v) { return (v * 2654435761u) >> (32 - HASH_BITS); };
+
+    while (n >= MATCH_LIMIT && i + MATCH_LIMIT <= n) {
+        uint32_t seq = read32(i);
+        uint32_t h = hash(seq);
+        int64_t ref = table[h];
+        table[h] = (int64_t)i;
+        if (ref < 0 || i - ref > 0xFFFF || read32(ref) != seq) {
+            i++;
+            continue;
+        }
+        size_t len = MIN_MATCH;
+        while (i + len < n - LAST_LITERALS && src[ref + len] == src[i + len]) len++;
+        lz4EmitSequence(out, src + anchor, i - anchor, i - ref, len);
+        i += len;
+        anchor = i;
+    }
+    lz4EmitSequence(out, src + anchor, n - anchor, 0, 0);
+    return out;
+}
+
+// Returns false on malformed input or if the output would not be rawSize bytes
+inline bool lz4Decompress(const uint8_t* src, size_t n, size_t rawSize, std::vector<uint8_t>& out) {
+    out.clear();
+    out.reserve(rawSize);
+    const uint8_t* p = src;
+    const uint8_t* end = src + n;
+    auto readLength = [&](size_t& len) {
+        uint8_t b;
+        do {
+            if (p >= end) return false;
+            b = *p++;
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+    while (p < end) {
+        uint8_t token = *p++;
+        size_t litLen = token >> 4;
+        if (litLen == 15 && !readLength(litLen)) return false;
+        if ((size_t)(end - p) < litLen || out.size() + litLen > rawSize) return false;
+        out.insert(out.end(), p, p + litLen);
+        p += litLen;
+        if (p == end) break;  // last sequence has no match
+        if (end - p < 2) return false;
+        size_t offset = p[0] | (size_t)p[1] << 8;
+        p += 2;
+        size_t matchLen = token & 0x0F;
+        if (matchLen == 15 && !readLength(matchLen)) return false;
+        matchLen += 4;
+        if (offset == 0 || offset > out.size() || out.size() + matchLen > rawSize) return false;
+        size_t from = out.size() - offset;
+        for (size_t k = 0; k < matchLen; k++) out.push_back(out[from + k]);  // may overlap
+    }
+    return out.size() == rawSize;
+}
+
+// Index of the palette color closest to color (0xRRGGBB)
+inline size_t nearestPaletteColor(const std::vector<uint32_t>& palette, uint32_t color) {
+    size_t best = 0;
+    int bestDistance = INT32_MAX;
+    for (size_t i = 0; i < palette.size(); i++) {
+        int dr = (int)(palette[i] >> 16 & 0xFF) - (int)(color >> 16 & 0xFF);
+        int dg = (int)(palette[i] >> 8 & 0xFF) - (int)(color >> 8 & 0xFF);
+        int db = (int)(palette[i] & 0xFF) - (int)(color & 0xFF);
+        int distance = dr * dr + dg * dg + db * db;
+        if (distance < bestDistance) {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+// --------------------
+// Chunk payload
+// --------------------
+// version, palette (RGB8), then blocks sorted by y/z/x as
+// zigzag(dy), packed xz, palette index << 1 | rotate
+inline std::vector<uint8_t> encodeChunkPayload(const StoredChunk& chunk) {
+    std::vector<StoredBlock> blocks = chunk.blocks;
+    std::sort(blocks.begin(), blocks.end(), [](const StoredBlock& a, const StoredBlock& b) {
+        if (a.y != b.y) return a.y < b.y;
+        if (a.z != b.z) return a.z < b.z;
+        return a.x < b.x;
+    });
+    std::vector<uint32_t> palette;
+    std::unordered_map<uint32_t, uint32_t> paletteIndex;
+    for (auto& b : blocks) {
+        if (paletteIndex.count(b.color)) continue;
+        if (palette.size() < MAX_PALETTE_COLORS) {
+            paletteIndex[b.color] = (uint32_t)palette.size();
+            palette.push_back(b.color);
+        } else {
+            paletteIndex[b.color] = (uint32_t)nearestPaletteColor(palette, b.color);
+        }
+    }
+
+    std::vector<uint8_t> out;
+    out.push_back(CHUNK_PAYLOAD_VERSION);
+    putVarint(out, palette.size());
+    for (uint32_t c : palette) {
+        out.push_back(c >> 16);
+        out.push_back(c >> 8);
+        out.push_back(c);
+    }
+    putVarint(out, blocks.size());
+    int32_t prevY = 0;
+    for (auto& b : blocks) {
+        putVarint(out, zigzag(b.y - prevY));
+        prevY = b.y;
+        out.push_back(b.x | b.z << 4);
+        putVarint(out, paletteIndex[b.color] << 1 | (b.rotate ? 1 : 0));
+    }
+    return out;
+}
+
+inline bool decodeChunkPayload(const std::vector<uint8_t>& data, StoredChunk& chunk) {
+    const uint8_t* p = data.data();
+    const uint8_t* end = p + data.size();
+    if (p >= end || *p++ != CHUNK_PAYLOAD_VERSION) return false;
+    uint32_t paletteSize;
+    if (!getVarint(p, end, paletteSize) || paletteSize > MAX_PALETTE_COLORS ||
+        (size_t)(end - p) < (size_t)paletteSize * 3) {
+        return false;
+    }
+    std::vector<uint32_t> palette(paletteSize);
+    for (auto& c : palette) {
+        c = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+        p += 3;
+    }
+    uint32_t count;
+    if (!getVarint(p, end, count) || count > (uint32_t)(end - p)) return false;
+    chunk.blocks.resize(count);
+    int32_t y = 0;
+    for (auto& b : chunk.blocks) {
+        uint32_t dy, packed;
+        if (!getVarint(p, end, dy) || p >= end) return false;
+        y += unzigzag(dy);
+        uint8_t xz = *p++;
+        if (!getVarint(p, end, packed) || (packed >> 1) >= paletteSize) return false;
+        b.x = xz & 0x0F;
+        b.z = xz >> 4;
+        b.y = y;
+        b.color = palette[packed >> 1];
+        b.rotate = packed & 1;
+    }
+    return p == end;
+}
+
+// --------------------
+// Region files
+// --------------------
+// File layout: magic, version, then REGION_CHUNKS table entries, then
+// payloads. A rewritten chunk goes to free space, a gap left by a chunk
+// that moved or the end of the file, and its entry is switched over only
+// once the payload is written, so the old copy stays valid until then.
+struct RegionEntry {
+    uint32_t offset = 0, capacity = 0, size = 0, rawSize = 0, checksum = 0;
+};
+
+const size_t REGION_ENTRY_BYTES = 20;
+const size_t REGION_HEADER_BYTES = 8 + REGION_CHUNKS * REGION_ENTRY_BYTES;
+
+struct RegionFile {
+    FILE* file = nullptr;
+    RegionEntry entries[REGION_CHUNKS];
+    uint64_t end = REGION_HEADER_BYTES;
+};
+
+inline std::string regionFilename(const std::string& dir, int rx, int rz) {
+    return dir + "/region_" + std::to_string(rx) + "_" + std::to_string(rz) + ".region";
+}
+
+inline int regionSlot(int cx, int cz) {
+    int lx = cx - floorDivStorage(cx, REGION_SIZE) * REGION_SIZE;
+    int lz = cz - floorDivStorage(cz, REGION_SIZE) * REGION_SIZE;
+    return lz * REGION_SIZE + lx;
+}
+
+// Reads the header of an open region file. Returns false if it is not a
+// region file of a version we understand.
+inline bool readRegionHeader(FILE* file, RegionFile& region) {
+    std::vector<uint8_t> header(REGION_HEADER_BYTES);
+    std::fseek(file, 0, SEEK_SET);
+    if (std::fread(header.data(), 1, header.size(), file) != header.size()) return false;
+    if (getU32(&header[0]) != REGION_MAGIC || getU32(&header[4]) != REGION_VERSION) return false;
+    for (int i = 0; i < REGION_CHUNKS; i++) {
+        const uint8_t* e = &header[8 + i * REGION_ENTRY_BYTES];
+        RegionEntry& entry = region.entries[i];
+        entry.offset = getU32(e);
+        entry.capacity = getU32(e + 4);
+        entry.size = getU32(e + 8);
+        entry.rawSize = getU32(e + 12);
+        entry.checksum = getU32(e + 16);
+    }
+    std::fseek(file, 0, SEEK_END);
+    region.end = std::max<uint64_t>(std::ftell(file), REGION_HEADER_BYTES);
+    return true;
+}
+
+inline bool writeRegionEntry(FILE* file, int slot, const RegionEntry& entry) {
+    std::vector<uint8_t> bytes;
+    putU32(bytes, entry.offset);
+    putU32(bytes, entry.capacity);
+    putU32(bytes, entry.size);
+    putU32(bytes, entry.rawSize);
+    putU32(bytes, entry.checksum);
+    std::fseek(file, 8 + slot * REGION_ENTRY_BYTES, SEEK_SET);
+    return std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+}
+
+// Start of the first run of at least `bytes` that no entry's payload uses
+inline uint64_t freeRegionSpace(const RegionFile& region, size_t bytes) {
+    std::vector<std::pair<uint64_t, uint64_t>> used;
+    for (const RegionEntry& e : region.entries) {
+        if (e.size) used.push_back({e.offset, (uint64_t)e.offset + std::max(e.size, e.capacity)});
+    }
+    std::sort(used.begin(), used.end());
+    uint64_t at = REGION_HEADER_BYTES;
+    for (auto& [start, end] : used) {
+        if (start >= at + bytes) break;
+        at = std::max(at, end);
+    }
+    return at;
+}
+
+// Reads and decodes one entry. Returns false if the data is damaged.
+inline bool readRegionChunk(FILE* file, const RegionEntry& entry, StoredChunk& chunk) {
+    std::vector<uint8_t> compressed(entry.size), raw;
+    std::fseek(file, entry.offset, SEEK_SET);
+    if (std::fread(compressed.data(), 1, compressed.size(), file) != compressed.size()) return false;
+    if (fnv1a(compressed.data(), compressed.size()) != entry.checksum) return false;
+    if (!lz4Decompress(compressed.data(), compressed.size(), entry.rawSize, raw)) return false;
+    return decodeChunkPayload(raw, chunk);
+}
+
+// Thread-safe store over every region file in a directory. Files stay open
+// for the lifetime of the store.
+class RegionStore {
+public:
+    explicit RegionStore(std::string dir) : dir(std::move(dir)) {}
+    ~RegionStore() { close(); }
+
+    const std::string& directory() const { return dir; }
+
+    // Closes every open region file and switches to another directory
+    void reopen(const std::string& newDir) {
+        std::lock_guard<std::mutex> lock(mutex);
+        close();
+        dir = newDir;
+    }
+
+    // False if the chunk was never saved or its data is damaged
+    bool load(int cx, int cz, StoredChunk& chunk) {
+        std::lock_guard<std::mutex> lock(mutex);
+        RegionFile* region = openRegion(cx, cz, false);
+        if (!region) return false;
+        const RegionEntry& entry = region->entries[regionSlot(cx, cz)];
+        if (!entry.size) return false;
+        chunk.cx = cx;
+        chunk.cz = cz;
+        if (readRegionChunk(region->file, entry, chunk)) return true;
+        std::fprintf(stderr, "Damaged chunk %d,%d in %s\n", cx, cz, dir.c_str());
+        chunk.blocks.clear();
+        return false;
+    }
+
+    // False if the chunk could not be written (disk full and the like);
+    // whatever was stored for it before is then still there
+    bool save(const StoredChunk& chunk) {
+        std::vector<uint8_t> raw = encodeChunkPayload(chunk);
+        std::vector<uint8_t> compressed = lz4Compress(raw);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        RegionFile* region = openRegion(chunk.cx, chunk.cz, true);
+        if (!region) return false;
+        int slot = regionSlot(chunk.cx, chunk.cz);
+        RegionEntry entry;
+        // Leave some room so the space fits the chunk after small edits too
+        entry.capacity = (uint32_t)((compressed.size() + compressed.size() / 4 + 63) & ~(size_t)63);
+        uint64_t offset = freeRegionSpace(*region, entry.capacity);
+        if (offset + entry.capacity > UINT32_MAX) return false;
+        entry.offset = (uint32_t)offset;
+        entry.size = compressed.size();
+        entry.rawSize = raw.size();
+        entry.checksum = fnv1a(compressed.data(), compressed.size());
+        // Payload first, away from the old one, so a crash before the entry
+        // is written leaves the old entry valid
+        compressed.resize(entry.capacity, 0);
+        std::fseek(region->file, entry.offset, SEEK_SET);
+        if (std::fwrite(compressed.data(), 1, compressed.size(), region->file) != compressed.size() ||
+            std::fflush(region->file) != 0) {
+            return false;
+        }
+        region->end = std::max(region->end, offset + entry.capacity);
+        if (!writeRegionEntry(region->file, slot, entry) || std::fflush(region->file) != 0) return false;
+        region->entries[slot] = entry;
+        return true;
+    }
+
+private:
+    void close() {
+        for (auto& [key, region] : regions) {
+            if (region.file) std::fclose(region.file);
+        }
+        regions.clear();
+    }
+
+    RegionFile* openRegion(int cx, int cz, bool create) {
+        int rx = floorDivStorage(cx, REGION_SIZE), rz = floorDivStorage(cz, REGION_SIZE);
+        int64_t key = (int64_t)((uint64_t)(uint32_t)rx << 32 | (uint32_t)rz);
+        auto it = regions.find(key);
+        if (it != regions.end()) return &it->second;
+
+        std::string path = regionFilename(dir, rx, rz);
+        FILE* file = std::fopen(path.c_str(), "r+b");
+        RegionFile region;
+        if (file && !readRegionHeader(file, region)) {
+            std::fprintf(stderr, "Ignoring unreadable region file %s\n", path.c_str());
+            std::fclose(file);
+            return nullptr;
+        }
+        if (!file) {
+            if (!create) return nullptr;
+            std::filesystem::create_directories(dir);
+            file = std::fopen(path.c_str(), "w+b");
+            if (!file) return nullptr;
+            std::vector<uint8_t> header;
+            putU32(header, REGION_MAGIC);
+            putU32(header, REGION_VERSION);
+            header.resize(REGION_HEADER_BYTES, 0);
+            if (std::fwrite(header.data(), 1, header.size(), file) != header.size() || std::fflush(file) != 0) {
+                std::fclose(file);
+                std::error_code ec;
+                std::filesystem::remove(path, ec);
+                return nullptr;
+            }
+        }
+        region.file = file;
+        return &regions.emplace(key, region).first->second;
+    }
+
+    std::string dir;
+    std::mutex mutex;
+    std::unordered_map<int64_t, RegionFile> regions;
+};
+
+// --------------------
+// Legacy chunk_X_Z.bin files
+// --------------------
+// size_t count, then count x (float pos[3], float color[3]) in world space
+inline bool parseLegacyChunkName(const std::string& name, int& cx, int& cz) {
+    return std::sscanf(name.c_str(), "chunk_%d_%d.bin", &cx, &cz) == 2 &&
+           name == "chunk_" + std::to_string(cx) + "_" + std::to_string(cz) + ".bin";
+}
+
+// Converts a legacy file, dropping cubes that do not belong to the chunk.
+// Returns false if the file is truncated or its count is implausible.
+inline bool readLegacyChunk(const std::string& path, int cx, int cz, StoredChunk& chunk) {
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+    if (!ifs) return false;
+    uint64_t fileSize = ifs.tellg();
+    ifs.seekg(0);
+    uint64_t n = 0;
+    if (!ifs.read((char*)&n, sizeof(uint64_t))) return false;
+    const uint64_t record = 6 * sizeof(float);
+    if (n > (fileSize - sizeof(uint64_t)) / record) return false;
+    chunk.cx = cx;
+    chunk.cz = cz;
+    chunk.blocks.clear();
+    for (uint64_t i = 0; i < n; i++) {
+        float v[6];
+        if (!ifs.read((char*)v, sizeof(v))) return false;
+        int x = (int)std::floor(v[0] + 0.5f), y = (int)std::floor(v[1] + 0.5f), z = (int)std::floor(v[2] + 0.5f);
+        if (floorDivStorage(x, STORED_CHUNK_SIZE) != cx || floorDivStorage(z, STORED_CHUNK_SIZE) != cz) continue;
+        StoredBlock b;
+        b.x = x - cx * STORED_CHUNK_SIZE;
+        b.z = z - cz * STORED_CHUNK_SIZE;
+        b.y = y;
+        b.color = packColor(v[3], v[4], v[5]);
+        chunk.blocks.push_back(b);
+    }
+    return true;
+}
+
+// Moves every legacy chunk file in dir into the region store. A legacy file
+// is deleted only after its chunk reads back from the store. Returns the
+// number of files migrated.
+inline int migrateLegacyChunks(RegionStore& store) {
+    namespace fs = std::filesystem;
+    int migrated = 0;
+    std::error_code ec;
+    if (!fs::is_directory(store.directory(), ec)) return 0;
+    std::vector<fs::path> legacyFiles;
+    for (auto& file : fs::directory_iterator(store.directory(), ec)) legacyFiles.push_back(file.path());
+    for (auto& path : legacyFiles) {
+        int cx, cz;
+        std::string name = path.filename().string();
+        if (!parseLegacyChunkName(name, cx, cz)) continue;
+        StoredChunk chunk, check;
+        if (!readLegacyChunk(path.string(), cx, cz, chunk)) {
+            std::fprintf(stderr, "Skipping unreadable legacy chunk %s\n", name.c_str());
+            continue;
+        }
+        if (!store.save(chunk) || !store.load(cx, cz, check) || check.blocks.size() != chunk.blocks.size()) {
+            std::fprintf(stderr, "Could not migrate %s\n", name.c_str());
+            continue;
+        }
+        fs::remove(path, ec);
+        migrated++;
+    }
+    return migrated;
+}
@@ -0,0 +1,148 @@
+#pragma once
+// Procedural terrain. A chunk is a pure function of (seed, cx, cz): no
+// global state, so any worker thread can generate any chunk, and chunks
+// nobody edited are regenerated instead of stored.
+#include "region-storage.hpp"
+#include <random>
+
+const int TERRAIN_BASE_HEIGHT = 8;
+const float TERRAIN_AMPLITUDE = 28.0f;
+const float TERRAIN_FREQUENCY = 1.0f / 128.0f;  // of the lowest octave
+const int TERRAIN_OCTAVES = 5;
+const int TERRAIN_MIN_DEPTH = 3;  // layers under the surface on flat ground
+
+// Heights are computed for the chunk plus a one column border so cliffs at
+// the chunk edge know how far down to fill
+const int TERRAIN_SPAN = STORED_CHUNK_SIZE + 2;
+
+// --------------------
+// Noise kernels
+// --------------------
+// Everything below is branch-free integer and float math over a row of
+// TERRAIN_SPAN columns so the compiler vectorises the inner loops.
+inline uint32_t terrainHash(uint32_t seed, int32_t x, int32_t z) {
+    uint32_t h = seed ^ ((uint32_t)x * 0x27D4EB2Du) ^ ((uint32_t)z * 0x165667B1u);
+    h ^= h >> 15; h *= 0x85EBCA6Bu;
+    h ^= h >> 13; h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// Dot product of the corner's pseudo-random gradient with the offset (dx, dz)
+inline float terrainGradient(uint32_t h, float dx, float dz) {
+    float gx = (float)(h & 0xFFFF) * (1.0f / 32768.0f) - 1.0f;
+    float gz = (float)(h >> 16) * (1.0f / 32768.0f) - 1.0f;
+    return gx * dx + gz * dz;
+}
+
+// Adds one octave of 2D gradient noise at (xs[i] * freq, z * freq) to out[i]
+inline void addNoiseRow(uint32_t seed, const float* xs, float z, float freq, float amplitude, float* out) {
+    float fz = z * freq;
+    int32_t z0 = (int32_t)fz;
+    z0 -= (fz < (float)z0);
+    float tz = fz - (float)z0;
+    float uz = tz * tz * tz * (tz * (tz * 6.0f - 15.0f) + 10.0f);
+    for (int i = 0; i < TERRAIN_SPAN; i++) {
+        float fx = xs[i] * freq;
+        int32_t x0 = (int32_t)fx;
+        x0 -= (fx < (float)x0);
+        float tx = fx - (float)x0;
+        float ux = tx * tx * tx * (tx * (tx * 6.0f - 15.0f) + 10.0f);
+        float n00 = terrainGradient(terrainHash(seed, x0, z0), tx, tz);
+        float n10 = terrainGradient(terrainHash(seed, x0 + 1, z0), tx - 1.0f, tz);
+        float n01 = terrainGradient(terrainHash(seed, x0, z0 + 1), tx, tz - 1.0f);
+        float n11 = terrainGradient(terrainHash(seed, x0 + 1, z0 + 1), tx - 1.0f, tz - 1.0f);
+        float nx0 = n00 + (n10 - n00) * ux;
+        float nx1 = n01 + (n11 - n01) * ux;
+        out[i] += (nx0 + (nx1 - nx0) * uz) * amplitude;
+    }
+}
+
+// Surface heights for columns [-1, STORED_CHUNK_SIZE] of chunk (cx, cz),
+// indexed [z + 1][x + 1]
+inline void terrainHeights(uint64_t seed, int cx, int cz, int heights[TERRAIN_SPAN][TERRAIN_SPAN]) {
+    uint32_t baseSeed = (uint32_t)(seed ^ (seed >> 32));
+    float xs[TERRAIN_SPAN];
+    for (int i = 0; i < TERRAIN_SPAN; i++) xs[i] = (float)(cx * STORED_CHUNK_SIZE + i - 1) + 0.5f;
+    for (int row = 0; row < TERRAIN_SPAN; row++) {
+        float z = (float)(cz * STORED_CHUNK_SIZE + row - 1) + 0.5f;
+        float sum[TERRAIN_SPAN] = {};
+        float freq = TERRAIN_FREQUENCY, amplitude = 1.0f;
+        for (int octave = 0; octave < TERRAIN_OCTAVES; octave++) {
+            addNoiseRow(baseSeed + octave * 0x9E3779B9u, xs, z, freq, amplitude, sum);
+            freq *= 2.0f;
+            amplitude *= 0.5f;
+        }
+        for (int i = 0; i < TERRAIN_SPAN; i++) {
+            float h = sum[i] * TERRAIN_AMPLITUDE;
+            int32_t floored = (int32_t)h;
+            floored -= (h < (float)floored);
+            heights[row][i] = TERRAIN_BASE_HEIGHT + floored;
+        }
+    }
+}
+
+// --------------------
+// Chunk generation
+// --------------------
+// Color band by height, slightly varied per block so flat areas are not one
+// solid color. A handful of shades keeps chunk palettes small.
+inline uint32_t terrainColor(uint64_t seed, int x, int y, int z, int surfaceY) {
+    float r, g, b;
+    int aboveBase = surfaceY - TERRAIN_BASE_HEIGHT;
+    if (y < surfaceY && aboveBase < 8) { r = 0.45f; g = 0.32f; b = 0.20f; }  // dirt
+    else if (y < surfaceY)             { r = 0.50f; g = 0.50f; b = 0.52f; }  // rock
+    else if (aboveBase < -6)           { r = 0.85f; g = 0.80f; b = 0.55f; }  // sand
+    else if (aboveBase < 8)            { r = 0.30f; g = 0.65f; b = 0.25f; }  // grass
+    else if (aboveBase < 14)           { r = 0.50f; g = 0.50f; b = 0.52f; }  // rock
+    else                               { r = 0.92f; g = 0.93f; b = 0.95f; }  // snow
+    float shade = 0.88f + 0.04f * (terrainHash((uint32_t)seed, x * 31 + y, z) & 3);
+    return packColor(r * shade, g * shade, b * shade);
+}
+
+// Fills `chunk` with the terrain of chunk (cx, cz). Each column is solid from
+// its surface down to TERRAIN_MIN_DEPTH layers, or further where a lower
+// neighbour column would otherwise leave a hole in the cliff face.
+inline void generateTerrainChunk(uint64_t seed, int cx, int cz, StoredChunk& chunk) {
+    int heights[TERRAIN_SPAN][TERRAIN_SPAN];
+    terrainHeights(seed, cx, cz, heights);
+    chunk.cx = cx;
+    chunk.cz = cz;
+    chunk.blocks.clear();
+    for (int z = 0; z < STORED_CHUNK_SIZE; z++) {
+        for (int x = 0; x < STORED_CHUNK_SIZE; x++) {
+            int top = heights[z + 1][x + 1];
+            int lowestNeighbour = std::min({heights[z][x + 1], heights[z + 2][x + 1],
+                                            heights[z + 1][x], heights[z + 1][x + 2]});
+            int bottom = std::min(top - TERRAIN_MIN_DEPTH + 1, lowestNeighbour + 1);
+            int worldX = cx * STORED_CHUNK_SIZE + x, worldZ = cz * STORED_CHUNK_SIZE + z;
+            for (int y = bottom; y <= top; y++) {
+                StoredBlock b;
+                b.x = x;
+                b.z = z;
+                b.y = y;
+                b.color = terrainColor(seed, worldX, y, worldZ, top);
+                chunk.blocks.push_back(b);
+            }
+        }
+    }
+}
+
+// --------------------
+// World seed
+// --------------------
+// Kept next to the region files. A new world gets a random seed that is
+// written on first use so unedited chunks come back the same next session.
+inline uint64_t loadWorldSeed(const std::string& dir) {
+    std::string path = dir + "/world.seed";
+    uint64_t seed = 0;
+    std::ifstream in(path);
+    if (in >> seed) return seed;
+    std::random_device rd;
+    seed = ((uint64_t)rd() << 32) | rd();
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    std::ofstream out(path);
+    out << seed << "\n";
+    return seed;
+}
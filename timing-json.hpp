@@ -0,0 +1,23 @@
+#pragma once
+// Timing summaries in the JSON reports of the game's --bench and headless
+// replay and of world-server's load test, so they all read the same.
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include <vector>
+
+// Writes {"p50","p99","mean","max"} of the samples, in their unit
+// (nearest-rank percentiles)
+inline void writeTimingJson(std::ostream& out, std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) {
+        if (samples.empty()) return 0.0;
+        size_t rank = (size_t)std::ceil(p * samples.size());
+        return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+    };
+    double sum = 0;
+    for (double v : samples) sum += v;
+    out << "{\"p50\": " << percentile(0.50) << ", \"p99\": " << percentile(0.99)
+        << ", \"mean\": " << (samples.empty() ? 0.0 : sum / samples.size())
+        << ", \"max\": " << (samples.empty() ? 0.0 : samples.back()) << "}";
+}
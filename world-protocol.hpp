@@ -0,0 +1,480 @@
+#pragma once
+// Messages between world-server and the game's client mode (`--connect`).
+// Every message is a u32 length, a type byte and a payload of mostly
+// varints. A chunk is sent whole once, LZ4-compressed like it is stored;
+// after that a subscriber only gets deltas: the edits that took the chunk
+// from the version it holds to the next ones, a few bytes per edit.
+#include "region-storage.hpp"
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX  // keep std::min and std::max usable
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET SocketHandle;
+typedef WSAPOLLFD PollEntry;
+const SocketHandle NO_SOCKET = INVALID_SOCKET;
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int SocketHandle;
+typedef pollfd PollEntry;
+const SocketHandle NO_SOCKET = -1;
+#endif
+
+const uint32_t PROTOCOL_VERSION = 1;
+const uint16_t DEFAULT_SERVER_PORT = 25580;
+const uint32_t MAX_MESSAGE_SIZE = 1u << 22;
+// Heights a server accepts edits at
+const int32_t EDIT_MIN_Y = -512, EDIT_MAX_Y = 1023;
+
+enum MessageType : uint8_t {
+    // Client to server
+    MSG_HELLO = 1,        // protocol version
+    MSG_SUBSCRIBE = 2,    // cx, cz, version held (0 if none)
+    MSG_UNSUBSCRIBE = 3,  // cx, cz
+    MSG_EDIT = 4,         // seq, edit in world coordinates
+    // Server to client
+    MSG_WELCOME = 16,     // world seed
+    MSG_CHUNK = 17,       // cx, cz, version, raw size, compressed chunk payload
+    MSG_CHUNK_DELTA = 18, // cx, cz, version it applies to, edits (each adds one to the version)
+    MSG_EDIT_ACK = 19,    // seq, accepted; if rejected, the block actually at the edit's position
+};
+
+struct BlockEdit {
+    bool place = false;  // otherwise a break
+    bool rotate = false;
+    int32_t x = 0, y = 0, z = 0;
+    uint32_t color = 0;  // 0xRRGGBB, places only
+};
+
+struct Message {
+    MessageType type = MSG_HELLO;
+    uint32_t seq = 0;      // MSG_EDIT, MSG_EDIT_ACK
+    uint32_t version = 0;  // held (subscribe), of the chunk, or the one a delta starts from
+    int32_t cx = 0, cz = 0;
+    uint64_t seed = 0;
+    bool accepted = false;
+    BlockEdit edit;                // MSG_EDIT; after a rejected MSG_EDIT_ACK, what is there
+    std::vector<BlockEdit> edits;  // MSG_CHUNK_DELTA, world coordinates
+    StoredChunk chunk;             // MSG_CHUNK
+};
+
+// --------------------
+// Encoding
+// --------------------
+inline void putSigned(std::vector<uint8_t>& out, int32_t v) { putVarint(out, zigzag(v)); }
+
+// Starts a message; endMessage fills in its length
+inline size_t beginMessage(std::vector<uint8_t>& out, MessageType type) {
+    size_t start = out.size();
+    putU32(out, 0);
+    out.push_back(type);
+    return start;
+}
+
+inline void endMessage(std::vector<uint8_t>& out, size_t start) {
+    uint32_t size = (uint32_t)(out.size() - start - 4);
+    for (int i = 0; i < 4; i++) out[start + i] = (uint8_t)(size >> (8 * i));
+}
+
+inline void encodeHello(std::vector<uint8_t>& out) {
+    size_t start = beginMessage(out, MSG_HELLO);
+    putVarint(out, PROTOCOL_VERSION);
+    endMessage(out, start);
+}
+
+inline void encodeSubscribe(std::vector<uint8_t>& out, int cx, int cz, uint32_t version) {
+    size_t start = beginMessage(out, MSG_SUBSCRIBE);
+    putSigned(out, cx);
+    putSigned(out, cz);
+    putVarint(out, version);
+    endMessage(out, start);
+}
+
+inline void encodeUnsubscribe(std::vector<uint8_t>& out, int cx, int cz) {
+    size_t start = beginMessage(out, MSG_UNSUBSCRIBE);
+    putSigned(out, cx);
+    putSigned(out, cz);
+    endMessage(out, start);
+}
+
+// Flags byte of an edit: place, rotate, and for deltas whether a color follows
+const uint8_t EDIT_PLACE = 1, EDIT_ROTATE = 2, EDIT_COLOR = 4;
+
+inline void putColor(std::vector<uint8_t>& out, uint32_t color) {
+    out.push_back((uint8_t)(color >> 16));
+    out.push_back((uint8_t)(color >> 8));
+    out.push_back((uint8_t)color);
+}
+
+inline void encodeEdit(std::vector<uint8_t>& out, uint32_t seq, const BlockEdit& edit) {
+    size_t start = beginMessage(out, MSG_EDIT);
+    putVarint(out, seq);
+    out.push_back((edit.place ? EDIT_PLACE : 0) | (edit.rotate ? EDIT_ROTATE : 0));
+    putSigned(out, edit.x);
+    putSigned(out, edit.y);
+    putSigned(out, edit.z);
+    if (edit.place) putColor(out, edit.color);
+    endMessage(out, start);
+}
+
+inline void encodeWelcome(std::vector<uint8_t>& out, uint64_t seed) {
+    size_t start = beginMessage(out, MSG_WELCOME);
+    putU32(out, (uint32_t)seed);
+    putU32(out, (uint32_t)(seed >> 32));
+    endMessage(out, start);
+}
+
+inline void encodeChunk(std::vector<uint8_t>& out, const StoredChunk& chunk, uint32_t version) {
+    std::vector<uint8_t> raw = encodeChunkPayload(chunk);
+    std::vector<uint8_t> compressed = lz4Compress(raw);
+    size_t start = beginMessage(out, MSG_CHUNK);
+    putSigned(out, chunk.cx);
+    putSigned(out, chunk.cz);
+    putVarint(out, version);
+    putVarint(out, (uint32_t)raw.size());
+    out.insert(out.end(), compressed.begin(), compressed.end());
+    endMessage(out, start);
+}
+
+// Edits are chunk-local: packed x/z, y as a difference from the previous
+// edit's, and the color only when it differs from the previous place's
+inline void encodeChunkDelta(std::vector<uint8_t>& out, int cx, int cz, uint32_t version,
+                             const BlockEdit* edits, size_t count) {
+    size_t start = beginMessage(out, MSG_CHUNK_DELTA);
+    putSigned(out, cx);
+    putSigned(out, cz);
+    putVarint(out, version);
+    putVarint(out, (uint32_t)count);
+    int32_t lastY = 0;
+    uint32_t lastColor = 0;
+    for (size_t i = 0; i < count; i++) {
+        const BlockEdit& edit = edits[i];
+        bool newColor = edit.place && edit.color != lastColor;
+        out.push_back((edit.place ? EDIT_PLACE : 0) | (edit.rotate ? EDIT_ROTATE : 0) | (newColor ? EDIT_COLOR : 0));
+        out.push_back((uint8_t)((edit.x - cx * STORED_CHUNK_SIZE) | (edit.z - cz * STORED_CHUNK_SIZE) << 4));
+        putSigned(out, edit.y - lastY);
+        if (newColor) putColor(out, edit.color);
+        lastY = edit.y;
+        if (edit.place) lastColor = edit.color;
+    }
+    endMessage(out, start);
+}
+
+inline void encodeEditAck(std::vector<uint8_t>& out, uint32_t seq, bool accepted, const BlockEdit& actual) {
+    size_t start = beginMessage(out, MSG_EDIT_ACK);
+    putVarint(out, seq);
+    out.push_back(accepted);
+    if (!accepted) {
+        out.push_back((actual.place ? EDIT_PLACE : 0) | (actual.rotate ? EDIT_ROTATE : 0));
+        putSigned(out, actual.x);
+        putSigned(out, actual.y);
+        putSigned(out, actual.z);
+        if (actual.place) putColor(out, actual.color);
+    }
+    endMessage(out, start);
+}
+
+// --------------------
+// Decoding
+// --------------------
+struct MessageReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+
+    uint32_t varint() {
+        uint32_t v = 0;
+        ok = ok && getVarint(p, end, v);
+        return v;
+    }
+    int32_t signedVarint() { return unzigzag(varint()); }
+    uint8_t byte() {
+        if (p >= end) ok = false;
+        return ok ? *p++ : 0;
+    }
+    uint32_t u32() {
+        if (end - p < 4) ok = false;
+        if (!ok) return 0;
+        uint32_t v = getU32(p);
+        p += 4;
+        return v;
+    }
+    uint32_t color() {
+        uint32_t r = byte(), g = byte(), b = byte();
+        return r << 16 | g << 8 | b;
+    }
+};
+
+// One message without its length prefix. False if it is malformed.
+inline bool decodeMessage(const uint8_t* data, size_t size, Message& msg) {
+    MessageReader in{data, data + size};
+    msg.type = (MessageType)in.byte();
+    auto readEdit = [&](BlockEdit& edit) {
+        uint8_t flags = in.byte();
+        edit.place = flags & EDIT_PLACE;
+        edit.rotate = flags & EDIT_ROTATE;
+        edit.x = in.signedVarint();
+        edit.y = in.signedVarint();
+        edit.z = in.signedVarint();
+        edit.color = edit.place ? in.color() : 0;
+    };
+    switch (msg.type) {
+    case MSG_HELLO:
+        msg.version = in.varint();
+        break;
+    case MSG_SUBSCRIBE:
+    case MSG_UNSUBSCRIBE:
+        msg.cx = in.signedVarint();
+        msg.cz = in.signedVarint();
+        if (msg.type == MSG_SUBSCRIBE) msg.version = in.varint();
+        break;
+    case MSG_EDIT:
+        msg.seq = in.varint();
+        readEdit(msg.edit);
+        break;
+    case MSG_WELCOME:
+        msg.seed = in.u32();
+        msg.seed |= (uint64_t)in.u32() << 32;
+        break;
+    case MSG_CHUNK: {
+        msg.cx = in.signedVarint();
+        msg.cz = in.signedVarint();
+        msg.version = in.varint();
+        uint32_t rawSize = in.varint();
+        std::vector<uint8_t> raw;
+        if (!in.ok || rawSize > MAX_MESSAGE_SIZE || !lz4Decompress(in.p, in.end - in.p, rawSize, raw) ||
+            !decodeChunkPayload(raw, msg.chunk)) {
+            return false;
+        }
+        msg.chunk.cx = msg.cx;
+        msg.chunk.cz = msg.cz;
+        in.p = in.end;
+        break;
+    }
+    case MSG_CHUNK_DELTA: {
+        msg.cx = in.signedVarint();
+        msg.cz = in.signedVarint();
+        msg.version = in.varint();
+        uint32_t count = in.varint();
+        if (!in.ok || count > size) return false;
+        msg.edits.resize(count);
+        int32_t lastY = 0;
+        uint32_t lastColor = 0;
+        for (auto& edit : msg.edits) {
+            uint8_t flags = in.byte();
+            uint8_t xz = in.byte();
+            edit.place = flags & EDIT_PLACE;
+            edit.rotate = flags & EDIT_ROTATE;
+            edit.x = msg.cx * STORED_CHUNK_SIZE + (xz & 15);
+            edit.z = msg.cz * STORED_CHUNK_SIZE + (xz >> 4);
+            edit.y = lastY + in.signedVarint();
+            if (flags & EDIT_COLOR) lastColor = in.color();
+            edit.color = edit.place ? lastColor : 0;
+            lastY = edit.y;
+        }
+        break;
+    }
+    case MSG_EDIT_ACK:
+        msg.seq = in.varint();
+        msg.accepted = in.byte();
+        if (!msg.accepted) readEdit(msg.edit);
+        break;
+    default:
+        return false;
+    }
+    return in.ok && in.p == in.end;
+}
+
+// --------------------
+// Sockets
+// --------------------
+inline bool startSockets() {
+#ifdef _WIN32
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+    return true;
+#endif
+}
+
+inline void closeSocket(SocketHandle socket) {
+    if (socket == NO_SOCKET) return;
+#ifdef _WIN32
+    closesocket(socket);
+#else
+    ::close(socket);
+#endif
+}
+
+inline bool socketWouldBlock() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+// Non-blocking, and without Nagle's delay: edits are small and latency
+// matters more than packet count
+inline void configureSocket(SocketHandle socket) {
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(socket, FIONBIO, &nonBlocking);
+#else
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    int noDelay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+}
+
+inline int pollSockets(PollEntry* entries, size_t count, int timeoutMs) {
+#ifdef _WIN32
+    return WSAPoll(entries, (ULONG)count, timeoutMs);
+#else
+    return poll(entries, count, timeoutMs);
+#endif
+}
+
+// Listens on `port` (0 picks a free one, see boundPort), on loopback only
+// unless anyAddress is set
+inline SocketHandle listenOn(uint16_t port, bool anyAddress) {
+    SocketHandle listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == NO_SOCKET) return NO_SOCKET;
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(anyAddress ? INADDR_ANY : INADDR_LOOPBACK);
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        closeSocket(listener);
+        return NO_SOCKET;
+    }
+    configureSocket(listener);
+    return listener;
+}
+
+inline uint16_t boundPort(SocketHandle socket) {
+    sockaddr_in addr = {};
+    socklen_t size = sizeof(addr);
+    if (getsockname(socket, (sockaddr*)&addr, &size) != 0) return 0;
+    return ntohs(addr.sin_port);
+}
+
+// Blocking connect; the socket is configured non-blocking afterwards
+inline SocketHandle connectTo(const std::string& host, uint16_t port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0) return NO_SOCKET;
+    SocketHandle result = NO_SOCKET;
+    for (addrinfo* a = found; a && result == NO_SOCKET; a = a->ai_next) {
+        SocketHandle s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (s == NO_SOCKET) continue;
+        if (connect(s, a->ai_addr, (int)a->ai_addrlen) == 0) result = s;
+        else closeSocket(s);
+    }
+    freeaddrinfo(found);
+    if (result != NO_SOCKET) configureSocket(result);
+    return result;
+}
+
+// Splits "host[:port]"
+inline void parseServerAddress(const std::string& address, std::string& host, uint16_t& port) {
+    size_t colon = address.rfind(':');
+    host = colon == std::string::npos ? address : address.substr(0, colon);
+    port = colon == std::string::npos ? DEFAULT_SERVER_PORT : (uint16_t)std::atoi(address.c_str() + colon + 1);
+    if (host.empty()) host = "127.0.0.1";
+}
+
+// A non-blocking socket with its unparsed input and unsent output
+class Connection {
+public:
+    SocketHandle socket = NO_SOCKET;
+    std::vector<uint8_t> in, out;
+    uint64_t bytesSent = 0, bytesReceived = 0;
+    uint32_t lastMessageBytes = 0;  // of the message nextMessage took last, with its length
+
+    bool isOpen() const { return socket != NO_SOCKET; }
+
+    void close() {
+        closeSocket(socket);
+        socket = NO_SOCKET;
+    }
+
+    // Reads whatever has arrived. False once the peer is gone.
+    bool receive() {
+        uint8_t buffer[16384];
+        while (true) {
+            int n = recv(socket, (char*)buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                in.insert(in.end(), buffer, buffer + n);
+                bytesReceived += n;
+                continue;
+            }
+            return n < 0 && socketWouldBlock();
+        }
+    }
+
+    // Writes as much output as the socket takes. False on error.
+    bool send() {
+        size_t sent = 0;
+        while (sent < out.size()) {
+            int n = ::send(socket, (const char*)out.data() + sent, (int)(out.size() - sent), sendFlags());
+            if (n <= 0) {
+                if (n < 0 && socketWouldBlock()) break;
+                return false;
+            }
+            sent += n;
+        }
+        out.erase(out.begin(), out.begin() + sent);
+        bytesSent += sent;
+        return true;
+    }
+
+    // Takes the next complete message out of the input. False if there is
+    // none yet; `broken` is set if the input is not a valid message.
+    bool nextMessage(Message& msg, bool& broken) {
+        broken = false;
+        if (in.size() - readAt < 4) return compact(false);
+        uint32_t size = getU32(in.data() + readAt);
+        if (size == 0 || size > MAX_MESSAGE_SIZE) {
+            broken = true;
+            return false;
+        }
+        if (in.size() - readAt - 4 < size) return compact(false);
+        msg = Message();
+        broken = !decodeMessage(in.data() + readAt + 4, size, msg);
+        lastMessageBytes = 4 + size;
+        readAt += 4 + size;
+        return !broken;
+    }
+
+private:
+    // Drops consumed input once a batch of messages has been read
+    bool compact(bool result) {
+        in.erase(in.begin(), in.begin() + readAt);
+        readAt = 0;
+        return result;
+    }
+
+    static int sendFlags() {
+#ifdef MSG_NOSIGNAL
+        return MSG_NOSIGNAL;  // a closed peer is an error, not SIGPIPE
+#else
+        return 0;
+#endif
+    }
+
+    size_t readAt = 0;
+};
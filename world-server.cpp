@@ -0,0 +1,719 @@
+// Authoritative world for the game's client mode (`app --connect
+// host[:port]`). The server owns a world directory (region files,
+// world.seed and an edit journal, laid out as the game keeps them) and
+// validates every edit. It sends each client the chunks it subscribes to,
+// then deltas of the edits made to them. Do not open the same directory in
+// the game while the server runs.
+//
+//   world-server [dir] [--port N] [--any-address]
+//       serves dir (default: chunks) until interrupted, on loopback only
+//       unless --any-address is given
+//   world-server load-test [--clients N] [--seconds S] [--edit-rate R]
+//                          [--radius R] [--out file.json]
+//       serves a scratch world on a loopback port to N simulated clients.
+//       Each subscribes to the chunks within R of a home near the others'
+//       and makes R edits a second. Bandwidth and edit latency are reported
+//       as JSON.
+#include "world-protocol.hpp"
+#include "terrain.hpp"
+#include "edit-journal.hpp"
+#include "timing-json.hpp"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <unordered_set>
+
+// Edits kept per chunk so a client coming back to a chunk it had gets a
+// delta instead of the whole chunk
+const size_t CHUNK_HISTORY_EDITS = 256;
+const double SERVER_SAVE_INTERVAL_MS = 10000;
+// Unsubscribed chunks kept in memory after the periodic save
+const size_t SERVER_IDLE_CHUNKS = 4096;
+// Versions of evicted chunks remembered, so a client still holding one
+// gets an empty delta when it comes back
+const size_t SERVER_EVICTED_VERSIONS = 65536;
+const int SERVER_POLL_MS = 5;
+// A client this far behind on reading is dropped
+const size_t MAX_CLIENT_BACKLOG = 16u << 20;
+
+double millisecondsSince(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+// --------------------
+// Server state
+// --------------------
+struct ServerChunk {
+    StoredChunk stored;
+    std::unordered_map<uint32_t, uint32_t> index;  // blockKey -> position in stored.blocks
+    // Every accepted edit adds one. Clients hold the version of their copy.
+    uint32_t version = 1;
+    std::vector<BlockEdit> history;  // the edits that made the last history.size() versions
+    std::vector<BlockEdit> pending;  // accepted, not yet sent to subscribers
+    std::unordered_set<int> subscribers;
+    bool dirty = false;
+    uint64_t lastUse = 0;  // WorldServer::uses when last subscribed to, left or edited
+};
+
+struct ServerClient {
+    int id = 0;
+    Connection connection;
+    bool greeted = false;
+    bool closed = false;
+    std::unordered_set<int64_t> subscribed;
+};
+
+struct ServerStats {
+    uint64_t editsAccepted = 0, editsRejected = 0;
+    uint64_t fullSyncs = 0, deltaSyncs = 0;  // answers to subscribes
+    uint64_t deltasSent = 0;
+    uint64_t bytesSent = 0, bytesReceived = 0;
+};
+
+struct WorldServer {
+    RegionStore store{"chunks"};
+    uint64_t seed = 0;
+    EditJournal journal;
+    SocketHandle listener = NO_SOCKET;
+    std::unordered_map<int64_t, ServerChunk> chunks;
+    // So versions never repeat: an evicted chunk comes back at the version
+    // it left with, or at firstVersion, which is past every version
+    // forgotten since
+    std::unordered_map<int64_t, uint32_t> evictedVersions;
+    uint32_t firstVersion = 1;
+    uint64_t uses = 0;
+    std::vector<int64_t> chunksWithPending;
+    std::vector<std::unique_ptr<ServerClient>> clients;
+    int nextClientId = 1;
+    ServerStats stats;
+};
+
+WorldServer server;
+
+uint32_t blockKey(int lx, int y, int lz) {
+    return (uint32_t)y << 8 | lz << 4 | lx;
+}
+
+std::string serverJournalPath() { return server.store.directory() + "/edits.journal"; }
+
+ServerChunk& serverChunk(int cx, int cz) {
+    int64_t key = chunkKey(cx, cz);
+    auto it = server.chunks.find(key);
+    if (it != server.chunks.end()) {
+        it->second.lastUse = ++server.uses;
+        return it->second;
+    }
+    ServerChunk& chunk = server.chunks[key];
+    chunk.lastUse = ++server.uses;
+    if (!server.store.load(cx, cz, chunk.stored)) generateTerrainChunk(server.seed, cx, cz, chunk.stored);
+    chunk.stored.cx = cx;
+    chunk.stored.cz = cz;
+    // Later blocks at the same position win, as when the game loads a chunk
+    std::vector<StoredBlock> blocks;
+    blocks.swap(chunk.stored.blocks);
+    for (auto& b : blocks) {
+        auto [slot, added] = chunk.index.emplace(blockKey(b.x, b.y, b.z), (uint32_t)chunk.stored.blocks.size());
+        if (added) chunk.stored.blocks.push_back(b);
+        else chunk.stored.blocks[slot->second] = b;
+    }
+    chunk.version = server.firstVersion;
+    auto evicted = server.evictedVersions.find(key);
+    if (evicted != server.evictedVersions.end()) {
+        chunk.version = evicted->second;
+        server.evictedVersions.erase(evicted);
+    }
+    return chunk;
+}
+
+// Applies an edit already known to be valid
+void applyServerEdit(ServerChunk& chunk, const BlockEdit& edit) {
+    int lx = edit.x - chunk.stored.cx * STORED_CHUNK_SIZE, lz = edit.z - chunk.stored.cz * STORED_CHUNK_SIZE;
+    uint32_t key = blockKey(lx, edit.y, lz);
+    auto it = chunk.index.find(key);
+    if (edit.place) {
+        StoredBlock b;
+        b.x = lx;
+        b.z = lz;
+        b.y = edit.y;
+        b.color = edit.color;
+        b.rotate = edit.rotate;
+        if (it != chunk.index.end()) {
+            chunk.stored.blocks[it->second] = b;
+        } else {
+            chunk.index[key] = (uint32_t)chunk.stored.blocks.size();
+            chunk.stored.blocks.push_back(b);
+        }
+    } else if (it != chunk.index.end()) {
+        // Swap with the last block to keep the array dense
+        uint32_t at = it->second;
+        chunk.index.erase(it);
+        if (at + 1 != chunk.stored.blocks.size()) {
+            StoredBlock& last = chunk.stored.blocks.back();
+            chunk.stored.blocks[at] = last;
+            chunk.index[blockKey(last.x, last.y, last.z)] = at;
+        }
+        chunk.stored.blocks.pop_back();
+    }
+    chunk.dirty = true;
+}
+
+// --------------------
+// Storage
+// --------------------
+// Saves every dirty chunk. The journal restarts empty once they all are.
+// Returns false if any failed to save.
+bool saveDirtyChunks() {
+    bool saved = true;
+    for (auto& [key, chunk] : server.chunks) {
+        if (!chunk.dirty) continue;
+        if (server.store.save(chunk.stored)) chunk.dirty = false;
+        else saved = false;
+    }
+    if (saved && server.journal.size()) server.journal.open(serverJournalPath());
+    return saved;
+}
+
+// Drops saved chunks nobody subscribes to, least recently used first,
+// down to SERVER_IDLE_CHUNKS
+void evictIdleChunks() {
+    std::vector<std::pair<uint64_t, int64_t>> idle;  // lastUse, key
+    for (auto& [key, chunk] : server.chunks) {
+        if (chunk.subscribers.empty() && chunk.pending.empty() && !chunk.dirty) idle.push_back({chunk.lastUse, key});
+    }
+    if (idle.size() <= SERVER_IDLE_CHUNKS) return;
+    size_t evict = idle.size() - SERVER_IDLE_CHUNKS;
+    std::nth_element(idle.begin(), idle.begin() + evict, idle.end());
+    for (size_t i = 0; i < evict; i++) {
+        server.evictedVersions[idle[i].second] = server.chunks[idle[i].second].version;
+        server.chunks.erase(idle[i].second);
+    }
+    // Forget them all at once when there are too many; every chunk loaded
+    // from now on starts past the versions forgotten
+    if (server.evictedVersions.size() > SERVER_EVICTED_VERSIONS) {
+        for (auto& [key, version] : server.evictedVersions) server.firstVersion = std::max(server.firstVersion, version + 1);
+        server.evictedVersions.clear();
+    }
+}
+
+// Applies the journal a crashed session left behind and saves the result.
+// Returns false, keeping the journals, if they hold volume edits (which
+// only the game can replay) or the replayed chunks cannot be saved.
+bool replayServerJournal(const std::string& dir, int& replayed) {
+    std::vector<JournalEdit> edits;
+    readJournal(serverJournalPath() + ".old", edits);  // the game's rotated journal
+    readJournal(serverJournalPath(), edits);
+    replayed = 0;
+    for (auto& edit : edits) {
+        if (isBoxEdit(edit.op)) {
+            std::cerr << dir << " has volume edits in its journal; open it in the game once to recover them" << std::endl;
+            return false;
+        }
+        BlockEdit block;
+        block.place = edit.op == JournalEdit::Place;
+        block.rotate = edit.rotate;
+        block.x = edit.x; block.y = edit.y; block.z = edit.z;
+        block.color = edit.color;
+        applyServerEdit(serverChunk(floorDivStorage(edit.x, STORED_CHUNK_SIZE), floorDivStorage(edit.z, STORED_CHUNK_SIZE)), block);
+        replayed++;
+    }
+    if (!saveDirtyChunks()) {
+        std::cerr << "Cannot save the edits recovered from " << serverJournalPath() << std::endl;
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::remove(serverJournalPath() + ".old", ec);
+    return true;
+}
+
+bool openServer(const std::string& dir, uint16_t port, bool anyAddress) {
+    server.store.reopen(dir);
+    int migrated = migrateLegacyChunks(server.store);
+    if (migrated) std::cout << "Migrated " << migrated << " chunk files to region storage" << std::endl;
+    server.seed = loadWorldSeed(dir);
+    int replayed = 0;
+    if (!replayServerJournal(dir, replayed)) return false;
+    if (replayed) std::cout << "Recovered " << replayed << " edits from the journal" << std::endl;
+    server.chunks.clear();
+    if (!server.journal.open(serverJournalPath())) {
+        std::cerr << "Cannot open " << serverJournalPath() << std::endl;
+        return false;
+    }
+    if (!startSockets()) return false;
+    server.listener = listenOn(port, anyAddress);
+    if (server.listener == NO_SOCKET) {
+        std::cerr << "Cannot listen on port " << port << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// --------------------
+// Messages
+// --------------------
+// Sends each subscriber of a chunk the edits accepted since its last delta
+void flushChunkDelta(ServerChunk& chunk) {
+    if (chunk.pending.empty()) return;
+    std::vector<uint8_t> delta;
+    encodeChunkDelta(delta, chunk.stored.cx, chunk.stored.cz, chunk.version - (uint32_t)chunk.pending.size(),
+                     chunk.pending.data(), chunk.pending.size());
+    for (auto& client : server.clients) {
+        if (!chunk.subscribers.count(client->id)) continue;
+        client->connection.out.insert(client->connection.out.end(), delta.begin(), delta.end());
+        server.stats.deltasSent++;
+    }
+    chunk.pending.clear();
+}
+
+void flushDeltas() {
+    for (int64_t key : server.chunksWithPending) {
+        auto it = server.chunks.find(key);
+        if (it != server.chunks.end()) flushChunkDelta(it->second);
+    }
+    server.chunksWithPending.clear();
+}
+
+// Brings the client's copy from `held` (0 if none) to the current version
+void subscribe(ServerClient& client, int cx, int cz, uint32_t held) {
+    int64_t key = chunkKey(cx, cz);
+    ServerChunk& chunk = serverChunk(cx, cz);
+    flushChunkDelta(chunk);  // others first, so the copy below is current
+    chunk.subscribers.insert(client.id);
+    client.subscribed.insert(key);
+    uint32_t missing = chunk.version - held;
+    if (held && held <= chunk.version && missing <= chunk.history.size()) {
+        encodeChunkDelta(client.connection.out, cx, cz, held, chunk.history.data() + chunk.history.size() - missing, missing);
+        server.stats.deltaSyncs++;
+    } else {
+        encodeChunk(client.connection.out, chunk.stored, chunk.version);
+        server.stats.fullSyncs++;
+    }
+}
+
+void unsubscribe(ServerClient& client, int64_t key) {
+    client.subscribed.erase(key);
+    auto it = server.chunks.find(key);
+    if (it == server.chunks.end()) return;
+    it->second.subscribers.erase(client.id);
+    it->second.lastUse = ++server.uses;
+}
+
+// Accepts a place into an empty cell or a break of an existing block, in a
+// chunk the client subscribes to. Either way the client learns the result;
+// after a rejection, also what is actually there.
+void handleEdit(ServerClient& client, uint32_t seq, const BlockEdit& edit) {
+    int cx = floorDivStorage(edit.x, STORED_CHUNK_SIZE), cz = floorDivStorage(edit.z, STORED_CHUNK_SIZE);
+    int64_t key = chunkKey(cx, cz);
+    BlockEdit actual;
+    actual.x = edit.x; actual.y = edit.y; actual.z = edit.z;
+    bool accepted = client.subscribed.count(key) && edit.y >= EDIT_MIN_Y && edit.y <= EDIT_MAX_Y;
+    if (accepted) {
+        ServerChunk& chunk = serverChunk(cx, cz);
+        auto it = chunk.index.find(blockKey(edit.x - cx * STORED_CHUNK_SIZE, edit.y, edit.z - cz * STORED_CHUNK_SIZE));
+        bool occupied = it != chunk.index.end();
+        accepted = edit.place != occupied;
+        if (accepted) {
+            applyServerEdit(chunk, edit);
+            chunk.version++;
+            chunk.history.push_back(edit);
+            if (chunk.history.size() > 2 * CHUNK_HISTORY_EDITS) {
+                chunk.history.erase(chunk.history.begin(), chunk.history.end() - CHUNK_HISTORY_EDITS);
+            }
+            if (chunk.pending.empty()) server.chunksWithPending.push_back(key);
+            chunk.pending.push_back(edit);
+
+            JournalEdit logged;
+            logged.op = edit.place ? JournalEdit::Place : JournalEdit::Break;
+            logged.rotate = edit.rotate;
+            logged.x = edit.x; logged.y = edit.y; logged.z = edit.z;
+            logged.color = edit.color;
+            server.journal.append(logged);
+        } else if (occupied) {
+            const StoredBlock& b = chunk.stored.blocks[it->second];
+            actual.place = true;
+            actual.rotate = b.rotate;
+            actual.color = b.color;
+        }
+    }
+    (accepted ? server.stats.editsAccepted : server.stats.editsRejected)++;
+    encodeEditAck(client.connection.out, seq, accepted, actual);
+}
+
+void handleMessage(ServerClient& client, const Message& msg) {
+    if (!client.greeted) {
+        client.greeted = msg.type == MSG_HELLO && msg.version == PROTOCOL_VERSION;
+        if (client.greeted) encodeWelcome(client.connection.out, server.seed);
+        else client.closed = true;
+        return;
+    }
+    switch (msg.type) {
+    case MSG_SUBSCRIBE: subscribe(client, msg.cx, msg.cz, msg.version); break;
+    case MSG_UNSUBSCRIBE: unsubscribe(client, chunkKey(msg.cx, msg.cz)); break;
+    case MSG_EDIT: handleEdit(client, msg.seq, msg.edit); break;
+    default: client.closed = true; break;
+    }
+}
+
+// --------------------
+// Serving
+// --------------------
+void acceptClients() {
+    while (true) {
+        SocketHandle socket = accept(server.listener, nullptr, nullptr);
+        if (socket == NO_SOCKET) return;
+        configureSocket(socket);
+        auto client = std::make_unique<ServerClient>();
+        client->id = server.nextClientId++;
+        client->connection.socket = socket;
+        server.clients.push_back(std::move(client));
+    }
+}
+
+void dropClosedClients() {
+    for (auto& client : server.clients) {
+        if (!client->closed) continue;
+        for (int64_t key : std::vector<int64_t>(client->subscribed.begin(), client->subscribed.end())) unsubscribe(*client, key);
+        server.stats.bytesSent += client->connection.bytesSent;
+        server.stats.bytesReceived += client->connection.bytesReceived;
+        client->connection.close();
+    }
+    server.clients.erase(std::remove_if(server.clients.begin(), server.clients.end(),
+                                        [](const std::unique_ptr<ServerClient>& c) { return c->closed; }),
+                         server.clients.end());
+}
+
+// Serves until `stop` is set, then saves and disconnects everyone
+void serveWorld(const std::atomic<bool>& stop) {
+    auto lastSave = std::chrono::steady_clock::now();
+    std::vector<PollEntry> entries;
+    while (!stop) {
+        entries.assign(1 + server.clients.size(), PollEntry());
+        entries[0].fd = server.listener;
+        entries[0].events = POLLIN;
+        for (size_t i = 0; i < server.clients.size(); i++) {
+            entries[i + 1].fd = server.clients[i]->connection.socket;
+            entries[i + 1].events = POLLIN | (server.clients[i]->connection.out.empty() ? 0 : POLLOUT);
+        }
+        pollSockets(entries.data(), entries.size(), SERVER_POLL_MS);
+
+        size_t polled = server.clients.size();
+        if (entries[0].revents & POLLIN) acceptClients();
+        for (size_t i = 0; i < polled; i++) {
+            ServerClient& client = *server.clients[i];
+            if (!(entries[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            if (!client.connection.receive()) client.closed = true;
+            Message msg;
+            bool broken = false;
+            while (!client.closed && client.connection.nextMessage(msg, broken)) handleMessage(client, msg);
+            if (broken) client.closed = true;
+        }
+        flushDeltas();
+        server.journal.flush();
+        for (auto& client : server.clients) {
+            if (client->closed || client->connection.out.empty()) continue;
+            if (!client->connection.send() || client->connection.out.size() > MAX_CLIENT_BACKLOG) client->closed = true;
+        }
+        dropClosedClients();
+
+        if (millisecondsSince(lastSave) >= SERVER_SAVE_INTERVAL_MS) {
+            saveDirtyChunks();
+            evictIdleChunks();
+            lastSave = std::chrono::steady_clock::now();
+        }
+    }
+    for (auto& client : server.clients) client->closed = true;
+    dropClosedClients();
+    saveDirtyChunks();
+    server.journal.close();
+    if (server.journal.size() == 0) {
+        std::error_code ec;
+        std::filesystem::remove(serverJournalPath(), ec);
+    }
+    closeSocket(server.listener);
+    server.listener = NO_SOCKET;
+}
+
+// --------------------
+// Load test
+// --------------------
+struct LoadTestOptions {
+    int clients = 32;
+    double seconds = 10;
+    double editRate = 10;  // per client per second
+    int radius = 2;        // subscribed chunks around each home
+    std::string out;
+};
+
+const uint64_t LOAD_TEST_SEED = 1;
+const double LOAD_TEST_RESUBSCRIBE_MS = 1000;  // each client leaves and rejoins one chunk this often
+const double LOAD_TEST_TIMEOUT_MS = 10000;
+
+struct LoadClientStats {
+    bool failed = false;
+    double syncMs = 0;  // until every subscribed chunk had arrived
+    int editsSent = 0, accepted = 0, rejected = 0;
+    std::vector<double> latencyMs;  // edit sent to its ack received
+    uint64_t bytesSent = 0, bytesReceived = 0;
+    int chunks = 0, deltas = 0, deltaEdits = 0;
+    uint64_t chunkBytes = 0, deltaBytes = 0;
+    int resyncs = 0, resyncsByDelta = 0;
+    int versionGaps = 0;  // deltas starting past the version held; should stay 0
+};
+
+// One simulated player: homes are spread over a few chunks so neighbours
+// see (and sometimes collide with) each other's edits. Places go in the
+// air above the terrain and breaks take back the client's own blocks.
+void runLoadClient(int index, const LoadTestOptions& options, uint16_t port, LoadClientStats& stats) {
+    Connection connection;
+    connection.socket = connectTo("127.0.0.1", port);
+    if (!connection.isOpen()) {
+        stats.failed = true;
+        return;
+    }
+    std::mt19937 rng(index + 1);
+    int homeX = index % 4 - 2, homeZ = index / 4 % 4 - 2;
+    std::vector<int64_t> chunkKeys;
+    encodeHello(connection.out);
+    for (int dx = -options.radius; dx <= options.radius; dx++) {
+        for (int dz = -options.radius; dz <= options.radius; dz++) {
+            encodeSubscribe(connection.out, homeX + dx, homeZ + dz, 0);
+            chunkKeys.push_back(chunkKey(homeX + dx, homeZ + dz));
+        }
+    }
+
+    std::unordered_map<int64_t, uint32_t> versions;
+    std::unordered_map<uint32_t, std::chrono::steady_clock::time_point> inFlight;
+    std::unordered_map<uint32_t, BlockEdit> sentEdits;
+    std::vector<BlockEdit> placed;
+    std::unordered_set<int64_t> resyncing;
+    uint32_t nextSeq = 1;
+    auto start = std::chrono::steady_clock::now();
+    double editsStartMs = -1, lastResyncMs = 0, nextEditMs = 0;
+    double editInterval = 1000.0 / std::max(0.001, options.editRate);
+
+    while (true) {
+        double nowMs = millisecondsSince(start);
+        bool synced = versions.size() == chunkKeys.size();
+        if (synced && editsStartMs < 0) {
+            editsStartMs = nowMs;
+            stats.syncMs = nowMs;
+            nextEditMs = nowMs + std::uniform_real_distribution<double>(0, editInterval)(rng);
+        }
+        bool editing = editsStartMs >= 0 && nowMs - editsStartMs < options.seconds * 1000;
+        if (editsStartMs < 0 && nowMs > LOAD_TEST_TIMEOUT_MS) {
+            stats.failed = true;
+            break;
+        }
+        if (editsStartMs >= 0 && !editing && (inFlight.empty() || nowMs - editsStartMs > options.seconds * 1000 + LOAD_TEST_TIMEOUT_MS)) break;
+
+        if (editing && nowMs >= nextEditMs) {
+            nextEditMs += editInterval;
+            BlockEdit edit;
+            if (!placed.empty() && rng() % 2) {
+                size_t pick = rng() % placed.size();
+                edit = placed[pick];
+                edit.place = false;
+                placed[pick] = placed.back();
+                placed.pop_back();
+            } else {
+                int64_t key = chunkKeys[rng() % chunkKeys.size()];
+                edit.place = true;
+                edit.rotate = true;
+                edit.x = (int)(key >> 32) * STORED_CHUNK_SIZE + rng() % STORED_CHUNK_SIZE;
+                edit.z = (int)(int32_t)(key & 0xFFFFFFFF) * STORED_CHUNK_SIZE + rng() % STORED_CHUNK_SIZE;
+                edit.y = TERRAIN_BASE_HEIGHT + (int)TERRAIN_AMPLITUDE + 2 + rng() % 8;
+                edit.color = rng() & 0xFFFFFF;
+            }
+            inFlight[nextSeq] = std::chrono::steady_clock::now();
+            sentEdits[nextSeq] = edit;
+            encodeEdit(connection.out, nextSeq++, edit);
+            stats.editsSent++;
+        }
+        if (editing && nowMs - lastResyncMs >= LOAD_TEST_RESUBSCRIBE_MS) {
+            lastResyncMs = nowMs;
+            int64_t key = chunkKeys[rng() % chunkKeys.size()];
+            if (!resyncing.count(key)) {
+                int cx = (int)(key >> 32), cz = (int)(int32_t)(key & 0xFFFFFFFF);
+                encodeUnsubscribe(connection.out, cx, cz);
+                encodeSubscribe(connection.out, cx, cz, versions[key]);
+                resyncing.insert(key);
+                stats.resyncs++;
+            }
+        }
+
+        if (!connection.out.empty() && !connection.send()) {
+            stats.failed = true;
+            break;
+        }
+        PollEntry entry = {};
+        entry.fd = connection.socket;
+        entry.events = POLLIN;
+        double waitMs = editing ? std::max(0.0, nextEditMs - millisecondsSince(start)) : 1;
+        pollSockets(&entry, 1, (int)std::min(waitMs, 5.0));
+        if (!connection.receive()) {
+            stats.failed = true;
+            break;
+        }
+        Message msg;
+        bool broken = false;
+        while (connection.nextMessage(msg, broken)) {
+            int64_t key = chunkKey(msg.cx, msg.cz);
+            if (msg.type == MSG_CHUNK) {
+                versions[key] = msg.version;
+                stats.chunks++;
+                stats.chunkBytes += connection.lastMessageBytes;
+                resyncing.erase(key);
+            } else if (msg.type == MSG_CHUNK_DELTA) {
+                if (resyncing.erase(key)) stats.resyncsByDelta++;
+                // A resync can start before deltas already received
+                if (msg.version > versions[key]) stats.versionGaps++;
+                versions[key] = std::max(versions[key], msg.version + (uint32_t)msg.edits.size());
+                stats.deltas++;
+                stats.deltaEdits += (int)msg.edits.size();
+                stats.deltaBytes += connection.lastMessageBytes;
+            } else if (msg.type == MSG_EDIT_ACK) {
+                auto sent = inFlight.find(msg.seq);
+                if (sent == inFlight.end()) continue;
+                stats.latencyMs.push_back(millisecondsSince(sent->second));
+                inFlight.erase(sent);
+                (msg.accepted ? stats.accepted : stats.rejected)++;
+                if (msg.accepted && sentEdits[msg.seq].place) placed.push_back(sentEdits[msg.seq]);
+                sentEdits.erase(msg.seq);
+            }
+        }
+        if (broken) {
+            stats.failed = true;
+            break;
+        }
+    }
+    stats.bytesSent = connection.bytesSent;
+    stats.bytesReceived = connection.bytesReceived;
+    connection.close();
+}
+
+int runLoadTest(const LoadTestOptions& options) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "world-server-load-test";
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    std::filesystem::create_directories(dir, ec);
+    std::ofstream(dir / "world.seed") << LOAD_TEST_SEED << "\n";
+    if (!openServer(dir.string(), 0, false)) return 1;
+    uint16_t port = boundPort(server.listener);
+
+    std::atomic<bool> stop{false};
+    std::thread serverThread(serveWorld, std::cref(stop));
+    std::vector<LoadClientStats> stats(options.clients);
+    std::vector<std::thread> clients;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options.clients; i++) clients.emplace_back(runLoadClient, i, std::cref(options), port, std::ref(stats[i]));
+    for (auto& client : clients) client.join();
+    double elapsedSeconds = millisecondsSince(start) / 1000;
+    stop = true;
+    serverThread.join();
+    server.store.reopen("chunks");
+    std::filesystem::remove_all(dir, ec);
+
+    LoadClientStats total;
+    std::vector<double> syncMs;
+    int failed = 0;
+    for (auto& s : stats) {
+        failed += s.failed;
+        if (!s.failed) syncMs.push_back(s.syncMs);
+        total.editsSent += s.editsSent;
+        total.accepted += s.accepted;
+        total.rejected += s.rejected;
+        total.latencyMs.insert(total.latencyMs.end(), s.latencyMs.begin(), s.latencyMs.end());
+        total.bytesSent += s.bytesSent;
+        total.bytesReceived += s.bytesReceived;
+        total.chunks += s.chunks;
+        total.chunkBytes += s.chunkBytes;
+        total.deltas += s.deltas;
+        total.deltaEdits += s.deltaEdits;
+        total.deltaBytes += s.deltaBytes;
+        total.resyncs += s.resyncs;
+        total.resyncsByDelta += s.resyncsByDelta;
+        total.versionGaps += s.versionGaps;
+    }
+
+    std::ofstream file;
+    if (!options.out.empty()) {
+        file.open(options.out);
+        if (!file) {
+            std::cerr << "Cannot write " << options.out << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = options.out.empty() ? std::cout : file;
+    double perClientSecond = options.clients * std::max(elapsedSeconds, 1e-9);
+    out << "{\n  \"clients\": " << options.clients << ",\n  \"failed_clients\": " << failed
+        << ",\n  \"seconds\": " << elapsedSeconds << ",\n  \"edit_rate\": " << options.editRate
+        << ",\n  \"radius\": " << options.radius
+        << ",\n  \"edits\": {\"sent\": " << total.editsSent << ", \"accepted\": " << total.accepted
+        << ", \"rejected\": " << total.rejected << "}"
+        << ",\n  \"edit_latency_ms\": ";
+    writeTimingJson(out, total.latencyMs);
+    out << ",\n  \"initial_sync_ms\": ";
+    writeTimingJson(out, syncMs);
+    out << ",\n  \"bandwidth\": {\"up_bytes\": " << total.bytesSent << ", \"down_bytes\": " << total.bytesReceived
+        << ", \"up_bytes_per_client_second\": " << total.bytesSent / perClientSecond
+        << ", \"down_bytes_per_client_second\": " << total.bytesReceived / perClientSecond << "}"
+        << ",\n  \"chunks\": {\"sent\": " << total.chunks << ", \"bytes\": " << total.chunkBytes
+        << ", \"bytes_per_chunk\": " << (total.chunks ? (double)total.chunkBytes / total.chunks : 0) << "}"
+        << ",\n  \"deltas\": {\"sent\": " << total.deltas << ", \"edits\": " << total.deltaEdits
+        << ", \"bytes\": " << total.deltaBytes
+        << ", \"bytes_per_edit\": " << (total.deltaEdits ? (double)total.deltaBytes / total.deltaEdits : 0) << "}"
+        << ",\n  \"resyncs\": {\"count\": " << total.resyncs << ", \"by_delta\": " << total.resyncsByDelta << "}"
+        << ",\n  \"version_gaps\": " << total.versionGaps << "\n}" << std::endl;
+    return failed || total.versionGaps ? 1 : 0;
+}
+
+// --------------------
+// Command line
+// --------------------
+std::atomic<bool> stopRequested{false};
+
+void requestStop(int) { stopRequested = true; }
+
+int usage() {
+    std::cerr << "usage: world-server [dir] [--port N] [--any-address]\n"
+                 "       world-server load-test [--clients N] [--seconds S] [--edit-rate R] [--radius R] [--out file.json]"
+              << std::endl;
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && !std::strcmp(argv[1], "load-test")) {
+        LoadTestOptions options;
+        for (int i = 2; i < argc; i++) {
+            if (!std::strcmp(argv[i], "--clients") && i + 1 < argc) options.clients = std::max(1, atoi(argv[++i]));
+            else if (!std::strcmp(argv[i], "--seconds") && i + 1 < argc) options.seconds = std::max(0.1, atof(argv[++i]));
+            else if (!std::strcmp(argv[i], "--edit-rate") && i + 1 < argc) options.editRate = std::max(0.0, atof(argv[++i]));
+            else if (!std::strcmp(argv[i], "--radius") && i + 1 < argc) options.radius = std::clamp(atoi(argv[++i]), 0, 8);
+            else if (!std::strcmp(argv[i], "--out") && i + 1 < argc) options.out = argv[++i];
+            else return usage();
+        }
+        return runLoadTest(options);
+    }
+
+    std::string dir = "chunks";
+    uint16_t port = DEFAULT_SERVER_PORT;
+    bool anyAddress = false;
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--port") && i + 1 < argc) port = (uint16_t)atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--any-address")) anyAddress = true;
+        else if (argv[i][0] != '-') dir = argv[i];
+        else return usage();
+    }
+    if (!openServer(dir, port, anyAddress)) return 1;
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+    std::cout << "Serving " << dir << " on port " << boundPort(server.listener) << std::endl;
+    serveWorld(stopRequested);
+    std::cout << "Saved " << dir << ", " << server.stats.editsAccepted << " edits accepted, "
+              << server.stats.editsRejected << " rejected" << std::endl;
+    return 0;
+}
@@ -0,0 +1,375 @@
+// Offline maintenance for a world directory (region files, legacy
+// chunk_X_Z.bin files, world.seed, edit journal). Needs no window or GL, so
+// it can run on a server. Do not run `repair` while the game has the world
+// open: both write the same region files.
+//
+//   world-tool stats  <dir>   counts, bytes and the most used colors
+//   world-tool check  <dir>   validates every chunk; exits 1 if any is damaged
+//   world-tool repair <dir>   migrates legacy files, then rewrites every
+//                             region without damaged chunks, duplicate blocks,
+//                             unedited chunks or slack space
+//
+// Options: --threads N (default: all cores), --top N (colors listed, 10)
+#include "region-storage.hpp"
+#include "terrain.hpp"
+#include "edit-journal.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <thread>
+
+const int DEFAULT_TOP_COLORS = 10;
+
+// --------------------
+// Scan results
+// --------------------
+// Filled per region file by one worker, then summed
+struct WorldStats {
+    int regionFiles = 0;
+    int badRegionFiles = 0;    // header unreadable
+    int chunks = 0;
+    int damagedChunks = 0;     // out of file bounds, overlapping, bad checksum or undecodable
+    int pristineChunks = 0;    // identical to freshly generated terrain
+    int legacyFiles = 0;
+    int badLegacyFiles = 0;
+    uint64_t blocks = 0;
+    uint64_t dynamicBlocks = 0;
+    uint64_t duplicateBlocks = 0;    // same position as a later block of the chunk
+    uint64_t outOfChunkBlocks = 0;   // legacy files only; regions cannot express them
+    uint64_t fileBytes = 0;
+    uint64_t payloadBytes = 0;       // compressed, as stored
+    uint64_t rawBytes = 0;           // before compression
+    uint64_t bytesAfterRepair = 0;
+    std::unordered_map<uint32_t, uint64_t> colors;
+
+    void add(const WorldStats& o) {
+        regionFiles += o.regionFiles;
+        badRegionFiles += o.badRegionFiles;
+        chunks += o.chunks;
+        damagedChunks += o.damagedChunks;
+        pristineChunks += o.pristineChunks;
+        legacyFiles += o.legacyFiles;
+        badLegacyFiles += o.badLegacyFiles;
+        blocks += o.blocks;
+        dynamicBlocks += o.dynamicBlocks;
+        duplicateBlocks += o.duplicateBlocks;
+        outOfChunkBlocks += o.outOfChunkBlocks;
+        fileBytes += o.fileBytes;
+        payloadBytes += o.payloadBytes;
+        rawBytes += o.rawBytes;
+        bytesAfterRepair += o.bytesAfterRepair;
+        for (auto& [color, count] : o.colors) colors[color] += count;
+    }
+};
+
+struct ToolOptions {
+    std::string command, dir;
+    int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    int topColors = DEFAULT_TOP_COLORS;
+    bool hasSeed = false;
+    uint64_t seed = 0;
+};
+
+// --------------------
+// Chunk checks
+// --------------------
+// Keeps the last block at each position, which is the one the game ends up
+// with when it loads the chunk. Returns the number removed.
+size_t removeDuplicateBlocks(StoredChunk& chunk) {
+    std::stable_sort(chunk.blocks.begin(), chunk.blocks.end(), [](const StoredBlock& a, const StoredBlock& b) {
+        if (a.y != b.y) return a.y < b.y;
+        if (a.z != b.z) return a.z < b.z;
+        return a.x < b.x;
+    });
+    auto samePos = [](const StoredBlock& a, const StoredBlock& b) { return a.x == b.x && a.y == b.y && a.z == b.z; };
+    size_t kept = 0;
+    for (size_t i = 0; i < chunk.blocks.size(); i++) {
+        if (i + 1 < chunk.blocks.size() && samePos(chunk.blocks[i], chunk.blocks[i + 1])) continue;
+        chunk.blocks[kept++] = chunk.blocks[i];
+    }
+    size_t removed = chunk.blocks.size() - kept;
+    chunk.blocks.resize(kept);
+    return removed;
+}
+
+// True if the chunk holds exactly the terrain the game would generate for
+// it, so it need not be stored. Expects removeDuplicateBlocks' order.
+bool isPristineChunk(const ToolOptions& options, const StoredChunk& chunk) {
+    if (!options.hasSeed) return false;
+    StoredChunk generated;
+    generateTerrainChunk(options.seed, chunk.cx, chunk.cz, generated);
+    if (generated.blocks.size() != chunk.blocks.size()) return false;
+    removeDuplicateBlocks(generated);
+    for (size_t i = 0; i < chunk.blocks.size(); i++) {
+        const StoredBlock& a = chunk.blocks[i];
+        const StoredBlock& b = generated.blocks[i];
+        if (a.x != b.x || a.y != b.y || a.z != b.z || a.color != b.color || a.rotate != b.rotate) return false;
+    }
+    return true;
+}
+
+void countBlocks(const StoredChunk& chunk, WorldStats& stats) {
+    stats.blocks += chunk.blocks.size();
+    for (auto& b : chunk.blocks) {
+        stats.dynamicBlocks += b.rotate;
+        stats.colors[b.color]++;
+    }
+}
+
+// --------------------
+// Region files
+// --------------------
+bool parseRegionName(const std::string& name, int& rx, int& rz) {
+    return std::sscanf(name.c_str(), "region_%d_%d.region", &rx, &rz) == 2 &&
+           name == "region_" + std::to_string(rx) + "_" + std::to_string(rz) + ".region";
+}
+
+// Writes the chunks as a fresh region file next to path and swaps it in.
+// A region left with no chunks is deleted.
+bool rewriteRegion(const std::string& path, const std::vector<StoredChunk>& chunks, uint64_t& bytesWritten) {
+    std::error_code ec;
+    bytesWritten = 0;
+    if (chunks.empty()) return std::filesystem::remove(path, ec) || !ec;
+    std::vector<uint8_t> payloads;
+    std::vector<RegionEntry> entries(REGION_CHUNKS);
+    for (auto& chunk : chunks) {
+        std::vector<uint8_t> raw = encodeChunkPayload(chunk);
+        std::vector<uint8_t> compressed = lz4Compress(raw);
+        RegionEntry& entry = entries[regionSlot(chunk.cx, chunk.cz)];
+        entry.offset = (uint32_t)(REGION_HEADER_BYTES + payloads.size());
+        entry.capacity = entry.size = (uint32_t)compressed.size();
+        entry.rawSize = (uint32_t)raw.size();
+        entry.checksum = fnv1a(compressed.data(), compressed.size());
+        payloads.insert(payloads.end(), compressed.begin(), compressed.end());
+    }
+    std::vector<uint8_t> file;
+    putU32(file, REGION_MAGIC);
+    putU32(file, REGION_VERSION);
+    for (auto& entry : entries) {
+        putU32(file, entry.offset);
+        putU32(file, entry.capacity);
+        putU32(file, entry.size);
+        putU32(file, entry.rawSize);
+        putU32(file, entry.checksum);
+    }
+    file.insert(file.end(), payloads.begin(), payloads.end());
+
+    std::string tmpPath = path + ".tmp";
+    FILE* out = std::fopen(tmpPath.c_str(), "wb");
+    if (!out) return false;
+    bool ok = std::fwrite(file.data(), 1, file.size(), out) == file.size();
+    ok = std::fclose(out) == 0 && ok;
+    if (ok) std::filesystem::rename(tmpPath, path, ec);
+    if (!ok || ec) {
+        std::filesystem::remove(tmpPath, ec);
+        return false;
+    }
+    bytesWritten = file.size();
+    return true;
+}
+
+// Validates every entry of one region file; with `repair` also rewrites it
+void scanRegion(const ToolOptions& options, const std::filesystem::path& path, int rx, int rz, WorldStats& stats) {
+    std::string name = path.filename().string();
+    bool repair = options.command == "repair";
+    std::error_code ec;
+    stats.regionFiles++;
+    stats.fileBytes += std::filesystem::file_size(path, ec);
+    FILE* file = std::fopen(path.string().c_str(), "rb");
+    RegionFile region;
+    if (!file || !readRegionHeader(file, region)) {
+        if (file) std::fclose(file);
+        stats.badRegionFiles++;
+        std::fprintf(stderr, "%s: not a readable region file\n", name.c_str());
+        // The game refuses to write to it; move it out of the way
+        if (repair) std::filesystem::rename(path, path.string() + ".bad", ec);
+        return;
+    }
+
+    // Entries must lie after the header, inside the file and apart from
+    // each other
+    std::vector<int> slots;
+    for (int slot = 0; slot < REGION_CHUNKS; slot++) {
+        if (region.entries[slot].size) slots.push_back(slot);
+    }
+    std::sort(slots.begin(), slots.end(), [&](int a, int b) { return region.entries[a].offset < region.entries[b].offset; });
+    std::vector<bool> damaged(REGION_CHUNKS, false);
+    uint64_t previousEnd = REGION_HEADER_BYTES;
+    for (int slot : slots) {
+        const RegionEntry& entry = region.entries[slot];
+        uint64_t entryEnd = (uint64_t)entry.offset + entry.size;
+        if (entry.offset < previousEnd || entryEnd > region.end || entry.size > entry.capacity) damaged[slot] = true;
+        previousEnd = std::max(previousEnd, (uint64_t)entry.offset + std::max(entry.size, entry.capacity));
+    }
+
+    std::vector<StoredChunk> kept;
+    for (int slot : slots) {
+        const RegionEntry& entry = region.entries[slot];
+        StoredChunk chunk;
+        chunk.cx = rx * REGION_SIZE + slot % REGION_SIZE;
+        chunk.cz = rz * REGION_SIZE + slot / REGION_SIZE;
+        stats.chunks++;
+        if (damaged[slot] || !readRegionChunk(file, entry, chunk)) {
+            stats.damagedChunks++;
+            std::fprintf(stderr, "%s: chunk %d,%d is damaged\n", name.c_str(), chunk.cx, chunk.cz);
+            continue;
+        }
+        stats.payloadBytes += entry.size;
+        stats.rawBytes += entry.rawSize;
+        stats.duplicateBlocks += removeDuplicateBlocks(chunk);
+        countBlocks(chunk, stats);
+        if (isPristineChunk(options, chunk)) stats.pristineChunks++;
+        else kept.push_back(std::move(chunk));
+    }
+    std::fclose(file);
+
+    if (repair) {
+        uint64_t written;
+        if (!rewriteRegion(path.string(), kept, written)) {
+            std::fprintf(stderr, "%s: could not rewrite\n", name.c_str());
+            written = std::filesystem::file_size(path, ec);
+        }
+        stats.bytesAfterRepair += written;
+    }
+}
+
+// Legacy files are only checked here; repair migrates them beforehand
+void scanLegacyFile(const std::filesystem::path& path, int cx, int cz, WorldStats& stats) {
+    std::error_code ec;
+    uint64_t bytes = std::filesystem::file_size(path, ec);
+    stats.legacyFiles++;
+    stats.fileBytes += bytes;
+    StoredChunk chunk;
+    if (!readLegacyChunk(path.string(), cx, cz, chunk)) {
+        stats.badLegacyFiles++;
+        std::fprintf(stderr, "%s: truncated or bad block count\n", path.filename().string().c_str());
+        return;
+    }
+    uint64_t records = (bytes - sizeof(uint64_t)) / (6 * sizeof(float));
+    stats.outOfChunkBlocks += records - chunk.blocks.size();
+    stats.duplicateBlocks += removeDuplicateBlocks(chunk);
+    countBlocks(chunk, stats);
+}
+
+// --------------------
+// Whole directory
+// --------------------
+// Region files are independent, so workers take them one at a time
+WorldStats scanWorld(const ToolOptions& options) {
+    namespace fs = std::filesystem;
+    struct Job {
+        fs::path path;
+        bool legacy;
+        int x, z;
+    };
+    std::vector<Job> jobs;
+    std::error_code ec;
+    for (auto& entry : fs::directory_iterator(options.dir, ec)) {
+        std::string name = entry.path().filename().string();
+        int x, z;
+        if (parseRegionName(name, x, z)) jobs.push_back({entry.path(), false, x, z});
+        else if (parseLegacyChunkName(name, x, z)) jobs.push_back({entry.path(), true, x, z});
+    }
+
+    std::atomic<size_t> next{0};
+    int threads = std::max(1, std::min(options.threads, (int)jobs.size()));
+    std::vector<WorldStats> perThread(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            for (size_t i; (i = next++) < jobs.size();) {
+                const Job& job = jobs[i];
+                if (job.legacy) scanLegacyFile(job.path, job.x, job.z, perThread[t]);
+                else scanRegion(options, job.path, job.x, job.z, perThread[t]);
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    WorldStats total;
+    for (auto& stats : perThread) total.add(stats);
+    return total;
+}
+
+void printStats(const ToolOptions& options, const WorldStats& stats) {
+    auto mb = [](uint64_t bytes) { return bytes / (1024.0 * 1024.0); };
+    std::printf("region files      %d (%d unreadable)\n", stats.regionFiles, stats.badRegionFiles);
+    std::printf("legacy files      %d (%d unreadable)\n", stats.legacyFiles, stats.badLegacyFiles);
+    std::printf("chunks            %d (%d damaged, %d unedited%s)\n", stats.chunks, stats.damagedChunks,
+                stats.pristineChunks, options.hasSeed ? "" : ", no world.seed to compare with");
+    std::printf("blocks            %llu (%llu dynamic)\n", (unsigned long long)stats.blocks,
+                (unsigned long long)stats.dynamicBlocks);
+    std::printf("duplicate blocks  %llu\n", (unsigned long long)stats.duplicateBlocks);
+    std::printf("out-of-chunk      %llu\n", (unsigned long long)stats.outOfChunkBlocks);
+    std::printf("file bytes        %.2f MB\n", mb(stats.fileBytes));
+    std::printf("chunk payloads    %.2f MB stored, %.2f MB raw (%.2fx)\n", mb(stats.payloadBytes), mb(stats.rawBytes),
+                stats.payloadBytes ? (double)stats.rawBytes / stats.payloadBytes : 0.0);
+    if (stats.blocks) {
+        std::printf("bytes per block   %.2f\n", (double)stats.payloadBytes / stats.blocks);
+    }
+    if (options.command == "repair") std::printf("after repair      %.2f MB\n", mb(stats.bytesAfterRepair));
+
+    std::vector<std::pair<uint32_t, uint64_t>> colors(stats.colors.begin(), stats.colors.end());
+    std::sort(colors.begin(), colors.end(), [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    std::printf("colors            %zu distinct\n", colors.size());
+    for (size_t i = 0; i < colors.size() && (int)i < options.topColors; i++) {
+        std::printf("  #%06X  %12llu  %5.1f%%\n", colors[i].first, (unsigned long long)colors[i].second,
+                    100.0 * colors[i].second / stats.blocks);
+    }
+}
+
+// --------------------
+// Main
+// --------------------
+int usage() {
+    std::cerr << "usage: world-tool stats|check|repair <world dir> [--threads N] [--top N]" << std::endl;
+    return 2;
+}
+
+int main(int argc, char** argv) {
+    ToolOptions options;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) options.threads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--top" && i + 1 < argc) options.topColors = std::max(0, std::atoi(argv[++i]));
+        else if (arg.size() > 1 && arg[0] == '-') return usage();
+        else positional.push_back(arg);
+    }
+    if (positional.size() != 2) return usage();
+    options.command = positional[0];
+    options.dir = positional[1];
+    if (options.command != "stats" && options.command != "check" && options.command != "repair") return usage();
+    std::error_code ec;
+    if (!std::filesystem::is_directory(options.dir, ec)) {
+        std::cerr << options.dir << " is not a directory" << std::endl;
+        return 2;
+    }
+
+    // Without the seed, unedited chunks cannot be recognised; never create
+    // one here (loadWorldSeed would)
+    std::ifstream seedFile(options.dir + "/world.seed");
+    options.hasSeed = (bool)(seedFile >> options.seed);
+
+    std::vector<JournalEdit> edits;
+    readJournal(options.dir + "/edits.journal.old", edits);
+    readJournal(options.dir + "/edits.journal", edits);
+    if (!edits.empty()) {
+        std::cout << edits.size() << " journaled edits not yet in the store; the game replays them on its next start"
+                  << std::endl;
+    }
+
+    if (options.command == "repair") {
+        RegionStore store(options.dir);
+        int migrated = migrateLegacyChunks(store);
+        if (migrated) std::cout << "Migrated " << migrated << " legacy chunk files" << std::endl;
+    }
+    WorldStats stats = scanWorld(options);
+    printStats(options, stats);
+    if (options.command == "check") {
+        return stats.badRegionFiles || stats.damagedChunks || stats.badLegacyFiles ? 1 : 0;
+    }
+    return 0;
+}